@@ -0,0 +1,450 @@
+// Microbenchmarks of the hot paths: parsing of API responses, world updates & lookups,
+// travel map path building and text layout. No window, no network, inputs are generated
+// from a fixed seed so runs are comparable between versions.
+//
+// Every benchmark is timed in a number of samples, each long enough to not be noise, and
+// reported as one line of key=value pairs: median, fastest & slowest sample per op, and
+// per item (tile, step, glyph run) where it makes sense. Meant to be diffed or fed to a script.
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>    // strtol, strtod, qsort
+#include <string.h>
+
+#include <fontstash.h>
+
+#include "utils.h"
+#include "log.h"
+#include "timer.h"
+#include "allocator.h"
+#include "json.h"
+#include "api.h"
+#include "world.h"
+#include "path.h"
+#include "render_text_layout.h"
+
+#define DEFAULT_SAMPLES   10
+#define DEFAULT_SAMPLE_MS 20.0
+#define DEFAULT_SEED      1
+// Same font the game renders with, see game.c.
+#define DEFAULT_FONT      "assets/fonts/Ancient_Lighthouse_Regular.otf"
+
+#define MAX_SAMPLES 100
+
+// Both planes whole, with room to spare so nothing is evicted.
+#define WORLD_BLOCKS 1024
+// Share of hidden tiles in generated maps, fog of the mock server is about that.
+#define HIDDEN_PERCENT 10
+
+// Path starts there, far enough from the plane edges.
+#define PATH_X 64
+#define PATH_Y 64
+
+// Map sizes the client asks for: a block, a couple of them, the travel map view area & the whole plane.
+static const uint32_t MAP_SIZES[] = { 16, 32, 64, WORLD_PLANE_SIZE };
+
+// Indexed by world_terrain_t, as api.c knows them.
+static const char* TERRAIN_NAMES[] = {
+	"rock", "rock_water", "rock_solid", "rock", "rock_sand", "wild", "grass",
+	"earth", "clay", "sand", "water", "water_bottom", "water_deep"
+};
+
+typedef void (*bench_fn_t)(void* user);
+
+typedef struct {
+	uint32_t   size;
+	char*      json;
+	api_map_t* map;
+} map_case_t;
+
+typedef struct {
+	uint32_t    num_samples;
+	double      sample_ms;
+	uint32_t    seed;
+	const char* filter;
+	const char* font;
+} config_t;
+
+static struct {
+	config_t config;
+
+	uint32_t random;
+
+	map_case_t maps[ARRAY_SIZE(MAP_SIZES)];
+	char*      state_json;
+
+	// Fully revealed, for lookups & paths.
+	struct world_t* world;
+	// Gets the generated maps, hidden tiles included.
+	struct world_t* world_update;
+
+	path_t  path;
+	int32_t path_script[PATH_MAX_LENGTH][2];
+	size_t  path_script_length;
+
+	FONScontext* fons;
+
+	// Results go there, so nothing is optimized away.
+	volatile uint64_t sink;
+} s_ctx;
+
+static uint32_t random_next() {
+	uint32_t x = s_ctx.random;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return s_ctx.random = x;
+}
+
+// INPUTS
+// ======
+
+static uint8_t random_terrain() {
+	return 1 + random_next() % (ARRAY_SIZE(TERRAIN_NAMES) - 1);
+}
+
+// Same shape as the server answers with, see server/mock_server.c.
+static char* map_json(uint32_t size, bool has_hidden) {
+	// Longest tile is { "static_id": "water_bottom" } with a separator.
+	const size_t capacity = 64 + (size_t)size * (size + 4) * 40;
+
+	char*  json   = BR_ALLOC(allocator_main(), capacity);
+	size_t length = snprintf(json, capacity, "{ \"x\": 0, \"y\": 0, \"map\": [");
+
+	for (uint32_t y = 0; y < size; ++y) {
+		length += snprintf(json + length, capacity - length, "%s[", y == 0 ? "" : ", ");
+		for (uint32_t x = 0; x < size; ++x) {
+			const char* separator = x == 0 ? "" : ", ";
+			if (has_hidden && random_next() % 100 < HIDDEN_PERCENT) {
+				length += snprintf(json + length, capacity - length, "%s{ \"hidden\": true }", separator);
+			} else {
+				length += snprintf(json + length, capacity - length, "%s{ \"static_id\": \"%s\" }", separator, TERRAIN_NAMES[random_terrain()]);
+			}
+		}
+		length += snprintf(json + length, capacity - length, "]");
+	}
+	snprintf(json + length, capacity - length, "] }");
+
+	return json;
+}
+
+static char* state_json() {
+	static const char* RESOURCE =
+		"{ \"last_update\": 1500000000, \"booster_time\": 0, \"value\": 7, \"max\": 12, "
+		"\"regen_rate\": 5, \"filled_segments\": 7, \"segment_time\": 3 }";
+
+	const size_t capacity = 1024;
+
+	char* json = BR_ALLOC(allocator_main(), capacity);
+	snprintf(json, capacity,
+		"{ \"timestamp\": 1500000000, \"player\": { \"username\": \"bench\", \"plane_id\": \"bench\", "
+		"\"level\": 3, \"experience\": 250, \"money\": 1200, \"x\": %d, \"y\": %d, \"avatar\": \"avatar_man1\", "
+		"\"mind\": %s, \"matter\": %s } }",
+		PATH_X, PATH_Y, RESOURCE, RESOURCE);
+
+	return json;
+}
+
+static api_map_t* map_parsed(const char* json, uint32_t size) {
+	api_map_t* map = BR_ALLOC(allocator_main(), sizeof(api_map_t) + sizeof(api_map_terrain_t) * size * size);
+	if (!api_parse_map(allocator_main(), json, map)) log_fatal("[bench] Generated map doesn't parse");
+	return map;
+}
+
+// Cursor dragged away from the player, a step sideways & a diagonal one in turn,
+// the way a path is drawn across the map.
+static void path_script_init() {
+	int32_t x     = PATH_X;
+	int32_t y     = PATH_Y;
+	size_t  steps = 0;
+
+	for (size_t i = 0; steps + 2 <= PATH_MAX_LENGTH; ++i) {
+		const bool is_diagonal = i % 2;
+
+		x += 1;
+		y += is_diagonal;
+		steps += is_diagonal ? 2 : 1;
+
+		s_ctx.path_script[s_ctx.path_script_length][0] = x;
+		s_ctx.path_script[s_ctx.path_script_length][1] = y;
+		++s_ctx.path_script_length;
+	}
+}
+
+// No GPU: glyphs are still rasterized into the atlas & quads laid out, nothing is uploaded or drawn.
+static int fons_create(void* uptr, int width, int height) { return 1; }
+static int fons_resize(void* uptr, int width, int height) { return 1; }
+static void fons_update(void* uptr, int* rect, const unsigned char* data) {}
+static void fons_draw(void* uptr, const float* verts, const float* tcoords, const unsigned int* colors, int nverts) {
+	s_ctx.sink += nverts;
+}
+
+static bool fons_init(const char* path) {
+	FONSparams params;
+	memset(&params, 0, sizeof(params));
+
+	params.renderCreate = fons_create;
+	params.renderResize = fons_resize;
+	params.renderUpdate = fons_update;
+	params.renderDraw   = fons_draw;
+
+	s_ctx.fons = render_text_layout_create(&params);
+	if (render_text_layout_load_font(s_ctx.fons, "regular", path)) return true;
+
+	render_text_layout_destroy(s_ctx.fons);
+	return false;
+}
+
+// BENCHMARKS
+// ==========
+
+static void bench_json_parse(void* user) {
+	const map_case_t* c = user;
+
+	struct json_t* json = json_parse(allocator_main(), c->json);
+	s_ctx.sink += json != NULL;
+	json_free(json);
+}
+
+static void bench_api_parse_map(void* user) {
+	const map_case_t* c = user;
+
+	s_ctx.sink += api_parse_map(allocator_main(), c->json, c->map);
+}
+
+static void bench_api_parse_state(void* user) {
+	api_state_t state;
+	s_ctx.sink += api_parse_state(allocator_main(), s_ctx.state_json, &state);
+}
+
+static void bench_world_update_data(void* user) {
+	const map_case_t* c = user;
+
+	world_update_data(s_ctx.world_update, c->map);
+}
+
+static void bench_world_is_hidden(void* user) {
+	uint64_t count = 0;
+	for (int32_t x = 0; x < WORLD_PLANE_SIZE; ++x) {
+		for (int32_t y = 0; y < WORLD_PLANE_SIZE; ++y) {
+			count += world_is_hidden(s_ctx.world, x, y);
+		}
+	}
+	s_ctx.sink += count;
+}
+
+static void bench_world_terrain(void* user) {
+	uint64_t sum = 0;
+	for (int32_t x = 0; x < WORLD_PLANE_SIZE; ++x) {
+		for (int32_t y = 0; y < WORLD_PLANE_SIZE; ++y) {
+			sum += world_terrain(s_ctx.world, x, y);
+		}
+	}
+	s_ctx.sink += sum;
+}
+
+static void bench_path_build(void* user) {
+	path_reset(&s_ctx.path);
+	for (size_t i = 0; i < s_ctx.path_script_length; ++i) {
+		path_input(&s_ctx.path, s_ctx.world, PATH_X, PATH_Y, s_ctx.path_script[i][0], s_ctx.path_script[i][1]);
+	}
+	s_ctx.sink += s_ctx.path.num_steps;
+}
+
+// Costs are taken, then the player walks it all step by step.
+static void bench_path_walk(void* user) {
+	bench_path_build(user);
+
+	uint8_t costs[PATH_MAX_LENGTH];
+	path_costs(&s_ctx.path, costs);
+
+	const path_t walked = s_ctx.path;
+	for (size_t i = 0; i < walked.num_steps; ++i) {
+		path_trim_walked(&s_ctx.path, walked.steps[i].tx, walked.steps[i].ty);
+	}
+	s_ctx.sink += costs[0] + s_ctx.path.num_steps;
+}
+
+// Step totals of a whole path, as the travel map labels them.
+// Bounds & shadow are asked for as well, so every part of the layout is timed.
+static void bench_render_text(void* user) {
+	float w, h;
+	const render_text_t params = {
+		.font     = "regular",
+		.size_pt  = 24.0f,
+		.color    = 0xFFFFFFFF,
+		.align    = RENDER_TEXT_ALIGN_CENTER | RENDER_TEXT_ALIGN_MIDDLE,
+		.bounds_w = &w,
+		.bounds_h = &h,
+		.shadow   = true
+	};
+
+	char buf[8];
+	for (size_t i = 0; i < PATH_MAX_LENGTH; ++i) {
+		snprintf(buf, sizeof(buf), "%zu", i);
+		render_text_layout(s_ctx.fons, buf, 0.0f, 0.0f, &params);
+	}
+	s_ctx.sink += w + h;
+}
+
+// RUNNER
+// ======
+
+static double measure(bench_fn_t fn, void* user, uint64_t iterations) {
+	const double start = timer_current();
+	for (uint64_t i = 0; i < iterations; ++i) {
+		fn(user);
+	}
+	return timer_current() - start;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+	const double x = *(const double*)a;
+	const double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+// Items are what an op goes through (tiles, steps...), 0 if it's one thing.
+static void run(const char* name, bench_fn_t fn, void* user, uint64_t items) {
+	assert(name);
+	assert(fn);
+
+	const config_t* c = &s_ctx.config;
+	if (c->filter && !strstr(name, c->filter)) return;
+
+	// Warms up caches & lazy allocations, then doubles the iterations till a sample is long enough.
+	uint64_t iterations = 1;
+	measure(fn, user, iterations);
+	while (measure(fn, user, iterations) < c->sample_ms) {
+		iterations *= 2;
+	}
+
+	double samples[MAX_SAMPLES];
+	for (uint32_t i = 0; i < c->num_samples; ++i) {
+		samples[i] = measure(fn, user, iterations) * 1e6 / iterations;
+	}
+	qsort(samples, c->num_samples, sizeof(double), compare_doubles);
+
+	const double median = samples[c->num_samples / 2];
+
+	printf("bench name=%s iterations=%llu samples=%u ns_per_op=%.1f ns_min=%.1f ns_max=%.1f",
+		name, (unsigned long long)iterations, c->num_samples, median, samples[0], samples[c->num_samples - 1]);
+	if (items > 0) printf(" items=%llu ns_per_item=%.2f", (unsigned long long)items, median / items);
+	printf("\n");
+
+	fflush(stdout);
+}
+
+static void usage() {
+	log_error("Usage: b4re_bench [options]");
+	log_error("  --samples N        samples per benchmark, median is reported, up to %u (%u)", MAX_SAMPLES, DEFAULT_SAMPLES);
+	log_error("  --sample-ms MS     minimum length of a sample (%.0f)", DEFAULT_SAMPLE_MS);
+	log_error("  --seed N           seed of the generated maps (%u)", DEFAULT_SEED);
+	log_error("  --filter TEXT      runs only benchmarks with it in the name");
+	log_error("  --font PATH        font for the text layout one, skipped if missing (%s)", DEFAULT_FONT);
+}
+
+static void parse_args(int argc, const char* argv[], config_t* c) {
+	for (int i = 1; i < argc; ++i) {
+		const char* arg   = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if      (strcmp(arg, "--samples") == 0 && value)   c->num_samples = strtol(argv[++i], NULL, 10);
+		else if (strcmp(arg, "--sample-ms") == 0 && value) c->sample_ms   = strtod(argv[++i], NULL);
+		else if (strcmp(arg, "--seed") == 0 && value)      c->seed        = strtol(argv[++i], NULL, 10);
+		else if (strcmp(arg, "--filter") == 0 && value)    c->filter      = argv[++i];
+		else if (strcmp(arg, "--font") == 0 && value)      c->font        = argv[++i];
+		else {
+			usage();
+			exit(strcmp(arg, "--help") == 0 ? 0 : 1);
+		}
+	}
+
+	if (c->num_samples == 0 || c->num_samples > MAX_SAMPLES || c->sample_ms <= 0.0) {
+		usage();
+		exit(1);
+	}
+}
+
+int main(int argc, const char* argv[]) {
+	config_t* c = &s_ctx.config;
+	c->num_samples = DEFAULT_SAMPLES;
+	c->sample_ms   = DEFAULT_SAMPLE_MS;
+	c->seed        = DEFAULT_SEED;
+	c->font        = DEFAULT_FONT;
+	parse_args(argc, argv, c);
+
+	log_set_info(false);
+
+	allocator_t* alloc = allocator_main();
+
+	s_ctx.random = (c->seed * 2654435761u) | 1;
+
+	for (size_t i = 0; i < ARRAY_SIZE(MAP_SIZES); ++i) {
+		map_case_t* m = &s_ctx.maps[i];
+		m->size = MAP_SIZES[i];
+		m->json = map_json(m->size, true);
+		m->map  = map_parsed(m->json, m->size);
+	}
+	s_ctx.state_json = state_json();
+
+	world_init(alloc, WORLD_BLOCKS);
+	s_ctx.world        = world_for_plane("bench");
+	s_ctx.world_update = world_for_plane("bench_update");
+	world_activate(s_ctx.world);
+
+	char*      revealed_json = map_json(WORLD_PLANE_SIZE, false);
+	api_map_t* revealed      = map_parsed(revealed_json, WORLD_PLANE_SIZE);
+	world_update_data(s_ctx.world, revealed);
+	BR_FREE(alloc, revealed);
+	BR_FREE(alloc, revealed_json);
+
+	path_script_init();
+
+	printf("run seed=%u samples=%u sample_ms=%.1f\n", c->seed, c->num_samples, c->sample_ms);
+
+	char name[64];
+	for (size_t i = 0; i < ARRAY_SIZE(MAP_SIZES); ++i) {
+		map_case_t*    m     = &s_ctx.maps[i];
+		const uint64_t tiles = (uint64_t)m->size * m->size;
+
+		snprintf(name, sizeof(name), "json_parse/%u", m->size);
+		run(name, bench_json_parse, m, tiles);
+		snprintf(name, sizeof(name), "api_parse_map/%u", m->size);
+		run(name, bench_api_parse_map, m, tiles);
+	}
+	run("api_parse_state", bench_api_parse_state, NULL, 0);
+
+	for (size_t i = 0; i < ARRAY_SIZE(MAP_SIZES); ++i) {
+		map_case_t* m = &s_ctx.maps[i];
+
+		snprintf(name, sizeof(name), "world_update_data/%u", m->size);
+		run(name, bench_world_update_data, m, (uint64_t)m->size * m->size);
+	}
+	run("world_is_hidden/plane", bench_world_is_hidden, NULL, WORLD_PLANE_SIZE * WORLD_PLANE_SIZE);
+	run("world_terrain/plane",   bench_world_terrain,   NULL, WORLD_PLANE_SIZE * WORLD_PLANE_SIZE);
+
+	bench_path_build(NULL);
+	const uint64_t steps = s_ctx.path.num_steps;
+	run("path_build", bench_path_build, NULL, steps);
+	run("path_walk",  bench_path_walk,  NULL, steps);
+
+	if (fons_init(c->font)) {
+		run("render_text/path_labels", bench_render_text, NULL, PATH_MAX_LENGTH);
+		render_text_layout_destroy(s_ctx.fons);
+	} else if (!c->filter || strstr("render_text/path_labels", c->filter)) {
+		log_error("[bench] No font at %s, skipping render_text", c->font);
+	}
+
+	world_shutdown();
+
+	for (size_t i = 0; i < ARRAY_SIZE(MAP_SIZES); ++i) {
+		BR_FREE(alloc, s_ctx.maps[i].map);
+		BR_FREE(alloc, s_ctx.maps[i].json);
+	}
+	BR_FREE(alloc, s_ctx.state_json);
+
+	return 0;
+}
@@ -0,0 +1,432 @@
+// Headless load generator for capacity testing the game API, e.g. against server/mock_server.c.
+// Drives many independent sessions (each with its own client & worlds) from one thread
+// over the shared http layer. Every session logs in, polls state, looks around the player
+// (which fetches the map the way the travel map does), walks and reveals per its profile.
+//
+// Reports throughput & latency percentiles per endpoint at the end, one line each.
+// Latencies are per transfer attempt as http stats keep them, so percentiles are upper
+// bounds of log2 buckets; login is measured from the call till the first state, exactly.
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>    // strtol, strtod, qsort
+#include <string.h>
+#include <unistd.h>    // usleep
+
+#include "utils.h"
+#include "log.h"
+#include "timer.h"
+#include "allocator.h"
+#include "http.h"
+#include "client.h"
+#include "session.h"
+#include "world.h"
+
+#define DEFAULT_ENDPOINT "http://localhost:8080/api/"
+#define DEFAULT_SESSIONS 16
+#define DEFAULT_DURATION 60
+#define DEFAULT_RAMP     5
+#define DEFAULT_TICK_MS  16
+#define DEFAULT_PROFILE  "explorer"
+
+#define MAX_SESSIONS 1024
+// After the run, for the logouts to get through.
+#define DRAIN_MS (3 * 1000)
+
+typedef struct {
+	const char* name;
+	// Tiles around the player looked at every tick, as the screen does.
+	int32_t     view_radius;
+	// Average time between walks & reveals, 0 for never. Actual ones vary by half of it.
+	uint32_t    move_every_ms;
+	uint32_t    reveal_every_ms;
+	uint32_t    max_steps;
+} profile_t;
+
+static const profile_t PROFILES[] = {
+	// Logs in and watches: state polls, map fetches & revalidations only.
+	{ .name = "idle",     .view_radius = 8 },
+	// Walks around a lot, fetching the map as it goes.
+	{ .name = "explorer", .view_radius = 12, .move_every_ms = 3000,  .max_steps = 8 },
+	// Stays around, reveals a lot.
+	{ .name = "revealer", .view_radius = 8,  .move_every_ms = 10000, .max_steps = 4, .reveal_every_ms = 1000 },
+};
+
+typedef struct {
+	const char*      endpoint;
+	uint32_t         num_sessions;
+	uint32_t         duration_s;
+	// Logins are spread over it.
+	uint32_t         ramp_s;
+	uint32_t         tick_ms;
+	uint32_t         seed;
+	uint8_t          num_workers;
+	uint16_t         max_connections;
+	const profile_t* profile;
+	bool             is_verbose;
+} config_t;
+
+typedef struct {
+	session_ctx_t* ctx;
+
+	uint32_t random;
+	char     username[32];
+
+	// Since the start of the run, negative till it happens.
+	double login_at;
+	double active_at;
+	bool   is_ended;
+
+	// Time left till the next one.
+	float    move_t;
+	float    reveal_t;
+	uint32_t num_moves;
+	uint32_t num_reveals;
+} player_t;
+
+static struct {
+	config_t config;
+
+	player_t* players;
+	double    started_at;
+} s_ctx;
+
+// xorshift32, own sequence per player, so runs repeat with the same seed.
+static uint32_t random_next(player_t* p) {
+	uint32_t x = p->random;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return p->random = x;
+}
+
+// Between half and one and a half of it.
+static float random_interval(player_t* p, uint32_t ms) {
+	return ms / 2 + random_next(p) % (ms + 1);
+}
+
+// BEHAVIOUR
+// =========
+
+// Everything here happens with the player's session bound.
+
+// Map of the visible tiles is fetched on demand, the same way rendering asks for it.
+static void look_around(const session_t* s, int32_t radius) {
+	assert(s);
+
+	const int32_t x0 = MAX(s->player.x - radius, 0);
+	const int32_t y0 = MAX(s->player.y - radius, 0);
+	const int32_t x1 = MIN(s->player.x + radius, WORLD_PLANE_SIZE - 1);
+	const int32_t y1 = MIN(s->player.y + radius, WORLD_PLANE_SIZE - 1);
+
+	for (int32_t y = y0; y <= y1; ++y) {
+		for (int32_t x = x0; x <= x1; ++x) {
+			if (!world_is_hidden(s->world, x, y)) world_terrain(s->world, x, y);
+		}
+	}
+}
+
+// Straight line in one of the 8 directions, cut at the plane edge.
+static void walk(player_t* p, const session_t* s, uint32_t max_steps) {
+	assert(p);
+	assert(s);
+
+	static const int8_t DIRECTIONS[8][2] = { {1, 0}, {1, 1}, {0, 1}, {-1, 1}, {-1, 0}, {-1, -1}, {0, -1}, {1, -1} };
+
+	const int8_t*  d     = DIRECTIONS[random_next(p) % 8];
+	const uint32_t count = 1 + random_next(p) % MIN(max_steps, SESSION_MAX_STEPS);
+
+	session_step_t steps[SESSION_MAX_STEPS];
+	size_t         num_steps = 0;
+
+	int32_t x = s->player.x;
+	int32_t y = s->player.y;
+	for (uint32_t i = 0; i < count; ++i) {
+		x += d[0];
+		y += d[1];
+		if (x < 0 || y < 0 || x >= WORLD_PLANE_SIZE || y >= WORLD_PLANE_SIZE) break;
+
+		steps[num_steps++] = (session_step_t) { .tx = x, .ty = y };
+	}
+
+	if (num_steps == 0) return;
+
+	session_move(steps, NULL, num_steps);
+	++p->num_moves;
+}
+
+// A hidden tile in sight, not being revealed already. Gives up after a few tries.
+static void reveal(player_t* p, const session_t* s, int32_t radius) {
+	assert(p);
+	assert(s);
+
+	for (size_t attempt = 0; attempt < 8; ++attempt) {
+		const int32_t x = s->player.x - radius + (int32_t)(random_next(p) % (2 * radius + 1));
+		const int32_t y = s->player.y - radius + (int32_t)(random_next(p) % (2 * radius + 1));
+		if (x < 0 || y < 0 || x >= WORLD_PLANE_SIZE || y >= WORLD_PLANE_SIZE) continue;
+
+		if (world_is_hidden(s->world, x, y) && !world_is_revealing(s->world, x, y)) {
+			session_reveal(x, y);
+			++p->num_reveals;
+			return;
+		}
+	}
+}
+
+static void player_update(player_t* p, double now, float dt) {
+	assert(p);
+
+	const config_t*  c       = &s_ctx.config;
+	const profile_t* profile = c->profile;
+
+	client_update(dt);
+	session_update(dt);
+
+	if (p->is_ended) return;
+
+	if (p->login_at < 0) {
+		const uint32_t index = p - s_ctx.players;
+		if (now < (double)c->ramp_s * 1000.0 * index / c->num_sessions) return;
+
+		p->login_at = now;
+		session_start(p->username, "load");
+		return;
+	}
+
+	const session_t* s = session_current();
+	if (!s || !s->world) return;
+
+	if (p->active_at < 0) {
+		p->active_at = now;
+		p->move_t    = random_interval(p, profile->move_every_ms);
+		p->reveal_t  = random_interval(p, profile->reveal_every_ms);
+	}
+
+	look_around(s, profile->view_radius);
+
+	if (profile->move_every_ms > 0 && !session_is_walking()) {
+		p->move_t -= dt;
+		if (p->move_t <= 0.0f) {
+			walk(p, s, profile->max_steps);
+			p->move_t = random_interval(p, profile->move_every_ms);
+		}
+	}
+
+	if (profile->reveal_every_ms > 0) {
+		p->reveal_t -= dt;
+		if (p->reveal_t <= 0.0f) {
+			reveal(p, s, profile->view_radius);
+			p->reveal_t = random_interval(p, profile->reveal_every_ms);
+		}
+	}
+}
+
+// REPORT
+// ======
+
+static int compare_doubles(const void* a, const void* b) {
+	const double x = *(const double*)a;
+	const double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static double percentile(const double* sorted, size_t count, double p) {
+	return count > 0 ? sorted[(size_t)(p * (count - 1))] : 0.0;
+}
+
+static void report(double run_ms) {
+	const config_t* c = &s_ctx.config;
+	const double    s = run_ms / 1000.0;
+
+	double*  logins     = BR_ALLOC(allocator_main(), sizeof(double) * c->num_sessions);
+	size_t   num_logins = 0;
+	uint32_t num_moves = 0, num_reveals = 0;
+
+	for (size_t i = 0; i < c->num_sessions; ++i) {
+		const player_t* p = &s_ctx.players[i];
+		if (p->active_at >= 0) logins[num_logins++] = p->active_at - p->login_at;
+		num_moves   += p->num_moves;
+		num_reveals += p->num_reveals;
+	}
+	qsort(logins, num_logins, sizeof(double), compare_doubles);
+
+	printf("run profile=%s sessions=%u seconds=%.1f logged_in=%zu moves=%u reveals=%u\n",
+		c->profile->name, c->num_sessions, s, num_logins, num_moves, num_reveals);
+	printf("login p50=%.1fms p90=%.1fms p99=%.1fms max=%.1fms\n",
+		percentile(logins, num_logins, 0.5), percentile(logins, num_logins, 0.9), percentile(logins, num_logins, 0.99),
+		num_logins > 0 ? logins[num_logins - 1] : 0.0);
+
+	BR_FREE(allocator_main(), logins);
+
+	http_endpoint_stats_t stats[HTTP_STATS_MAX_ENDPOINTS];
+	const size_t          n = http_stats(stats, HTTP_STATS_MAX_ENDPOINTS);
+
+	uint32_t total_requests = 0, total_failed = 0;
+	uint64_t total_down     = 0;
+
+	for (size_t i = 0; i < n; ++i) {
+		const http_endpoint_stats_t* e     = &stats[i];
+		const http_histogram_t*      ttfb  = &e->timings[HTTP_TIMING_TTFB];
+		const http_histogram_t*      total = &e->timings[HTTP_TIMING_TOTAL];
+
+		printf("endpoint %s requests=%u rps=%.1f failed=%u down_kbps=%.1f ttfb_p50<=%.0fms ttfb_p99<=%.0fms p50<=%.0fms p90<=%.0fms p99<=%.0fms max=%.1fms\n",
+			e->name, e->num_requests, e->num_requests / s, e->num_failed, e->bytes_down / 1024.0 / s,
+			http_stats_percentile(ttfb, 0.5), http_stats_percentile(ttfb, 0.99),
+			http_stats_percentile(total, 0.5), http_stats_percentile(total, 0.9), http_stats_percentile(total, 0.99), total->max_ms);
+
+		total_requests += e->num_requests;
+		total_failed   += e->num_failed;
+		total_down     += e->bytes_down;
+	}
+
+	printf("total requests=%u rps=%.1f failed=%u down_kbps=%.1f\n",
+		total_requests, total_requests / s, total_failed, total_down / 1024.0 / s);
+}
+
+// SETUP
+// =====
+
+static void usage() {
+	log_error("Usage: loadgen [options]");
+	log_error("  --endpoint URL     API base to hit (%s)", DEFAULT_ENDPOINT);
+	log_error("  --sessions N       simultaneous players, up to %u (%u)", MAX_SESSIONS, DEFAULT_SESSIONS);
+	log_error("  --duration S       length of the run (%u)", DEFAULT_DURATION);
+	log_error("  --ramp S           logins are spread over it (%u)", DEFAULT_RAMP);
+	log_error("  --profile NAME     idle, explorer or revealer (%s)", DEFAULT_PROFILE);
+	log_error("  --tick MS          update period of every session (%u)", DEFAULT_TICK_MS);
+	log_error("  --seed N           seed of the behaviour (1)");
+	log_error("  --workers N        http worker threads, 0 for one per core (0)");
+	log_error("  --connections N    connections to the host, 0 for 4 per session");
+	log_error("  --verbose          logs what the client & session do");
+}
+
+static const profile_t* profile_lookup(const char* name) {
+	for (size_t i = 0; i < ARRAY_SIZE(PROFILES); ++i) {
+		if (strcmp(PROFILES[i].name, name) == 0) return &PROFILES[i];
+	}
+	return NULL;
+}
+
+static void parse_args(int argc, const char* argv[], config_t* c) {
+	for (int i = 1; i < argc; ++i) {
+		const char* arg   = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if      (strcmp(arg, "--verbose") == 0)              c->is_verbose      = true;
+		else if (strcmp(arg, "--endpoint") == 0 && value)    c->endpoint        = argv[++i];
+		else if (strcmp(arg, "--sessions") == 0 && value)    c->num_sessions    = strtol(argv[++i], NULL, 10);
+		else if (strcmp(arg, "--duration") == 0 && value)    c->duration_s      = strtol(argv[++i], NULL, 10);
+		else if (strcmp(arg, "--ramp") == 0 && value)        c->ramp_s          = strtol(argv[++i], NULL, 10);
+		else if (strcmp(arg, "--tick") == 0 && value)        c->tick_ms         = strtol(argv[++i], NULL, 10);
+		else if (strcmp(arg, "--seed") == 0 && value)        c->seed            = strtol(argv[++i], NULL, 10);
+		else if (strcmp(arg, "--workers") == 0 && value)     c->num_workers     = strtol(argv[++i], NULL, 10);
+		else if (strcmp(arg, "--connections") == 0 && value) c->max_connections = strtol(argv[++i], NULL, 10);
+		else if (strcmp(arg, "--profile") == 0 && value)     c->profile         = profile_lookup(argv[++i]);
+		else {
+			usage();
+			exit(strcmp(arg, "--help") == 0 ? 0 : 1);
+		}
+	}
+
+	if (!c->profile || c->num_sessions == 0 || c->num_sessions > MAX_SESSIONS || c->tick_ms == 0 || strlen(c->endpoint) == 0) {
+		usage();
+		exit(1);
+	}
+}
+
+int main(int argc, const char* argv[]) {
+	config_t* c = &s_ctx.config;
+	c->endpoint     = DEFAULT_ENDPOINT;
+	c->num_sessions = DEFAULT_SESSIONS;
+	c->duration_s   = DEFAULT_DURATION;
+	c->ramp_s       = DEFAULT_RAMP;
+	c->tick_ms      = DEFAULT_TICK_MS;
+	c->seed         = 1;
+	c->profile      = profile_lookup(DEFAULT_PROFILE);
+	parse_args(argc, argv, c);
+
+	log_set_info(c->is_verbose);
+
+	const uint32_t connections = c->max_connections ? c->max_connections : MIN(4 * c->num_sessions, UINT16_MAX);
+
+	http_config_t http = http_config_default();
+	http.num_workers          = c->num_workers;
+	http.num_players          = c->num_sessions;
+	http.max_host_connections = connections;
+	http.max_connections      = connections;
+	http_init(&http);
+
+	client_set_endpoint(c->endpoint);
+
+	allocator_t* alloc = allocator_main();
+
+	s_ctx.players = BR_ALLOC(alloc, sizeof(player_t) * c->num_sessions);
+	for (size_t i = 0; i < c->num_sessions; ++i) {
+		player_t* p = &s_ctx.players[i];
+		memset(p, 0, sizeof(player_t));
+
+		p->ctx       = session_ctx_create(alloc);
+		p->random    = (c->seed * 2654435761u + i * 40503u) | 1;
+		p->login_at  = -1.0;
+		p->active_at = -1.0;
+		snprintf(p->username, sizeof(p->username), "load_%zu", i);
+
+		session_bind(p->ctx);
+		client_init();
+		session_init(alloc);
+	}
+
+	fprintf(stderr, "[loadgen] %u sessions, profile %s, %u s against %s\n", c->num_sessions, c->profile->name, c->duration_s, c->endpoint);
+
+	s_ctx.started_at = timer_current();
+
+	const double duration_ms = c->duration_s * 1000.0;
+	double       last        = 0.0;
+	double       now         = 0.0;
+	bool         is_ending   = false;
+
+	while (now < duration_ms + DRAIN_MS) {
+		now = timer_current() - s_ctx.started_at;
+		const float dt = now - last;
+		last = now;
+
+		for (size_t i = 0; i < c->num_sessions; ++i) {
+			player_t* p = &s_ctx.players[i];
+
+			session_bind(p->ctx);
+			player_update(p, now, dt);
+
+			// Logged in ones say goodbye.
+			if (is_ending && !p->is_ended) {
+				if (session_current()) session_end();
+				p->is_ended = true;
+			}
+		}
+		session_bind(NULL);
+
+		is_ending = now >= duration_ms;
+
+		const double spent = timer_current() - s_ctx.started_at - now;
+		if (spent < c->tick_ms) usleep((c->tick_ms - spent) * 1000);
+	}
+
+	report(MIN(now, duration_ms));
+
+	for (size_t i = 0; i < c->num_sessions; ++i) {
+		session_bind(s_ctx.players[i].ctx);
+		session_shutdown();
+		client_shutdown();
+	}
+	session_bind(NULL);
+
+	http_shutdown();
+
+	for (size_t i = 0; i < c->num_sessions; ++i) {
+		session_ctx_destroy(alloc, s_ctx.players[i].ctx);
+	}
+	BR_FREE(alloc, s_ctx.players);
+
+	return 0;
+}
@@ -13,12 +13,17 @@ local TARGET_DIR   = path.join(BUILD_DIR, "bin", OS)
 
 require "clang_complete"
 
+newoption {
+	trigger     = "profile",
+	description = "Compile the scoped CPU profiler (src/profile.h) into release builds as well"
+}
+
 workspace "b4re"
 	configurations { "debug", "release" }
 	location(path.join(PROJECTS_DIR, OS))
 
-project "entry"
-	kind "WindowedApp"
+-- Game itself, the windowed app and the headless one share everything but the entry point.
+local function game_project()
 	language "C"
 
 	targetdir(path.join(TARGET_DIR, "%{cfg.buildcfg}"))
@@ -65,6 +70,10 @@ project "entry"
 		defines { "NDEBUG" }
 		optimize "On"
 
+	-- Scoped CPU profiler, see src/profile.h. Costs a ring write per scope, so release builds only get it on demand.
+	filter { "configurations:debug or options:profile" }
+		defines { "BR_PROFILE" }
+
 	filter "system:windows"
 		defines { "BR_PLATFORM_WIN" }
 
@@ -107,3 +116,191 @@ project "entry"
 			"X11",
 			"GL"
 		}
+end
+
+project "entry"
+	kind "WindowedApp"
+	game_project()
+
+-- No display needed: noop renderer, fixed timestep & scripted input, see src/entry/main_headless.c.
+-- Still links X11 & GL as bgfx is built with them, but never opens a display.
+project "entry_headless"
+	kind "ConsoleApp"
+	game_project()
+
+	filter {}
+		defines { "BR_HEADLESS" }
+
+-- Mock of the game API, for local runs & benchmarks without the live server.
+project "mock_server"
+	kind "ConsoleApp"
+	language "C"
+
+	targetdir(path.join(TARGET_DIR, "%{cfg.buildcfg}"))
+
+	flags { "FatalWarnings" }
+
+	files {
+		"server/**.h", "server/**.c",
+		"src/log.c",
+		"src/timer.c",
+		"3rdparty/tinycthread/*.c"
+	}
+
+	includedirs { "src" }
+
+	sysincludedirs { "3rdparty/tinycthread" }
+
+	filter "configurations:debug"
+		defines { "DEBUG" }
+		symbols "On"
+
+	filter "configurations:release"
+		defines { "NDEBUG" }
+		optimize "On"
+
+	filter "system:macosx"
+		defines { "BR_PLATFORM_MACOS" }
+
+	filter "system:linux"
+		defines { "BR_PLATFORM_LINUX" }
+
+		links { "pthread" }
+
+-- Many headless players against the API, for capacity testing the server.
+project "loadgen"
+	kind "ConsoleApp"
+	language "C"
+
+	targetdir(path.join(TARGET_DIR, "%{cfg.buildcfg}"))
+
+	flags { "FatalWarnings" }
+
+	files {
+		"loadgen/**.h", "loadgen/**.c",
+		"src/allocator.c",
+		"src/api.c",
+		"src/client.c",
+		"src/http.c",
+		"src/http_cache.c",
+		"src/http_trace.c",
+		"src/json.c",
+		"src/log.c",
+		"src/metrics.c",
+		"src/session.c",
+		"src/timer.c",
+		"src/world.c",
+		"3rdparty/tinycthread/*.c",
+		"3rdparty/jsmn/*.c"
+	}
+
+	includedirs { "src" }
+
+	sysincludedirs {
+		"3rdparty/curl/include",
+		"3rdparty/tinycthread",
+		"3rdparty/jsmn"
+	}
+
+	links { "curlDebug" }
+
+	filter "configurations:debug"
+		defines { "DEBUG" }
+		symbols "On"
+
+	filter "configurations:release"
+		defines { "NDEBUG" }
+		optimize "On"
+
+	filter "system:macosx"
+		defines { "BR_PLATFORM_MACOS" }
+
+		libdirs { "3rdparty/curl/lib/macosx_x64" }
+
+		links {
+			"Foundation.framework",
+			"Security.framework"
+		}
+
+	filter "system:linux"
+		defines { "BR_PLATFORM_LINUX" }
+
+		libdirs { "3rdparty/curl/lib/linux_x64" }
+
+		links {
+			"m",
+			"dl",
+			"pthread"
+		}
+
+-- Microbenchmarks of the hot paths, one key=value line per benchmark, see bench/bench.c.
+-- Links what the world pulls in, but never touches the network.
+project "b4re_bench"
+	kind "ConsoleApp"
+	language "C"
+
+	targetdir(path.join(TARGET_DIR, "%{cfg.buildcfg}"))
+
+	flags { "FatalWarnings" }
+
+	files {
+		"bench/**.h", "bench/**.c",
+		"src/allocator.c",
+		"src/api.c",
+		"src/client.c",
+		"src/http.c",
+		"src/http_cache.c",
+		"src/http_trace.c",
+		"src/json.c",
+		"src/log.c",
+		"src/metrics.c",
+		"src/path.c",
+		"src/render_text_layout.c",
+		"src/session.c",
+		"src/timer.c",
+		"src/world.c",
+		"3rdparty/tinycthread/*.c",
+		"3rdparty/jsmn/*.c"
+	}
+
+	includedirs { "src" }
+
+	sysincludedirs {
+		"3rdparty/curl/include",
+		"3rdparty/tinycthread",
+		"3rdparty/fontstash",
+		"3rdparty/jsmn"
+	}
+
+	links { "curlDebug" }
+
+	-- Timings of a debug build mean little, benchmarks are optimized either way.
+	optimize "On"
+
+	filter "configurations:debug"
+		defines { "DEBUG" }
+		symbols "On"
+
+	filter "configurations:release"
+		defines { "NDEBUG" }
+
+	filter "system:macosx"
+		defines { "BR_PLATFORM_MACOS" }
+
+		libdirs { "3rdparty/curl/lib/macosx_x64" }
+
+		links {
+			"Foundation.framework",
+			"Security.framework"
+		}
+
+	filter "system:linux"
+		defines { "BR_PLATFORM_LINUX" }
+
+		libdirs { "3rdparty/curl/lib/linux_x64" }
+
+		links {
+			"m",
+			"dl",
+			"pthread"
+		}
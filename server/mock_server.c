@@ -0,0 +1,892 @@
+// Mock of the game API for local runs & benchmarks, see USE_LOCAL_SERVER in client.c.
+// Single-threaded, every connection is served by one poll() loop. Responses are held back
+// for the configured latency without blocking the other connections.
+//
+// Serves:
+//   POST /api/login, /api/logout
+//   GET  /api/state
+//   POST /api/move
+//   GET  /api/map/<plane>/<x>/<y>/<size>[?format=compact]
+//   POST /api/reveal/<x>/<y>
+//
+// Planes are generated from their id and the seed, so every run sees the same world.
+// There is one player: the client doesn't keep cookies, so sessions can't be told apart.
+
+// memmem
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>    // strtol, strtod, realloc
+#include <string.h>
+#include <strings.h>   // strncasecmp
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "utils.h"
+#include "log.h"
+#include "timer.h"
+#include "world.h"
+
+#define MAX_CONNECTIONS   64
+#define MAX_REQUEST_SIZE  (16 * 1024)
+#define MAX_PLANES        8
+#define MAX_MAP_SIZE      256
+#define PLANE_ID_LENGTH   64
+
+#define DEFAULT_PORT      8080
+#define DEFAULT_PLANE     "plane_1"
+#define SPAWN_X           (WORLD_PLANE_SIZE / 2)
+#define SPAWN_Y           (WORLD_PLANE_SIZE / 2)
+
+typedef struct {
+	uint16_t port;
+	// Added to every response, jitter is uniform in [0, jitter_ms].
+	uint32_t latency_ms;
+	uint32_t jitter_ms;
+	// Chances of a 503 and of a 429 with Retry-After, per request.
+	float    error_rate;
+	float    throttle_rate;
+	uint32_t seed;
+	// Ignores "?format=compact", as the old server does.
+	bool     is_json_only;
+	bool     is_verbose;
+} config_t;
+
+typedef struct {
+	char    id[PLANE_ID_LENGTH];
+	uint8_t terrain[WORLD_PLANE_SIZE][WORLD_PLANE_SIZE];
+	// Bit per tile.
+	uint8_t hidden[WORLD_PLANE_SIZE][WORLD_PLANE_SIZE / 8];
+} plane_t;
+
+typedef struct {
+	char     username[PLANE_ID_LENGTH];
+	char     plane_id[PLANE_ID_LENGTH];
+	int32_t  x, y;
+	uint32_t money;
+	uint32_t exp;
+	// Server time of the last change, so an unchanged state keeps its ETag.
+	uint64_t changed_at;
+} player_t;
+
+typedef struct {
+	int fd;
+
+	char   in[MAX_REQUEST_SIZE];
+	size_t in_used;
+
+	char*  out;
+	size_t out_capacity;
+	size_t out_size;
+	size_t out_sent;
+	// Response is held back till then.
+	double ready_at;
+	bool   has_response;
+	bool   is_closing;
+} connection_t;
+
+typedef struct {
+	char        method[8];
+	char        path[256];
+	const char* if_none_match;
+	size_t      if_none_match_length;
+	const char* body;
+	size_t      body_size;
+} request_t;
+
+// Growable response body.
+typedef struct {
+	char*  data;
+	size_t size;
+	size_t capacity;
+} body_t;
+
+static const char* TERRAIN_NAMES[] = {
+	[TERRAIN_DEFAULT]      = "default",
+	[TERRAIN_ROCK_WATER]   = "rock_water",
+	[TERRAIN_ROCK_SOLID]   = "rock_solid",
+	[TERRAIN_ROCK]         = "rock",
+	[TERRAIN_ROCK_SAND]    = "rock_sand",
+	[TERRAIN_WILD]         = "wild",
+	[TERRAIN_GRASS]        = "grass",
+	[TERRAIN_EARTH]        = "earth",
+	[TERRAIN_CLAY]         = "clay",
+	[TERRAIN_SAND]         = "sand",
+	[TERRAIN_WATER]        = "water",
+	[TERRAIN_WATER_BOTTOM] = "water_bottom",
+	[TERRAIN_WATER_DEEP]   = "water_deep",
+};
+
+static struct {
+	config_t config;
+
+	int          listener;
+	connection_t connections[MAX_CONNECTIONS];
+
+	plane_t* planes[MAX_PLANES];
+	size_t   num_planes;
+
+	player_t player;
+
+	uint32_t random;
+
+	volatile sig_atomic_t is_stopping;
+
+	uint32_t num_requests;
+	uint32_t num_errors;
+	uint64_t bytes_out;
+} s_ctx;
+
+// UTILS
+// =====
+
+// xorshift32.
+static uint32_t random_next() {
+	uint32_t x = s_ctx.random;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return s_ctx.random = x;
+}
+
+static float random_float() {
+	return (random_next() & 0xFFFFFF) / (float)0x1000000;
+}
+
+// FNV-1a.
+static uint32_t hash(const void* data, size_t size, uint32_t seed) {
+	const uint8_t* p = data;
+
+	uint32_t h = 2166136261u ^ seed;
+	for (size_t i = 0; i < size; ++i) {
+		h ^= p[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static void body_reserve(body_t* b, size_t size) {
+	if (b->size + size <= b->capacity) return;
+
+	size_t capacity = b->capacity ? b->capacity : 1024;
+	while (capacity < b->size + size) capacity *= 2;
+
+	b->data = realloc(b->data, capacity);
+	if (!b->data) log_fatal("[server] Out of memory");
+	b->capacity = capacity;
+}
+
+static void body_append(body_t* b, const void* data, size_t size) {
+	body_reserve(b, size);
+	memcpy(b->data + b->size, data, size);
+	b->size += size;
+}
+
+static void body_printf(body_t* b, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+static void body_printf(body_t* b, const char* format, ...) {
+	va_list args;
+
+	va_start(args, format);
+	const int length = vsnprintf(NULL, 0, format, args);
+	va_end(args);
+
+	body_reserve(b, length + 1);
+
+	va_start(args, format);
+	vsnprintf(b->data + b->size, length + 1, format, args);
+	va_end(args);
+
+	b->size += length;
+}
+
+// PLANES
+// ======
+
+// Smooth noise in [0, 1): bilinear value noise over a lattice of the given cell size.
+static float value_noise(uint32_t seed, int32_t x, int32_t y, int32_t cell) {
+	const int32_t cx = x / cell;
+	const int32_t cy = y / cell;
+	const float   fx = (float)(x % cell) / cell;
+	const float   fy = (float)(y % cell) / cell;
+
+	float corners[4];
+	for (int32_t i = 0; i < 4; ++i) {
+		const int32_t p[2] = { cx + (i & 1), cy + (i >> 1) };
+		corners[i] = (hash(p, sizeof(p), seed) & 0xFFFF) / 65536.0f;
+	}
+
+	// Smoothstep, so cell borders don't show.
+	const float sx = fx * fx * (3.0f - 2.0f * fx);
+	const float sy = fy * fy * (3.0f - 2.0f * fy);
+
+	const float top    = corners[0] + (corners[1] - corners[0]) * sx;
+	const float bottom = corners[2] + (corners[3] - corners[2]) * sx;
+	return top + (bottom - top) * sy;
+}
+
+static float fractal_noise(uint32_t seed, int32_t x, int32_t y) {
+	return value_noise(seed,     x, y, 32) * 0.5f
+	     + value_noise(seed + 1, x, y, 16) * 0.3f
+	     + value_noise(seed + 2, x, y, 4)  * 0.2f;
+}
+
+static uint8_t terrain_at(float height, float moisture) {
+	if (height < 0.30f) return TERRAIN_WATER_DEEP;
+	if (height < 0.36f) return TERRAIN_WATER;
+	if (height < 0.39f) return TERRAIN_WATER_BOTTOM;
+	if (height < 0.42f) return moisture < 0.5f ? TERRAIN_SAND : TERRAIN_ROCK_WATER;
+	if (height < 0.58f) return moisture < 0.45f ? TERRAIN_GRASS : TERRAIN_WILD;
+	if (height < 0.66f) return moisture < 0.5f  ? TERRAIN_EARTH : TERRAIN_CLAY;
+	if (height < 0.72f) return TERRAIN_ROCK_SAND;
+	if (height < 0.78f) return TERRAIN_ROCK;
+	return TERRAIN_ROCK_SOLID;
+}
+
+static void plane_generate(plane_t* p) {
+	assert(p);
+
+	const uint32_t seed = hash(p->id, strlen(p->id), s_ctx.config.seed);
+
+	for (int32_t y = 0; y < WORLD_PLANE_SIZE; ++y) {
+		for (int32_t x = 0; x < WORLD_PLANE_SIZE; ++x) {
+			const float height   = fractal_noise(seed,      x, y);
+			const float moisture = fractal_noise(seed + 16, x, y);
+			const float fog      = value_noise  (seed + 32, x, y, 8);
+
+			p->terrain[y][x] = terrain_at(height, moisture);
+			if (fog > 0.7f) p->hidden[y][x / 8] |= 1 << (x % 8);
+		}
+	}
+}
+
+static plane_t* plane_find(const char* id) {
+	assert(id);
+
+	for (size_t i = 0; i < s_ctx.num_planes; ++i) {
+		if (strcmp(s_ctx.planes[i]->id, id) == 0) return s_ctx.planes[i];
+	}
+
+	if (s_ctx.num_planes == MAX_PLANES || strlen(id) >= PLANE_ID_LENGTH) return NULL;
+
+	plane_t* p = calloc(1, sizeof(plane_t));
+	if (!p) log_fatal("[server] Out of memory");
+
+	strcpy(p->id, id);
+	plane_generate(p);
+
+	if (s_ctx.config.is_verbose) log_info("[server] Generated plane %s", id);
+
+	s_ctx.planes[s_ctx.num_planes++] = p;
+	return p;
+}
+
+static bool plane_is_inside(int32_t x, int32_t y) {
+	return x >= 0 && y >= 0 && x < WORLD_PLANE_SIZE && y < WORLD_PLANE_SIZE;
+}
+
+// Tile as the compact map has it: terrain in the low 7 bits, hidden flag in the high one.
+// Everything off the plane is hidden.
+static uint8_t plane_tile(const plane_t* p, int32_t x, int32_t y) {
+	if (!plane_is_inside(x, y)) return 0x80;
+
+	const bool is_hidden = p->hidden[y][x / 8] & (1 << (x % 8));
+	return is_hidden ? 0x80 : p->terrain[y][x];
+}
+
+// ENDPOINTS
+// =========
+
+typedef struct {
+	uint16_t    code;
+	const char* content_type;
+	body_t      body;
+	// Doesn't get an ETag if false.
+	bool        is_cacheable;
+} response_t;
+
+static void reply(response_t* r, uint16_t code, const char* content_type) {
+	r->code         = code;
+	r->content_type = content_type;
+}
+
+static void state_resource(body_t* b, const char* name, uint8_t value) {
+	body_printf(b,
+		"\"%s\": { \"last_update\": %llu, \"booster_time\": 0, \"value\": %u, \"max\": 12, "
+		"\"regen_rate\": 5, \"filled_segments\": %u, \"segment_time\": 0 }",
+		name, (unsigned long long)s_ctx.player.changed_at, value, value);
+}
+
+static void handle_state(const request_t* req, response_t* r) {
+	const player_t* p = &s_ctx.player;
+
+	reply(r, 200, "application/json");
+	r->is_cacheable = true;
+
+	body_printf(&r->body,
+		"{ \"timestamp\": %llu, \"player\": { \"username\": \"%s\", \"plane_id\": \"%s\", "
+		"\"level\": %u, \"experience\": %u, \"money\": %u, \"x\": %d, \"y\": %d, \"avatar\": \"avatar_man1\", ",
+		(unsigned long long)p->changed_at, p->username, p->plane_id, 1 + p->exp / 100, p->exp, p->money, p->x, p->y);
+	state_resource(&r->body, "mind", 12);
+	body_printf(&r->body, ", ");
+	state_resource(&r->body, "matter", 12);
+	body_printf(&r->body, " } }");
+}
+
+// Multipart form value, crude but it's only ever curl talking to us.
+static bool form_value(const request_t* req, const char* name, char* value, size_t size) {
+	char key[64];
+	snprintf(key, sizeof(key), "name=\"%s\"", name);
+
+	const char* end = req->body + req->body_size;
+	const char* k   = memmem(req->body, req->body_size, key, strlen(key));
+	if (!k) return false;
+
+	const char* v = memmem(k, end - k, "\r\n\r\n", 4);
+	if (!v) return false;
+	v += 4;
+
+	const char* e = memmem(v, end - v, "\r\n", 2);
+	if (!e) e = end;
+
+	const size_t length = MIN((size_t)(e - v), size - 1);
+	memcpy(value, v, length);
+	value[length] = 0;
+	return true;
+}
+
+static void handle_login(const request_t* req, response_t* r) {
+	player_t* p = &s_ctx.player;
+
+	if (!form_value(req, "username", p->username, sizeof(p->username))) strcpy(p->username, "player");
+	p->changed_at = time(NULL);
+
+	reply(r, 200, "application/json");
+	body_printf(&r->body, "{}");
+}
+
+static void handle_logout(const request_t* req, response_t* r) {
+	reply(r, 200, "application/json");
+	body_printf(&r->body, "{}");
+}
+
+// Body is a JSON array of steps, the player ends up at the last one.
+static void handle_move(const request_t* req, response_t* r) {
+	player_t* p = &s_ctx.player;
+
+	int32_t x = p->x;
+	int32_t y = p->y;
+
+	const char* end = req->body + req->body_size;
+	for (const char* it = req->body; it < end; ++it) {
+		if (*it == 'x' && it + 3 < end && it[1] == '"') x = strtol(it + 3, NULL, 10);
+		if (*it == 'y' && it + 3 < end && it[1] == '"') y = strtol(it + 3, NULL, 10);
+	}
+
+	if (!plane_is_inside(x, y)) {
+		reply(r, 400, "application/json");
+		body_printf(&r->body, "{ \"error\": \"out of the plane\" }");
+		return;
+	}
+
+	p->x          = x;
+	p->y          = y;
+	p->exp       += 1;
+	p->changed_at = time(NULL);
+
+	reply(r, 200, "application/json");
+	body_printf(&r->body, "{}");
+}
+
+static void map_compact(const plane_t* p, int32_t x0, int32_t y0, uint32_t size, body_t* b) {
+	const uint8_t header[12] = {
+		'B', '4', 'R', 'M', 1, 1,
+		x0 & 0xFF, (x0 >> 8) & 0xFF,
+		y0 & 0xFF, (y0 >> 8) & 0xFF,
+		size & 0xFF, (size >> 8) & 0xFF,
+	};
+	body_append(b, header, sizeof(header));
+
+	// RLE, runs don't care about rows.
+	uint8_t tile = 0;
+	uint8_t run  = 0;
+	for (uint32_t i = 0; i < size * size; ++i) {
+		const uint8_t t = plane_tile(p, x0 + i % size, y0 + i / size);
+		if (run > 0 && (t != tile || run == UINT8_MAX)) {
+			const uint8_t pair[2] = { run, tile };
+			body_append(b, pair, 2);
+			run = 0;
+		}
+		tile = t;
+		++run;
+	}
+	const uint8_t pair[2] = { run, tile };
+	body_append(b, pair, 2);
+}
+
+static void map_json(const plane_t* p, int32_t x0, int32_t y0, uint32_t size, body_t* b) {
+	body_printf(b, "{ \"x\": %d, \"y\": %d, \"map\": [", x0, y0);
+
+	for (uint32_t y = 0; y < size; ++y) {
+		body_printf(b, "%s[", y == 0 ? "" : ", ");
+		for (uint32_t x = 0; x < size; ++x) {
+			const uint8_t t = plane_tile(p, x0 + x, y0 + y);
+			if (t & 0x80) {
+				body_printf(b, "%s{ \"hidden\": true }", x == 0 ? "" : ", ");
+			} else {
+				body_printf(b, "%s{ \"static_id\": \"%s\" }", x == 0 ? "" : ", ", TERRAIN_NAMES[t]);
+			}
+		}
+		body_printf(b, "]");
+	}
+
+	body_printf(b, "] }");
+}
+
+// /api/map/<plane>/<x>/<y>/<size>
+static void handle_map(const request_t* req, response_t* r) {
+	char    plane_id[PLANE_ID_LENGTH];
+	int32_t x, y;
+	int32_t size;
+	int     n = 0;
+
+	if (sscanf(req->path, "/api/map/%63[^/]/%d/%d/%d%n", plane_id, &x, &y, &size, &n) != 4 || size <= 0 || size > MAX_MAP_SIZE) {
+		reply(r, 400, "application/json");
+		body_printf(&r->body, "{ \"error\": \"bad map request\" }");
+		return;
+	}
+
+	const plane_t* p = plane_find(plane_id);
+	if (!p) {
+		reply(r, 404, "application/json");
+		body_printf(&r->body, "{ \"error\": \"no such plane\" }");
+		return;
+	}
+
+	const bool is_compact = !s_ctx.config.is_json_only && strstr(req->path + n, "format=compact");
+
+	if (is_compact) {
+		reply(r, 200, "application/octet-stream");
+		map_compact(p, x, y, size, &r->body);
+	} else {
+		reply(r, 200, "application/json");
+		map_json(p, x, y, size, &r->body);
+	}
+	r->is_cacheable = true;
+}
+
+// /api/reveal/<x>/<y>
+static void handle_reveal(const request_t* req, response_t* r) {
+	int32_t x, y;
+
+	plane_t* p = plane_find(s_ctx.player.plane_id);
+
+	if (sscanf(req->path, "/api/reveal/%d/%d", &x, &y) != 2 || !p || !plane_is_inside(x, y)) {
+		reply(r, 400, "application/json");
+		body_printf(&r->body, "{ \"error\": \"bad reveal request\" }");
+		return;
+	}
+
+	p->hidden[y][x / 8] &= ~(1 << (x % 8));
+	s_ctx.player.money      += 1;
+	s_ctx.player.changed_at  = time(NULL);
+
+	reply(r, 200, "application/json");
+	body_printf(&r->body, "{ \"static_id\": \"%s\" }", TERRAIN_NAMES[p->terrain[y][x]]);
+}
+
+static const struct {
+	const char* method;
+	const char* prefix;
+	void      (*handle)(const request_t* req, response_t* r);
+} ROUTES[] = {
+	{ "POST", "/api/login",   handle_login  },
+	{ "POST", "/api/logout",  handle_logout },
+	{ "GET",  "/api/state",   handle_state  },
+	{ "POST", "/api/move",    handle_move   },
+	{ "GET",  "/api/map/",    handle_map    },
+	{ "POST", "/api/reveal/", handle_reveal },
+};
+
+static void route(const request_t* req, response_t* r) {
+	const config_t* c = &s_ctx.config;
+
+	// Injected failures happen before anything is touched, like with an overloaded server.
+	const float roll = random_float();
+	if (roll < c->error_rate) {
+		reply(r, 503, "text/plain");
+		body_printf(&r->body, "Service Unavailable");
+		return;
+	}
+	if (roll < c->error_rate + c->throttle_rate) {
+		reply(r, 429, "text/plain");
+		body_printf(&r->body, "Too Many Requests");
+		return;
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(ROUTES); ++i) {
+		if (strcmp(req->method, ROUTES[i].method) != 0) continue;
+		if (strncmp(req->path, ROUTES[i].prefix, strlen(ROUTES[i].prefix)) != 0) continue;
+
+		ROUTES[i].handle(req, r);
+		return;
+	}
+
+	reply(r, 404, "text/plain");
+	body_printf(&r->body, "Not Found");
+}
+
+// CONNECTIONS
+// ===========
+
+static const char* reason(uint16_t code) {
+	switch (code) {
+		case 200: return "OK";
+		case 304: return "Not Modified";
+		case 400: return "Bad Request";
+		case 404: return "Not Found";
+		case 413: return "Payload Too Large";
+		case 429: return "Too Many Requests";
+		case 503: return "Service Unavailable";
+		default:  return "Unknown";
+	}
+}
+
+static void connection_close(connection_t* c) {
+	assert(c && c->fd >= 0);
+
+	close(c->fd);
+	free(c->out);
+	memset(c, 0, sizeof(connection_t));
+	c->fd = -1;
+}
+
+static void connection_write(connection_t* c, const void* data, size_t size) {
+	if (c->out_size + size > c->out_capacity) {
+		size_t capacity = c->out_capacity ? c->out_capacity : 4096;
+		while (capacity < c->out_size + size) capacity *= 2;
+
+		c->out = realloc(c->out, capacity);
+		if (!c->out) log_fatal("[server] Out of memory");
+		c->out_capacity = capacity;
+	}
+	memcpy(c->out + c->out_size, data, size);
+	c->out_size += size;
+}
+
+static void connection_respond(connection_t* c, const request_t* req, response_t* r) {
+	char etag[16] = {0};
+	if (r->code == 200 && r->is_cacheable) {
+		snprintf(etag, sizeof(etag), "\"%08x\"", hash(r->body.data, r->body.size, 0));
+
+		if (req->if_none_match && req->if_none_match_length == strlen(etag) && memcmp(req->if_none_match, etag, req->if_none_match_length) == 0) {
+			r->code      = 304;
+			r->body.size = 0;
+		}
+	}
+
+	char   header[512];
+	size_t length = snprintf(header, sizeof(header), "HTTP/1.1 %u %s\r\nContent-Length: %zu\r\n", r->code, reason(r->code), r->code == 304 ? 0 : r->body.size);
+
+	if (r->content_type && r->code != 304) length += snprintf(header + length, sizeof(header) - length, "Content-Type: %s\r\n", r->content_type);
+	if (etag[0])                           length += snprintf(header + length, sizeof(header) - length, "ETag: %s\r\n", etag);
+	if (r->code == 429)                    length += snprintf(header + length, sizeof(header) - length, "Retry-After: 1\r\n");
+	if (c->is_closing)                     length += snprintf(header + length, sizeof(header) - length, "Connection: close\r\n");
+	length += snprintf(header + length, sizeof(header) - length, "\r\n");
+
+	connection_write(c, header, length);
+	if (r->code != 304) connection_write(c, r->body.data, r->body.size);
+
+	const config_t* config = &s_ctx.config;
+	const uint32_t  jitter = config->jitter_ms ? random_next() % (config->jitter_ms + 1) : 0;
+	c->ready_at     = timer_current() + config->latency_ms + jitter;
+	c->has_response = true;
+
+	s_ctx.num_requests += 1;
+	s_ctx.num_errors   += r->code >= 400;
+
+	if (config->is_verbose) log_info("[server] %s %s - %u, %zu bytes", req->method, req->path, r->code, r->body.size);
+}
+
+// Value of a header, NULL if there is none. Not zero-terminated.
+static const char* header_find(const char* headers, const char* end, const char* name, size_t* length) {
+	const size_t n = strlen(name);
+
+	for (const char* line = headers; line < end;) {
+		const char* eol = memmem(line, end - line, "\r\n", 2);
+		if (!eol) eol = end;
+
+		if ((size_t)(eol - line) > n && strncasecmp(line, name, n) == 0 && line[n] == ':') {
+			const char* v = line + n + 1;
+			while (v < eol && *v == ' ') ++v;
+			*length = eol - v;
+			return v;
+		}
+		line = eol + 2;
+	}
+	return NULL;
+}
+
+// Handles a complete request if there is one, false if it needs more data.
+static bool connection_process(connection_t* c) {
+	const char* head_end = memmem(c->in, c->in_used, "\r\n\r\n", 4);
+	if (!head_end) {
+		if (c->in_used == MAX_REQUEST_SIZE) c->is_closing = true;
+		return false;
+	}
+
+	const char* headers = memchr(c->in, '\n', head_end - c->in);
+	headers = headers ? headers + 1 : head_end;
+
+	size_t      length;
+	const char* v = header_find(headers, head_end, "Content-Length", &length);
+	const size_t body_size = v ? strtoul(v, NULL, 10) : 0;
+	const size_t head_size = head_end + 4 - c->in;
+
+	request_t req = {0};
+	response_t r  = {0};
+
+	if (head_size + body_size > MAX_REQUEST_SIZE) {
+		c->is_closing = true;
+		reply(&r, 413, "text/plain");
+		connection_respond(c, &req, &r);
+		free(r.body.data);
+		return true;
+	}
+
+	if (c->in_used < head_size + body_size) {
+		// Curl waits a second for it before sending a large body.
+		if (header_find(headers, head_end, "Expect", &length) && c->out_size == 0 && !c->has_response) {
+			static const char CONTINUE[] = "HTTP/1.1 100 Continue\r\n\r\n";
+			send(c->fd, CONTINUE, sizeof(CONTINUE) - 1, 0);
+		}
+		return false;
+	}
+
+	sscanf(c->in, "%7s %255s", req.method, req.path);
+	req.if_none_match = header_find(headers, head_end, "If-None-Match", &req.if_none_match_length);
+	req.body          = c->in + head_size;
+	req.body_size     = body_size;
+
+	const char* connection = header_find(headers, head_end, "Connection", &length);
+	if (connection && length >= 5 && strncasecmp(connection, "close", 5) == 0) c->is_closing = true;
+
+	route(&req, &r);
+	connection_respond(c, &req, &r);
+	free(r.body.data);
+
+	// Keeps whatever came after it, though curl doesn't pipeline.
+	const size_t used = head_size + body_size;
+	memmove(c->in, c->in + used, c->in_used - used);
+	c->in_used -= used;
+
+	return true;
+}
+
+static void connection_accept() {
+	const int fd = accept(s_ctx.listener, NULL, NULL);
+	if (fd < 0) return;
+
+	for (size_t i = 0; i < MAX_CONNECTIONS; ++i) {
+		connection_t* c = &s_ctx.connections[i];
+		if (c->fd >= 0) continue;
+
+		const int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+		c->fd = fd;
+		return;
+	}
+
+	log_error("[server] Too many connections, dropping one");
+	close(fd);
+}
+
+static void connection_read(connection_t* c) {
+	const ssize_t n = recv(c->fd, c->in + c->in_used, MAX_REQUEST_SIZE - c->in_used, 0);
+	if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+		connection_close(c);
+		return;
+	}
+	if (n > 0) c->in_used += n;
+}
+
+static void connection_send(connection_t* c) {
+	const ssize_t n = send(c->fd, c->out + c->out_sent, c->out_size - c->out_sent, 0);
+	if (n < 0) {
+		if (errno != EAGAIN && errno != EINTR) connection_close(c);
+		return;
+	}
+
+	c->out_sent       += n;
+	s_ctx.bytes_out   += n;
+	if (c->out_sent < c->out_size) return;
+
+	c->out_size     = 0;
+	c->out_sent     = 0;
+	c->has_response = false;
+
+	if (c->is_closing) {
+		connection_close(c);
+	} else {
+		connection_process(c);
+	}
+}
+
+// SERVER
+// ======
+
+static void on_signal(int sig) {
+	s_ctx.is_stopping = 1;
+}
+
+static void listen_on(uint16_t port) {
+	s_ctx.listener = socket(AF_INET, SOCK_STREAM, 0);
+	if (s_ctx.listener < 0) log_fatal("[server] Failed to create a socket");
+
+	const int one = 1;
+	setsockopt(s_ctx.listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	struct sockaddr_in addr = {0};
+	addr.sin_family      = AF_INET;
+	addr.sin_port        = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(s_ctx.listener, (struct sockaddr*)&addr, sizeof(addr)) != 0) log_fatal("[server] Failed to bind to port %u", port);
+	if (listen(s_ctx.listener, MAX_CONNECTIONS) != 0) log_fatal("[server] Failed to listen");
+}
+
+static void serve() {
+	struct pollfd fds[MAX_CONNECTIONS + 1];
+	connection_t* polled[MAX_CONNECTIONS + 1];
+
+	while (!s_ctx.is_stopping) {
+		const double now     = timer_current();
+		double       timeout = -1.0;
+
+		size_t num_fds = 0;
+		fds[num_fds++] = (struct pollfd) { .fd = s_ctx.listener, .events = POLLIN };
+
+		for (size_t i = 0; i < MAX_CONNECTIONS; ++i) {
+			connection_t* c = &s_ctx.connections[i];
+			if (c->fd < 0) continue;
+
+			// One request at a time per connection, next one is read once the response is gone.
+			short events = 0;
+			if (!c->has_response) {
+				events = POLLIN;
+			} else if (now >= c->ready_at) {
+				events = POLLOUT;
+			} else if (timeout < 0 || c->ready_at - now < timeout) {
+				timeout = c->ready_at - now;
+			}
+
+			polled[num_fds] = c;
+			fds[num_fds++]  = (struct pollfd) { .fd = c->fd, .events = events };
+		}
+
+		if (poll(fds, num_fds, timeout < 0 ? -1 : (int)timeout + 1) < 0) {
+			if (errno == EINTR) continue;
+			log_fatal("[server] Poll failed");
+		}
+
+		if (fds[0].revents & POLLIN) connection_accept();
+
+		for (size_t i = 1; i < num_fds; ++i) {
+			connection_t* c = polled[i];
+
+			if (fds[i].revents & (POLLERR | POLLNVAL)) {
+				connection_close(c);
+				continue;
+			}
+			if (fds[i].revents & POLLOUT) connection_send(c);
+			if (c->fd >= 0 && (fds[i].revents & (POLLIN | POLLHUP))) {
+				connection_read(c);
+				if (c->fd >= 0) connection_process(c);
+			}
+		}
+	}
+}
+
+static void usage() {
+	log_info("Usage: mock_server [options]");
+	log_info("  --port N           port to listen at on localhost (%u)", DEFAULT_PORT);
+	log_info("  --latency MS       added to every response (0)");
+	log_info("  --jitter MS        random extra latency up to it (0)");
+	log_info("  --error-rate F     chance of a 503 per request, 0..1 (0)");
+	log_info("  --throttle-rate F  chance of a 429 per request, 0..1 (0)");
+	log_info("  --seed N           seed of the generated planes (1)");
+	log_info("  --json             answers maps with JSON only, as the old server does");
+	log_info("  --verbose          logs every request");
+}
+
+static void parse_args(int argc, const char* argv[], config_t* c) {
+	for (int i = 1; i < argc; ++i) {
+		const char* arg   = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if      (strcmp(arg, "--json") == 0)                       c->is_json_only  = true;
+		else if (strcmp(arg, "--verbose") == 0)                    c->is_verbose    = true;
+		else if (strcmp(arg, "--port") == 0 && value)              c->port          = strtol(argv[++i], NULL, 10);
+		else if (strcmp(arg, "--latency") == 0 && value)           c->latency_ms    = strtol(argv[++i], NULL, 10);
+		else if (strcmp(arg, "--jitter") == 0 && value)            c->jitter_ms     = strtol(argv[++i], NULL, 10);
+		else if (strcmp(arg, "--error-rate") == 0 && value)        c->error_rate    = strtod(argv[++i], NULL);
+		else if (strcmp(arg, "--throttle-rate") == 0 && value)     c->throttle_rate = strtod(argv[++i], NULL);
+		else if (strcmp(arg, "--seed") == 0 && value)              c->seed          = strtol(argv[++i], NULL, 10);
+		else {
+			usage();
+			exit(strcmp(arg, "--help") == 0 ? 0 : 1);
+		}
+	}
+}
+
+int main(int argc, const char* argv[]) {
+	config_t* c = &s_ctx.config;
+	c->port = DEFAULT_PORT;
+	c->seed = 1;
+	parse_args(argc, argv, c);
+
+	s_ctx.random = c->seed * 2654435761u | 1;
+
+	for (size_t i = 0; i < MAX_CONNECTIONS; ++i) s_ctx.connections[i].fd = -1;
+
+	player_t* p = &s_ctx.player;
+	strcpy(p->username, "player");
+	strcpy(p->plane_id, DEFAULT_PLANE);
+	p->x          = SPAWN_X;
+	p->y          = SPAWN_Y;
+	p->changed_at = time(NULL);
+
+	signal(SIGINT,  on_signal);
+	signal(SIGTERM, on_signal);
+	// A client going away mid-response is not a reason to die.
+	signal(SIGPIPE, SIG_IGN);
+
+	listen_on(c->port);
+	log_info("[server] Listening on localhost:%u, latency %u+%u ms, errors %.2f, throttling %.2f",
+		c->port, c->latency_ms, c->jitter_ms, c->error_rate, c->throttle_rate);
+
+	serve();
+
+	log_info("[server] Served %u requests, %u failed, %llu bytes", s_ctx.num_requests, s_ctx.num_errors, (unsigned long long)s_ctx.bytes_out);
+
+	for (size_t i = 0; i < MAX_CONNECTIONS; ++i) {
+		if (s_ctx.connections[i].fd >= 0) connection_close(&s_ctx.connections[i]);
+	}
+	for (size_t i = 0; i < s_ctx.num_planes; ++i) free(s_ctx.planes[i]);
+	close(s_ctx.listener);
+
+	return 0;
+}
@@ -1,7 +1,7 @@
 #include "api.h"
 
 #include <assert.h>
-#include <string.h> // strcmp
+#include <string.h> // strcmp, memcmp
 
 #include "utils.h"
 #include "log.h"
@@ -114,6 +114,45 @@ static uint8_t parse_terrain(const char* key) {
 	return TERRAIN_DEFAULT;
 }
 
+#define COMPACT_MAP_MAGIC       "B4RM"
+#define COMPACT_MAP_VERSION     1
+#define COMPACT_MAP_HEADER_SIZE 12
+
+enum {
+	COMPACT_MAP_RAW = 0,
+	COMPACT_MAP_RLE = 1
+};
+
+static inline uint16_t read_u16(const uint8_t* p) {
+	return p[0] | (p[1] << 8);
+}
+
+static inline void unpack_tile(uint8_t tile, api_map_terrain_t* terrain) {
+	terrain->is_hidden = tile >> 7;
+	terrain->type      = terrain->is_hidden ? TERRAIN_DEFAULT : (tile & 0x7F);
+}
+
+static void parse_location(const struct json_t* json, json_iterator_t loc, api_map_terrain_t* terrain) {
+	assert(json);
+	assert(terrain);
+
+	bool    is_hidden = false;
+	uint8_t type      = 0;
+
+	if (json_has_property(json, loc, "hidden")) {
+		is_hidden = BOOL_PROPERTY(json, loc, "hidden");
+	}
+
+	if (!is_hidden) {
+		char terrain_id[MAX_API_STRING_LENGTH];
+		STRING_PROPERTY(json, loc, "static_id", terrain_id);
+		type = parse_terrain(terrain_id);
+	}
+
+	terrain->is_hidden = is_hidden;
+	terrain->type      = type;
+}
+
 bool api_parse_map(struct allocator_t* alloc, const char* data, api_map_t* map) {
 	assert(alloc);
 	assert(data);
@@ -138,25 +177,94 @@ bool api_parse_map(struct allocator_t* alloc, const char* data, api_map_t* map)
 
 		for (size_t x = 0; x < N; ++x) {
 			const json_iterator_t loc = json_array_value(json, row, x);
-			
-			bool    is_hidden = false;
-			uint8_t type      = 0;
+			parse_location(json, loc, terrain);
+			++terrain;
+		}
+	}
 
-			if (json_has_property(json, loc, "hidden")) {
-				is_hidden = BOOL_PROPERTY(json, loc, "hidden");
-			}
+	json_free(json);
+	return true;
+}
 
-			if (!is_hidden) {
-				char terrain_id[MAX_API_STRING_LENGTH];
-				STRING_PROPERTY(json, loc, "static_id", terrain_id);
-				type = parse_terrain(terrain_id);
+bool api_parse_map_compact(const uint8_t* data, size_t size, size_t max_tiles, api_map_t* map) {
+	assert(data);
+	assert(map);
+
+	if (size < COMPACT_MAP_HEADER_SIZE || memcmp(data, COMPACT_MAP_MAGIC, 4) != 0) return false;
+
+	if (data[4] != COMPACT_MAP_VERSION) {
+		log_error("[api] Unsupported compact map version %u", data[4]);
+		return false;
+	}
+
+	const uint8_t encoding = data[5];
+	const size_t  N        = read_u16(data + 10);
+	const size_t  tiles    = N * N;
+
+	if (tiles > max_tiles) {
+		log_error("[api] Compact map is too big: %zu", N);
+		return false;
+	}
+
+	map->x    = (int16_t)read_u16(data + 6);
+	map->y    = (int16_t)read_u16(data + 8);
+	map->size = N;
+
+	const uint8_t* payload      = data + COMPACT_MAP_HEADER_SIZE;
+	const size_t   payload_size = size - COMPACT_MAP_HEADER_SIZE;
+
+	api_map_terrain_t* terrain = map->data;
+
+	switch (encoding) {
+		case COMPACT_MAP_RAW:
+			if (payload_size < tiles) return false;
+			for (size_t i = 0; i < tiles; ++i) {
+				unpack_tile(payload[i], &terrain[i]);
 			}
+			return true;
+
+		case COMPACT_MAP_RLE: {
+			size_t t = 0;
+			for (size_t i = 0; i + 1 < payload_size && t < tiles; i += 2) {
+				const size_t run = payload[i];
+				if (run > tiles - t) return false;
+
+				api_map_terrain_t value;
+				unpack_tile(payload[i + 1], &value);
+				for (size_t r = 0; r < run; ++r) {
+					terrain[t++] = value;
+				}
+			}
+			return t == tiles;
+		}
 
-			terrain->is_hidden = is_hidden;
-			terrain->type      = type;
+		default:
+			log_error("[api] Unknown compact map encoding %u", encoding);
+			return false;
+	}
+}
 
-			++terrain;
+bool api_parse_reveal(struct allocator_t* alloc, const char* data, api_reveal_t* reveal) {
+	assert(alloc);
+	assert(data);
+	assert(reveal);
+
+	reveal->has_terrain = false;
+
+	struct json_t* json = json_parse(alloc, data);
+	if (!json) return false;
+
+	// The server either answers with a revealed location or with a 1x1 map around it.
+	if (json_has_property(json, 0, "map")) {
+		const json_iterator_t locations = json_property(json, 0, "map");
+		if (json_array_size(json, locations) == 1) {
+			const json_iterator_t row = json_array_value(json, locations, 0);
+			parse_location(json, json_array_value(json, row, 0), &reveal->terrain);
+			reveal->has_terrain = true;
 		}
+	} else if (json_has_property(json, 0, "static_id") || json_has_property(json, 0, "hidden")) {
+		parse_location(json, 0, &reveal->terrain);
+		reveal->has_terrain = true;
 	}
 
 	json_free(json);
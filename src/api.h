@@ -64,12 +64,31 @@ typedef struct {
 } api_map_terrain_t;
 
 typedef struct api_map_t {
+	// Not a part of the response, filled from the request.
+	char plane_id[MAX_API_STRING_LENGTH];
+
 	int32_t x, y;
 	size_t  size;
 
 	api_map_terrain_t data[];
 } api_map_t;
 
+typedef struct {
+	int32_t x, y;
+
+	// False if the server answered with an empty body, so the tile has to be re-fetched.
+	bool              has_terrain;
+	api_map_terrain_t terrain;
+} api_reveal_t;
+
 bool api_parse_state(struct allocator_t* alloc, const char* data, api_state_t* state);
 // TODO: @robustness Pass available buffer size.
 bool api_parse_map(struct allocator_t* alloc, const char* data, api_map_t* map);
+// Compact map encoding, asked for with "?format=compact", little-endian:
+//   "B4RM", u8 version (1), u8 encoding (0 - raw, 1 - rle), i16 x, i16 y, u16 size, payload.
+// Tile is a byte - terrain id (world_terrain_t) in the low 7 bits, hidden flag in the high one.
+// Raw payload is size*size tiles, row after row. RLE payload is (u8 run, u8 tile) pairs over the same order.
+// Returns false if data is not a compact map (e.g. server doesn't support it and answered with JSON) or is broken.
+bool api_parse_map_compact(const uint8_t* data, size_t size, size_t max_tiles, api_map_t* map);
+// Doesn't touch reveal coordinates, those are filled by the caller.
+bool api_parse_reveal(struct allocator_t* alloc, const char* data, api_reveal_t* reveal);
@@ -1,5 +1,10 @@
 #include "entry/entry.h"
 
+#include <assert.h>
+#include <string.h> // strcmp
+#include <stdlib.h> // atof, atoi
+#include <signal.h>
+
 #include <bgfx/bgfx.h>
 #include <bgfx/platform.h>
 #include <gb_math.h>
@@ -12,13 +17,54 @@
 #include "http.h"
 #include "allocator.h"
 #include "log.h"
+#include "timer.h"
+#include "profile.h"
+#include "metrics.h"
 
 static struct {
 	uint16_t w;
 	uint16_t h;
 	uint32_t reset;
+
+	double update_ms;
+	double render_ms;
+
+	const char*           profile_path;
+	bool                  should_profile_on_exit;
+	volatile sig_atomic_t should_dump_profile;
+
+	metrics_id_t frame_metric;
 } s_ctx;
 
+#define HTTP_CACHE_DIR       ".http_cache"
+#define HTTP_CACHE_MAX_BYTES (64 * 1024 * 1024)
+
+#define DEFAULT_PROFILE_PATH "profile.json"
+
+#define DEFAULT_METRICS_PERIOD_S 10
+
+static bool has_arg(int32_t argc, const char* argv[], const char* arg) {
+	for (int32_t i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], arg) == 0) return true;
+	}
+	return false;
+}
+
+// Value following the arg, NULL if there is none.
+static const char* arg_value(int32_t argc, const char* argv[], const char* arg) {
+	for (int32_t i = 1; i + 1 < argc; ++i) {
+		if (strcmp(argv[i], arg) == 0) return argv[i + 1];
+	}
+	return NULL;
+}
+
+#ifdef BR_PROFILE
+// Profile is dumped on demand with kill -USR1, at the end of the frame.
+static void on_profile_signal(int sig) {
+	s_ctx.should_dump_profile = 1;
+}
+#endif
+
 static void check_resized() {
 	const entry_window_info_t* ewi = entry_get_window();
 	if (ewi->width != s_ctx.w || ewi->height != s_ctx.h) {
@@ -29,10 +75,21 @@ static void check_resized() {
 }
 
 bool entry_init(int32_t argc, const char* argv[]) {
+	PROFILE_THREAD("main");
+
+	// Scopes are always recorded when profiling is compiled in, --profile also dumps them on exit.
+	s_ctx.profile_path           = arg_value(argc, argv, "--profile");
+	s_ctx.should_profile_on_exit = s_ctx.profile_path != NULL;
+	if (!s_ctx.profile_path) s_ctx.profile_path = DEFAULT_PROFILE_PATH;
+#ifdef BR_PROFILE
+	signal(SIGUSR1, on_profile_signal);
+#endif
+
 	const entry_window_info_t* ewi = entry_get_window();
 	s_ctx.w     = ewi->width;
 	s_ctx.h     = ewi->height;
-	s_ctx.reset = BGFX_RESET_VSYNC;
+	// Headless frames are measured, nothing to wait for.
+	s_ctx.reset = ewi->is_headless ? BGFX_RESET_NONE : BGFX_RESET_VSYNC;
 
 	bgfx_platform_data_t pd = {0};
 	pd.ndt = ewi->display;
@@ -41,7 +98,7 @@ bool entry_init(int32_t argc, const char* argv[]) {
 	bgfx_set_platform_data(&pd);
 
 	/* bgfx_init(BGFX_RENDERER_TYPE_METAL, BGFX_PCI_ID_NONE, 0, NULL, NULL); */
-	bgfx_init(BGFX_RENDERER_TYPE_COUNT, BGFX_PCI_ID_NONE, 0, NULL, NULL);
+	bgfx_init(ewi->is_headless ? BGFX_RENDERER_TYPE_NOOP : BGFX_RENDERER_TYPE_COUNT, BGFX_PCI_ID_NONE, 0, NULL, NULL);
 	bgfx_reset(s_ctx.w, s_ctx.h, s_ctx.reset);
 	bgfx_set_debug(BGFX_DEBUG_TEXT);
 
@@ -49,20 +106,64 @@ bool entry_init(int32_t argc, const char* argv[]) {
 
 	render_init();
 	render_text_init();
-	http_init();
+
+	http_config_t http = http_config_default();
+	http.cache_dir       = HTTP_CACHE_DIR;
+	http.cache_max_bytes = HTTP_CACHE_MAX_BYTES;
+	http.is_offline      = has_arg(argc, argv, "--offline");
+	http.record_path     = arg_value(argc, argv, "--record");
+	http.replay_path     = arg_value(argc, argv, "--replay");
+
+	const char* scale = arg_value(argc, argv, "--replay-scale");
+	if (scale) http.replay_latency_scale = atof(scale);
+
+	// Bad network, e.g. --net-rtt 300 --net-jitter 200 --net-down 50000 --net-failures 0.05.
+	http_conditions_t* net = &http.conditions;
+	const char*        v;
+	if ((v = arg_value(argc, argv, "--net-rtt")))      net->rtt_ms                    = atoi(v);
+	if ((v = arg_value(argc, argv, "--net-jitter")))   net->jitter_ms                 = atoi(v);
+	if ((v = arg_value(argc, argv, "--net-down")))     net->download_bytes_per_second = atoi(v);
+	if ((v = arg_value(argc, argv, "--net-up")))       net->upload_bytes_per_second   = atoi(v);
+	if ((v = arg_value(argc, argv, "--net-failures"))) net->failure_rate              = atof(v);
+	if ((v = arg_value(argc, argv, "--net-seed")))     net->seed                      = atoi(v);
+
+	http_init(&http);
+
+	// Frame times & the rest of metrics.h, e.g. --metrics metrics.log --metrics-period 60.
+	s_ctx.frame_metric = metrics_histogram("frame_us");
+	const char* metrics_path = arg_value(argc, argv, "--metrics");
+	if (metrics_path) {
+		const char* period = arg_value(argc, argv, "--metrics-period");
+		metrics_open(metrics_path, (period ? atoi(period) : DEFAULT_METRICS_PERIOD_S) * 1000);
+	}
+
 	imgui_init();
 
 	return game_init(argc, argv);
 }
 
 bool entry_tick(float dt) {
+	PROFILE_SCOPE("entry_tick");
+
+	const uint64_t tick_start = timer_current_ns();
+
 	check_resized();
 
 	bgfx_dbg_text_clear(0, false);
 	
-	input_update();
-	imgui_update();
-	bool should_continue = game_update(s_ctx.w, s_ctx.h, dt);
+	{
+		PROFILE_SCOPE("input_update");
+		input_update();
+		imgui_update();
+	}
+
+	const double update_start = timer_current();
+	bool should_continue;
+	{
+		PROFILE_SCOPE("game_update");
+		should_continue = game_update(s_ctx.w, s_ctx.h, dt);
+	}
+	s_ctx.update_ms = timer_current() - update_start;
 
 	bgfx_set_view_name(0, "main");
 	bgfx_set_view_mode(0, BGFX_VIEW_MODE_SEQUENTIAL);
@@ -73,19 +174,46 @@ bool entry_tick(float dt) {
 	gb_mat4_ortho2d(&proj, 0.0f, s_ctx.w, s_ctx.h, 0.0f);
 	bgfx_set_view_transform(0, NULL, proj.e);
 
-	game_render(s_ctx.w, s_ctx.h, dt);
+	const double render_start = timer_current();
+	{
+		PROFILE_SCOPE("game_render");
+		game_render(s_ctx.w, s_ctx.h, dt);
+	}
+	s_ctx.render_ms = timer_current() - render_start;
 
 	// Should be called after anything that can call IMGUI.
 	imgui_post_update();
 
-	bgfx_frame(false);
+	{
+		PROFILE_SCOPE("bgfx_frame");
+		bgfx_frame(false);
+	}
+
+	if (s_ctx.should_dump_profile) {
+		s_ctx.should_dump_profile = 0;
+		profile_dump(s_ctx.profile_path);
+	}
+
+	metrics_record(s_ctx.frame_metric, (timer_current_ns() - tick_start) / 1000);
+	metrics_update();
 
 	return should_continue;
 }
 
+void entry_frame_timings(double* update_ms, double* render_ms) {
+	assert(update_ms);
+	assert(render_ms);
+
+	*update_ms = s_ctx.update_ms;
+	*render_ms = s_ctx.render_ms;
+}
+
 void entry_shutdown() {
+	if (s_ctx.should_profile_on_exit) profile_dump(s_ctx.profile_path);
+
 	game_shutdown();
 	http_shutdown();
+	metrics_close();
 	render_text_shutdown();
 	render_shutdown();
 	bgfx_shutdown();
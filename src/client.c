@@ -2,29 +2,53 @@
 
 #include <stddef.h>
 #include <assert.h>
-#include <stdio.h>  // snprintf
+#include <stdio.h>  // snprintf, vsnprintf
+#include <stdarg.h>
+#include <string.h> // strncpy
 
 #include "utils.h"
 #include "log.h"
 #include "http.h"
 #include "allocator.h"
 #include "api.h"
+#include "timer.h"
+#include "metrics.h"
 
-// TODO: Handle too-much-requests!
+// Deadlines, a stuck poll or block fetch is better failed and asked for again.
+#define STATE_TIMEOUT_MS (10 * 1000)
+#define MAP_TIMEOUT_MS   (15 * 1000)
 
+// Local one is server/mock_server.c, see `make serve`.
 /* #define USE_LOCAL_SERVER */
 
 #if defined(DEBUG) && defined(USE_LOCAL_SERVER)
-	#define API_ENDPOINT(s) "http://localhost:8080/api/"s
+	#define API_ENDPOINT "http://localhost:8080/api/"
 #else
-	#define API_ENDPOINT(s) "http://ancientlighthouse.com:8080/api/"s
+	#define API_ENDPOINT "http://ancientlighthouse.com:8080/api/"
 #endif
 
-#define RESPONSE_BUFFER_SIZE (4 * 8 * 1024)
+#define MAX_ENDPOINT_LENGTH 128
+#define MAX_URL_LENGTH      (MAX_ENDPOINT_LENGTH + MAX_API_STRING_LENGTH + 64)
+
+#define RESPONSE_BUFFER_SIZE (8 * 8 * 1024)
 #define RESPONSE_MESSAGE_BUFFER_SIZE (4 * 8 * 1024)
 // Must be a power-of-two.
 #define MAX_PAGES  16
 #define ITEMS_MASK (MAX_PAGES - 1)
+// Left for state polls, moves, reveals & their map refetches, map batches never take them.
+#define PAGES_RESERVED 4
+
+// Batched map requests are capped by the response buffer, 32x32 tiles of JSON fit nicely.
+#define MAP_BATCH_MAX_TILES         32
+// Once the server proved it talks compact maps, a byte per tile allows way bigger batches.
+#define MAP_BATCH_MAX_TILES_COMPACT 64
+// In blocks, per axis.
+#define MAP_BATCH_GRID_SIZE 32
+
+// Validators of the last 200 responses, per URL.
+#define MAX_VALIDATORS 128
+// Per request, including the conditional ones.
+#define MAX_HEADERS 4
 
 typedef struct {
 #ifdef DEBUG
@@ -33,78 +57,152 @@ typedef struct {
 
 	http_work_id_t request_id;
 
+	// Identical GETs in flight share a page, the message is delivered once per caller.
+	// 0 for anything but GETs.
+	uint64_t url_hash;
+	uint8_t  num_callers;
+	// Sent validators, so can be answered with a 304.
+	bool     is_conditional;
+
+	// Request parameters, for handlers which can't get everything from a response.
+	int32_t args[3];
+	char    plane_id[MAX_API_STRING_LENGTH];
+
 	uint8_t index;
 	uint8_t next;
 
 	uint8_t response_type;
+	size_t  response_size;
 	uint8_t response_buffer[RESPONSE_BUFFER_SIZE];
 	uint8_t response_message[RESPONSE_MESSAGE_BUFFER_SIZE];
 } page_t;
 
+typedef struct {
+	// 0 for a free one.
+	uint64_t url_hash;
+	uint32_t last_used;
+	char     etag[HTTP_MAX_ETAG_LENGTH];
+	char     last_modified[HTTP_MAX_LAST_MODIFIED_LENGTH];
+} validator_t;
+
 typedef struct {
 	uint32_t  read;
 	uint32_t  write;
 	page_t*   items[MAX_PAGES];
 } messages_t;
 
-static struct {
+typedef struct client_ctx_t {
 	messages_t messages;
 
 	page_t  pages[MAX_PAGES];
 	uint8_t pages_free;
+	uint8_t num_pages_used;
 
 	page_t* pages_in_work[MAX_PAGES];
 	uint8_t num_pages_in_work;
-} s_ctx;
+
+	bool has_compact_maps;
+
+	// Responses are per user, so is their disk cache. Empty when logged out.
+	char username[MAX_API_STRING_LENGTH];
+
+	// Unchanged state or map costs a 304 without a body.
+	validator_t validators[MAX_VALIDATORS];
+	uint32_t    validators_tick;
+} client_ctx_t;
+
+// Bound one, the app never binds anything but the built-in one.
+static client_ctx_t  s_default;
+static client_ctx_t* s_ctx = &s_default;
+
+// Shared by all of them.
+static char s_endpoint[MAX_ENDPOINT_LENGTH] = API_ENDPOINT;
+
+// Shared as well, numbers of all the instances add up. Parsing is per message type.
+static struct {
+	metrics_id_t pages_in_use;
+	metrics_id_t parse_us[MESSAGE_TYPE_COUNT];
+} s_metrics;
 
 // RESPONSE -> MESSAGE
 // ===================
 
-typedef void (*handler_t)(const void* response, void* out_msg);
+// Handlers are called for failed requests too, but only 200 responses carry a body worth parsing.
+typedef void (*handler_t)(const page_t* p, uint16_t code, void* out_msg);
 
-void handle_noop(const void* response, void* out_msg) {
-	assert(response);
+void handle_noop(const page_t* p, uint16_t code, void* out_msg) {
+	assert(p);
 	assert(out_msg);
 }
 
-void handle_login(const void* response, void* out_msg) {
-	assert(response);
+void handle_login(const page_t* p, uint16_t code, void* out_msg) {
+	assert(p);
 	assert(out_msg);
 	// TODO: Nothing, I guess.
 }
 
-void handle_logout(const void* response, void* out_msg) {
-	assert(response);
+void handle_logout(const page_t* p, uint16_t code, void* out_msg) {
+	assert(p);
 	assert(out_msg);
 }
 
-void handle_state(const void* response, void* out_msg) {
-	assert(response);
+void handle_state(const page_t* p, uint16_t code, void* out_msg) {
+	assert(p);
 	assert(out_msg);
 
-	api_parse_state(allocator_main(), response, out_msg);
+	if (code != 200) return;
+	api_parse_state(allocator_main(), (const char*)p->response_buffer, out_msg);
 }
 
-void handle_map(const void* response, void* out_msg) {
-	assert(response);
+void handle_map(const page_t* p, uint16_t code, void* out_msg) {
+	assert(p);
 	assert(out_msg);
 
-	api_parse_map(allocator_main(), response, out_msg);
+	api_map_t* m = out_msg;
+	strncpy(m->plane_id, p->plane_id, MAX_API_STRING_LENGTH);
+
+	// Failed one still tells what was asked for.
+	if (code != 200) {
+		m->x    = p->args[0];
+		m->y    = p->args[1];
+		m->size = p->args[2];
+		return;
+	}
+
+	const size_t max_tiles = RESPONSE_MESSAGE_BUFFER_SIZE - sizeof(message_t) - sizeof(api_map_t);
+	if (api_parse_map_compact(p->response_buffer, p->response_size, max_tiles, m)) {
+		if (!s_ctx->has_compact_maps) log_info("[client] Server supports compact maps");
+		s_ctx->has_compact_maps = true;
+		return;
+	}
+
+	// Falls back to JSON, if server doesn't know the compact format.
+	api_parse_map(allocator_main(), (const char*)p->response_buffer, m);
 }
 
-void handle_reveal(const void* response, void* out_msg) {
-	assert(response);
+void handle_reveal(const page_t* p, uint16_t code, void* out_msg) {
+	assert(p);
 	assert(out_msg);
+
+	api_reveal_t* r = out_msg;
+	r->x           = p->args[0];
+	r->y           = p->args[1];
+	r->has_terrain = false;
+
+	// Empty body is fine, it just has no terrain to patch with.
+	if (code == 200) api_parse_reveal(allocator_main(), (const char*)p->response_buffer, r);
 }
 
-static const struct { uint8_t t; handler_t h; }
+static const struct { uint8_t t; handler_t h; const char* metric; }
 HANDLERS[] = {
-	{ MESSAGE_TYPE_NOOP,   handle_noop   },
-	{ MESSAGE_TYPE_LOGIN,  handle_login  },
-	{ MESSAGE_TYPE_LOGOUT, handle_logout },
-	{ MESSAGE_TYPE_STATE,  handle_state  },
-	{ MESSAGE_TYPE_MAP,    handle_map    },
-	{ MESSAGE_TYPE_REVEAL, handle_reveal }
+	{ MESSAGE_TYPE_NOOP,   handle_noop,   "client.parse_us.noop"   },
+	{ MESSAGE_TYPE_LOGIN,  handle_login,  "client.parse_us.login"  },
+	{ MESSAGE_TYPE_LOGOUT, handle_logout, "client.parse_us.logout" },
+	{ MESSAGE_TYPE_STATE,  handle_state,  "client.parse_us.state"  },
+	{ MESSAGE_TYPE_MAP,    handle_map,    "client.parse_us.map"    },
+	{ MESSAGE_TYPE_REVEAL, handle_reveal, "client.parse_us.reveal" },
+	// Only the response code matters.
+	{ MESSAGE_TYPE_MOVE,   handle_noop,   "client.parse_us.move"   }
 };
 
 static handler_t handlers_lookup(uint8_t type) {
@@ -114,11 +212,100 @@ static handler_t handlers_lookup(uint8_t type) {
 	return HANDLERS[0].h;
 }
 
+// HELPERS
+// =======
+
+// FNV-1a.
+static uint64_t hash_url(const char* url) {
+	assert(url);
+
+	uint64_t h = 14695981039346656037ull;
+	for (const char* c = url; *c; ++c) {
+		h ^= (uint8_t)*c;
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+// Endpoint is known at runtime, so it's prepended to the path here.
+static const char* api_url(char url[MAX_URL_LENGTH], const char* format, ...) {
+	assert(url);
+	assert(format);
+
+	const int n = snprintf(url, MAX_URL_LENGTH, "%s", s_endpoint);
+
+	va_list args;
+	va_start(args, format);
+	vsnprintf(url + n, MAX_URL_LENGTH - n, format, args);
+	va_end(args);
+
+	return url;
+}
+
+// VALIDATORS
+// ==========
+
+static validator_t* validators_find(uint64_t url_hash) {
+	assert(url_hash);
+
+	for (size_t i = 0; i < MAX_VALIDATORS; ++i) {
+		validator_t* v = &s_ctx->validators[i];
+		if (v->url_hash == url_hash) {
+			v->last_used = ++s_ctx->validators_tick;
+			return v;
+		}
+	}
+	return NULL;
+}
+
+// Takes the one for the url, a free one, or the least recently used one.
+static validator_t* validators_alloc(uint64_t url_hash) {
+	assert(url_hash);
+
+	validator_t* victim = &s_ctx->validators[0];
+	for (size_t i = 0; i < MAX_VALIDATORS; ++i) {
+		validator_t* v = &s_ctx->validators[i];
+		if (v->url_hash == url_hash || v->url_hash == 0) {
+			victim = v;
+			break;
+		}
+		if (v->last_used < victim->last_used) victim = v;
+	}
+
+	victim->url_hash  = url_hash;
+	victim->last_used = ++s_ctx->validators_tick;
+	return victim;
+}
+
+static void validators_store(uint64_t url_hash, http_work_id_t id) {
+	assert(url_hash);
+
+	char etag[HTTP_MAX_ETAG_LENGTH];
+	char last_modified[HTTP_MAX_LAST_MODIFIED_LENGTH];
+
+	const bool has_etag          = http_response_etag(id, etag, sizeof(etag));
+	const bool has_last_modified = http_response_last_modified(id, last_modified, sizeof(last_modified));
+
+	if (!has_etag && !has_last_modified) {
+		validator_t* v = validators_find(url_hash);
+		if (v) v->url_hash = 0;
+		return;
+	}
+
+	validator_t* v = validators_alloc(url_hash);
+	strcpy(v->etag,          has_etag          ? etag          : "");
+	strcpy(v->last_modified, has_last_modified ? last_modified : "");
+}
+
+static void validators_clear() {
+	memset(s_ctx->validators, 0, sizeof(s_ctx->validators));
+}
+
 // MESSAGES MANAGEMENT
 // ===================
 
 static size_t messages_size() {
-	return s_ctx.messages.write - s_ctx.messages.read;
+	return s_ctx->messages.write - s_ctx->messages.read;
 }
 
 static bool messages_full() {
@@ -126,26 +313,26 @@ static bool messages_full() {
 }
 
 static bool messages_empty() {
-	return s_ctx.messages.read == s_ctx.messages.write;
+	return s_ctx->messages.read == s_ctx->messages.write;
 }
 
 static void messages_push(page_t* p) {
 	assert(!messages_full());
 	assert(p);
 
-	const uint32_t i = s_ctx.messages.write++;
-	s_ctx.messages.items[i & ITEMS_MASK] = p;
+	const uint32_t i = s_ctx->messages.write++;
+	s_ctx->messages.items[i & ITEMS_MASK] = p;
 }
 
 static page_t* messages_peek() {
 	assert(!messages_empty());
-	const uint32_t i = s_ctx.messages.read;
-	return s_ctx.messages.items[i & ITEMS_MASK];
+	const uint32_t i = s_ctx->messages.read;
+	return s_ctx->messages.items[i & ITEMS_MASK];
 }
 
 static void messages_consume() {
 	assert(!messages_empty());
-	++s_ctx.messages.read;
+	++s_ctx->messages.read;
 }
 
 // PAGES MANAGEMENT
@@ -153,19 +340,25 @@ static void messages_consume() {
 
 static void pages_init() {
 	for (size_t i = 0; i < MAX_PAGES; ++i) {
-		s_ctx.pages[i].index = i;
-		s_ctx.pages[i].next  = i + 1;
+		s_ctx->pages[i].index = i;
+		s_ctx->pages[i].next  = i + 1;
 	}
 }
 
 static page_t* pages_alloc(uint8_t type, const char* tag) {
-	assert(s_ctx.pages_free < MAX_PAGES);
+	assert(s_ctx->pages_free < MAX_PAGES);
 
-	const size_t f = s_ctx.pages_free;
-	s_ctx.pages_free = s_ctx.pages[f].next;
+	const size_t f = s_ctx->pages_free;
+	s_ctx->pages_free = s_ctx->pages[f].next;
+	++s_ctx->num_pages_used;
 
-	page_t* p = &s_ctx.pages[f];
+	metrics_change(s_metrics.pages_in_use, 1);
+
+	page_t* p = &s_ctx->pages[f];
 	p->response_type = type;
+	p->url_hash       = 0;
+	p->num_callers    = 1;
+	p->is_conditional = false;
 
 #ifdef DEBUG
 	p->tag = tag;
@@ -176,18 +369,25 @@ static page_t* pages_alloc(uint8_t type, const char* tag) {
 	return p;
 }
 
+static bool pages_can_alloc_for_batch() {
+	return s_ctx->num_pages_used < MAX_PAGES - PAGES_RESERVED;
+}
+
 static void pages_free(page_t* p) {
 	assert(p);
 
-	p->next          = s_ctx.pages_free;
-	s_ctx.pages_free = p->index;
+	p->next          = s_ctx->pages_free;
+	s_ctx->pages_free = p->index;
+	--s_ctx->num_pages_used;
+
+	metrics_change(s_metrics.pages_in_use, -1);
 }
 
 static void pages_put_in_work(page_t* p) {
 	assert(p);
-	assert(s_ctx.num_pages_in_work < MAX_PAGES);
+	assert(s_ctx->num_pages_in_work < MAX_PAGES);
 
-	s_ctx.pages_in_work[s_ctx.num_pages_in_work++] = p;
+	s_ctx->pages_in_work[s_ctx->num_pages_in_work++] = p;
 }
 
 static void pages_handle_response(page_t* p) {
@@ -197,37 +397,47 @@ static void pages_handle_response(page_t* p) {
 	log_info("[client] Got a response for \"%s\"", p->tag);
 #endif
 
-	uint8_t code;
-	if (http_response_code(p->request_id, &code)) {
+	// Cancelled, timed out or never issued ones are delivered as failed without a response.
+	uint16_t code  = 0;
+	size_t   bytes = 0;
+	if (http_response_code(p->request_id, &code) && http_response_size(p->request_id, &bytes)) {
 		log_info("[client] Got a response code %u", code);
-		size_t bytes;
-		if (http_response_size(p->request_id, &bytes)) {
-			/* log_info("[client] Got a response %zu bytes:", bytes); */
-			/* log_info("[client] %s", p->response_buffer); */
+		/* log_info("[client] Got a response %zu bytes:", bytes); */
+		/* log_info("[client] %s", p->response_buffer); */
 
-			message_t* m = (message_t*)p->response_message;
-			m->type = p->response_type;
+		if (p->url_hash && code == 200) validators_store(p->url_hash, p->request_id);
+	} else {
+		log_info("[client] Request failed with status %d", http_status(p->request_id));
+	}
 
-			handler_t h = handlers_lookup(p->response_type);
-			h(p->response_buffer, m->data);
+	p->response_size = bytes;
 
-			messages_push(p);
-		}
-	}
+	message_t* m = (message_t*)p->response_message;
+	m->type = p->response_type;
+	m->code = code;
+
+	const uint64_t start = timer_current_ns();
+
+	handler_t h = handlers_lookup(p->response_type);
+	h(p, code, m->data);
+
+	metrics_record(s_metrics.parse_us[p->response_type], (timer_current_ns() - start) / 1000);
+
+	messages_push(p);
 }
 
 static void pages_update() {
-	page_t** pages_in_work = s_ctx.pages_in_work;
+	page_t** pages_in_work = s_ctx->pages_in_work;
 
 	size_t i = 0;
-	size_t n = s_ctx.num_pages_in_work;
+	size_t n = s_ctx->num_pages_in_work;
 
 	while (i < n) {
 		page_t* p = pages_in_work[i];
 
-		// TODO: Handle unknown status by dropping it (can issue a message though).
-		if (http_status(p->request_id) == HTTP_STATUS_FINISHED) {
+		if (http_status(p->request_id) != HTTP_STATUS_IN_PROGRESS) {
 			pages_handle_response(p);
+			http_release(p->request_id);
 			pages_in_work[i] = pages_in_work[n - 1];
 			--n;
 		} else {
@@ -235,49 +445,136 @@ static void pages_update() {
 		}
 	}
 
-	s_ctx.num_pages_in_work = n;
+	s_ctx->num_pages_in_work = n;
 }
 
 // API HELPERS
 // ===========
 
-static void api_get(const char* url, uint8_t type, const char* tag) {
+static page_t* pages_find_in_work(uint64_t url_hash, uint8_t type, bool is_conditional) {
+	for (size_t i = 0; i < s_ctx->num_pages_in_work; ++i) {
+		page_t* p = s_ctx->pages_in_work[i];
+		if (p->url_hash == url_hash && p->response_type == type && p->is_conditional == is_conditional && p->num_callers < UINT8_MAX) return p;
+	}
+	return NULL;
+}
+
+// Conditional one can be answered with a 304, if the caller still has the last result of the url.
+static page_t* api_get(const char* url, const http_options_t* options, uint8_t type, const char* tag, bool is_conditional) {
 	assert(url);
 
-	page_t* p     = pages_alloc(type, tag);
-	p->request_id = http_get(url, p->response_buffer, RESPONSE_BUFFER_SIZE);
+	// Same GET is already on its way, no need to fetch & parse it twice.
+	const uint64_t url_hash = hash_url(url);
+	page_t*        same     = pages_find_in_work(url_hash, type, is_conditional);
+	if (same) {
+		log_info("[client] Joining in-flight request for \"%s\"", tag);
+		++same->num_callers;
+		return same;
+	}
+
+	http_options_t o = options ? *options : (http_options_t) {0};
+	o.endpoint       = tag;
+	o.cache_scope    = s_ctx->username[0] ? s_ctx->username : NULL;
+
+	const char* headers[MAX_HEADERS];
+	char        if_none_match[HTTP_MAX_ETAG_LENGTH + 32];
+	char        if_modified_since[HTTP_MAX_LAST_MODIFIED_LENGTH + 32];
+
+	assert(o.num_headers + 2 <= MAX_HEADERS);
+	for (size_t i = 0; i < o.num_headers; ++i) {
+		headers[i] = o.headers[i];
+	}
+
+	const validator_t* v = is_conditional ? validators_find(url_hash) : NULL;
+	if (v && v->etag[0]) {
+		snprintf(if_none_match, sizeof(if_none_match), "If-None-Match: %s", v->etag);
+		headers[o.num_headers++] = if_none_match;
+	}
+	if (v && v->last_modified[0]) {
+		snprintf(if_modified_since, sizeof(if_modified_since), "If-Modified-Since: %s", v->last_modified);
+		headers[o.num_headers++] = if_modified_since;
+	}
+	o.headers = headers;
+
+	page_t* p         = pages_alloc(type, tag);
+	p->url_hash       = url_hash;
+	p->is_conditional = is_conditional;
+	p->request_id     = http_get(url, &o, p->response_buffer, RESPONSE_BUFFER_SIZE);
 
 	pages_put_in_work(p);
+	return p;
 }
 
-static void api_post_form(const char* url, const http_form_part_t* parts, size_t num_parts, uint8_t type, const char* tag) {
+static page_t* api_post_form(const char* url, const http_form_part_t* parts, size_t num_parts, uint8_t type, const char* tag) {
 	assert(url);
 
+	const http_options_t options = { .endpoint = tag };
+
 	page_t* p     = pages_alloc(type, tag);
-	p->request_id = http_post_form(url, parts, num_parts, p->response_buffer, RESPONSE_BUFFER_SIZE);
+	p->request_id = http_post_form(url, parts, num_parts, &options, p->response_buffer, RESPONSE_BUFFER_SIZE);
 
 	pages_put_in_work(p);
+	return p;
 }
 
-static void api_post(const char* url, uint8_t type, const char* tag) {
-	api_post_form(url, NULL, 0, type, tag);
+static page_t* api_post(const char* url, uint8_t type, const char* tag) {
+	return api_post_form(url, NULL, 0, type, tag);
 }
 
-static void api_post_json(const char* url, const char* payload, uint8_t type, const char* tag) {
+static page_t* api_post_json(const char* url, const char* payload, uint8_t type, const char* tag) {
 	assert(url);
 	assert(payload);
 
+	const http_options_t options = { .endpoint = tag };
+
 	page_t* p     = pages_alloc(type, tag);
-	p->request_id = http_post_json(url, payload, p->response_buffer, RESPONSE_BUFFER_SIZE);
+	p->request_id = http_post_json(url, payload, &options, p->response_buffer, RESPONSE_BUFFER_SIZE);
 
 	pages_put_in_work(p);
+	return p;
 }
 
 // PUBLIC API
 // ==========
 
+client_ctx_t* client_ctx_create(struct allocator_t* alloc) {
+	assert(alloc);
+
+	// Pages are big, so it's zeroed without a copy on the stack.
+	client_ctx_t* c = BR_ALLOC(alloc, sizeof(client_ctx_t));
+	memset(c, 0, sizeof(client_ctx_t));
+	return c;
+}
+
+void client_ctx_destroy(struct allocator_t* alloc, client_ctx_t* c) {
+	assert(alloc);
+	assert(c);
+	assert(c != s_ctx);
+
+	BR_FREE(alloc, c);
+}
+
+void client_bind(client_ctx_t* c) {
+	s_ctx = c ? c : &s_default;
+}
+
+void client_set_endpoint(const char* url) {
+	assert(url);
+	assert(strlen(url) < MAX_ENDPOINT_LENGTH);
+
+	strncpy(s_endpoint, url, MAX_ENDPOINT_LENGTH - 1);
+}
+
 void client_init() {
 	pages_init();
+
+	s_metrics.pages_in_use = metrics_gauge("client.pages_in_use");
+	for (size_t i = 0; i < ARRAY_SIZE(HANDLERS); ++i) {
+		s_metrics.parse_us[HANDLERS[i].t] = metrics_histogram(HANDLERS[i].metric);
+	}
+
+	// Connection is ready by the time the player logs in.
+	http_preconnect(s_endpoint);
 }
 
 void client_shutdown() {}
@@ -297,6 +594,8 @@ bool client_messages_peek(message_t** msg) {
 
 void client_messages_consume() {
 	page_t* p = messages_peek();
+	if (--p->num_callers > 0) return;
+
 	messages_consume();
 	pages_free(p);
 }
@@ -307,58 +606,157 @@ void client_login(const char* username, const char* password) {
 
 	log_info("[client] Logging in with username=%s", username);
 
+	// Different user, different state.
+	validators_clear();
+	snprintf(s_ctx->username, sizeof(s_ctx->username), "%s", username);
+
 	http_form_part_t form[] = {
 		{ "username", username },
 		{ "password", password }
 	};
 
-	api_post_form(API_ENDPOINT("login"), form, 2, MESSAGE_TYPE_LOGIN, "login");
+	char url[MAX_URL_LENGTH];
+	api_post_form(api_url(url, "login"), form, 2, MESSAGE_TYPE_LOGIN, "login");
 }
 
 void client_logout() {
 	log_info("[client] Logging out");
-	api_post(API_ENDPOINT("logout"), MESSAGE_TYPE_LOGOUT, "logout");
+
+	s_ctx->username[0] = 0;
+
+	char url[MAX_URL_LENGTH];
+	api_post(api_url(url, "logout"), MESSAGE_TYPE_LOGOUT, "logout");
 }
 
 void client_state() {
 	log_info("[client] Fetching state");
-	api_get(API_ENDPOINT("state"), MESSAGE_TYPE_STATE, "state");
+
+	const http_options_t options = { .priority = HTTP_PRIORITY_STATE, .timeout_ms = STATE_TIMEOUT_MS };
+
+	// Session keeps the last state, so an unchanged one can come as a 304.
+	char url[MAX_URL_LENGTH];
+	api_get(api_url(url, "state"), &options, MESSAGE_TYPE_STATE, "state", true);
 }
 
 void client_move(const int32_t* coords, size_t count) {
 	assert(coords);
 	assert(count > 0);
 	
-	char buffer[512];
-	size_t rest = 512;
-
-	// TODO: Overflow validation.
+	char   buffer[4096];
+	size_t used = 0;
 
-	rest -= snprintf(buffer + (512 - rest), 512, "[ { \"x\": %d, \"y\": %d }\n", coords[0], coords[1]);
-	for (size_t i = 1; i < count; ++i) {
-		rest -= snprintf(buffer + (512 - rest), rest, ", { \"x\": %d, \"y\": %d }\n", coords[i * 2], coords[i * 2 + 1]);
+	for (size_t i = 0; i < count && used < sizeof(buffer); ++i) {
+		used += snprintf(buffer + used, sizeof(buffer) - used, "%s{ \"x\": %d, \"y\": %d }\n", i == 0 ? "[ " : ", ", coords[i * 2], coords[i * 2 + 1]);
 	}
-	snprintf(buffer + (512 - rest), rest, "]");
+	if (used < sizeof(buffer)) used += snprintf(buffer + used, sizeof(buffer) - used, "]");
+
+	if (used >= sizeof(buffer)) log_fatal("[client] Path of %zu steps is too long to move", count);
 	
-	api_post_json(API_ENDPOINT("move"), buffer, MESSAGE_TYPE_NOOP, "move");
+	char url[MAX_URL_LENGTH];
+	api_post_json(api_url(url, "move"), buffer, MESSAGE_TYPE_MOVE, "move");
 }
 
-void client_map(int32_t x, int32_t y, uint8_t size) {
+static void map_request(const char* plane_id, int32_t x, int32_t y, uint8_t size, bool is_revalidation) {
+	assert(plane_id);
 	assert(size > 0);
 
-	log_info("[client] Fetching map");
+	log_info("[client] %s map", is_revalidation ? "Revalidating" : "Fetching");
+
+	char url[MAX_URL_LENGTH];
+	api_url(url, "map/%s/%d/%d/%u?format=compact", plane_id, x, y, size);
 
-	char url[128];
-	snprintf(url, sizeof(url), API_ENDPOINT("map/homeland_3/%d/%d/%u"), x, y, size);
+	const http_options_t options = {
+		.priority   = is_revalidation ? HTTP_PRIORITY_PREFETCH : HTTP_PRIORITY_VISIBLE,
+		.timeout_ms = MAP_TIMEOUT_MS
+	};
+
+	page_t* p = api_get(url, &options, MESSAGE_TYPE_MAP, "map", is_revalidation);
+	strncpy(p->plane_id, plane_id, MAX_API_STRING_LENGTH - 1);
+	p->plane_id[MAX_API_STRING_LENGTH - 1] = 0;
+	p->args[0] = x;
+	p->args[1] = y;
+	p->args[2] = size;
+}
 
-	api_get(url, MESSAGE_TYPE_MAP, "map");
+void client_map(const char* plane_id, int32_t x, int32_t y, uint8_t size) {
+	map_request(plane_id, x, y, size, false);
 }
 
 void client_reveal(int32_t x, int32_t y) {
 	log_info("[client] Revealing %u, %u", x, y);
 
-	char url[128];
-	snprintf(url, sizeof(url), API_ENDPOINT("reveal/%u/%u"), x, y);
+	char url[MAX_URL_LENGTH];
+	api_url(url, "reveal/%u/%u", x, y);
+
+	page_t* p  = api_post(url, MESSAGE_TYPE_REVEAL, "reveal");
+	p->args[0] = x;
+	p->args[1] = y;
+}
+
+void client_cancel_maps(const char* plane_id) {
+	assert(plane_id);
+
+	for (size_t i = 0; i < s_ctx->num_pages_in_work; ++i) {
+		page_t* p = s_ctx->pages_in_work[i];
+		if (p->response_type != MESSAGE_TYPE_MAP || strncmp(p->plane_id, plane_id, MAX_API_STRING_LENGTH) != 0) continue;
+
+		log_info("[client] Cancelling map fetch for %d, %d", p->args[0], p->args[1]);
+		http_cancel(p->request_id);
+	}
+}
+
+size_t client_map_batch(const char* plane_id, uint8_t block_size, client_map_block_t* blocks, size_t count, bool is_revalidation) {
+	assert(plane_id);
+	assert(block_size > 0);
+	assert(blocks || count == 0);
+
+	// Bit per block: still needs to go out.
+	uint32_t grid[MAP_BATCH_GRID_SIZE] = {0};
+	for (size_t i = 0; i < count; ++i) {
+		assert(blocks[i].x < MAP_BATCH_GRID_SIZE && blocks[i].y < MAP_BATCH_GRID_SIZE);
+		grid[blocks[i].y] |= 1u << blocks[i].x;
+		blocks[i].is_requested = false;
+	}
+
+	const size_t max_tiles = s_ctx->has_compact_maps ? MAP_BATCH_MAX_TILES_COMPACT : MAP_BATCH_MAX_TILES;
+	const size_t max_side  = MAX(max_tiles / block_size, 1);
+
+	size_t num_requests = 0;
+
+	for (size_t y = 0; y < MAP_BATCH_GRID_SIZE; ++y) {
+		while (grid[y] && pages_can_alloc_for_batch()) {
+			const size_t x = __builtin_ctz(grid[y]);
+
+			// Grows the square while the next ring is all needed.
+			size_t side = 1;
+			while (side < max_side && x + side < MAP_BATCH_GRID_SIZE && y + side < MAP_BATCH_GRID_SIZE) {
+				const uint32_t row_mask = (uint32_t)((1ull << (side + 1)) - 1) << x;
+
+				bool ring_needed = (grid[y + side] & row_mask) == row_mask;
+				for (size_t j = y; ring_needed && j < y + side; ++j) {
+					ring_needed = grid[j] & (1u << (x + side));
+				}
+				if (!ring_needed) break;
+
+				++side;
+			}
+
+			const uint32_t mask = (uint32_t)((1ull << side) - 1) << x;
+			for (size_t j = y; j < y + side; ++j) {
+				grid[j] &= ~mask;
+			}
+
+			map_request(plane_id, x * block_size, y * block_size, side * block_size, is_revalidation);
+			++num_requests;
+
+			for (size_t i = 0; i < count; ++i) {
+				const client_map_block_t* b = &blocks[i];
+				if (b->x >= x && b->x < x + side && b->y >= y && b->y < y + side) {
+					blocks[i].is_requested = true;
+				}
+			}
+		}
+	}
 
-	api_post(url, MESSAGE_TYPE_REVEAL, "reveal");
+	return num_requests;
 }
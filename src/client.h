@@ -10,14 +10,33 @@ typedef enum {
 	MESSAGE_TYPE_LOGOUT,
 	MESSAGE_TYPE_STATE,
 	MESSAGE_TYPE_MAP,
-	MESSAGE_TYPE_REVEAL
+	MESSAGE_TYPE_REVEAL,
+	MESSAGE_TYPE_MOVE,
+	MESSAGE_TYPE_COUNT
 } message_type_t;
 
 typedef struct {
 	uint8_t  type;
+	// HTTP response code, 0 if the request failed without a response.
+	uint16_t code;
 	uint8_t* data[];
 } message_t;
 
+struct allocator_t;
+
+// Everything a client keeps lives in an instance, client_ calls work on the bound one.
+// App sticks to the built-in one, the load generator drives many of them in turn. Not thread-safe.
+typedef struct client_ctx_t client_ctx_t;
+
+client_ctx_t* client_ctx_create (struct allocator_t* alloc);
+// Must not be bound.
+void          client_ctx_destroy(struct allocator_t* alloc, client_ctx_t* c);
+// NULL binds the built-in one.
+void          client_bind       (client_ctx_t* c);
+
+// Base of the API URLs, e.g. "http://localhost:8080/api/", the live server by default. Shared by all instances.
+void client_set_endpoint(const char* url);
+
 void client_init();
 void client_shutdown();
 void client_update(float dt);
@@ -26,9 +45,25 @@ void client_login(const char* username, const char* password);
 void client_logout();
 void client_state();
 void client_move(const int32_t* coords, size_t count);
-void client_map(int32_t x, int32_t y, uint8_t size);
+void client_map(const char* plane_id, int32_t x, int32_t y, uint8_t size);
 void client_reveal(int32_t x, int32_t y);
 
+typedef struct {
+	// In blocks.
+	uint8_t x, y;
+	// Set if the block went out with one of the requests.
+	bool    is_requested;
+} client_map_block_t;
+
+// Coalesces adjacent blocks into as few square map requests as possible, up to a size cap.
+// Returns the number of requests issued. Responses cover several blocks at once.
+// Leaves a few pages free for the other requests, blocks that don't fit stay unrequested.
+// Revalidation sends validators of the last response for the same request and goes at prefetch priority,
+// an unchanged map comes back as a 304 without data.
+size_t client_map_batch(const char* plane_id, uint8_t block_size, client_map_block_t* blocks, size_t count, bool is_revalidation);
+// In-flight map fetches of the plane come back as failed (code 0), freeing their pages right away.
+void   client_cancel_maps(const char* plane_id);
+
 bool client_messages_peek(message_t** msg);
 void client_messages_consume();
 
@@ -11,6 +11,8 @@ typedef struct {
 	void* window;
 	uint16_t width;
 	uint16_t height;
+	// No window, nothing is shown: rendering goes to bgfx's noop renderer.
+	bool is_headless;
 } entry_window_info_t;
 
 const entry_window_info_t* entry_get_window();
@@ -28,3 +30,6 @@ void entry_mouse_position(float* x, float* y);
 bool entry_init(int32_t argc, const char* argv[]);
 bool entry_tick(float dt);
 void entry_shutdown();
+
+// CPU time of the last tick's game update & render, in milliseconds.
+void entry_frame_timings(double* update_ms, double* render_ms);
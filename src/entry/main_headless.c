@@ -0,0 +1,166 @@
+#ifdef BR_HEADLESS
+
+#include "entry.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h> // strtol, strtod, qsort
+#include <string.h> // strcmp
+#include <math.h>   // cosf, sinf
+
+#include "log.h"
+#include "timer.h"
+#include "allocator.h"
+
+// No display & no GPU: frames go to bgfx's noop renderer, time steps are fixed and input is scripted,
+// so the CPU side of the frame loop can be measured on build servers. Runs a fixed number of frames,
+// then reports per-frame CPU time percentiles of game update, game render & the whole tick.
+//
+// Own options are --frames, --warmup and --dt, the rest goes to the app, e.g. --replay a recorded
+// trace (see http_trace.h) to get the same network every run.
+
+#define DEFAULT_FRAMES 3600
+#define DEFAULT_WARMUP 60
+#define DEFAULT_DT_MS  (1000.0f / 60)
+
+#define WINDOW_WIDTH  600
+#define WINDOW_HEIGHT 400
+
+// Cursor circles the center of the window once in that many frames.
+#define SCRIPT_ORBIT_FRAMES 240
+#define SCRIPT_ORBIT_RADIUS 120.0f
+// Left button goes down for a couple of frames every that many frames, a click.
+#define SCRIPT_CLICK_FRAMES 90
+// Right button is held through every that many frames, dragging along the orbit.
+#define SCRIPT_DRAG_FRAMES  600
+#define SCRIPT_DRAG_LENGTH  60
+
+typedef enum {
+	TIMING_UPDATE = 0,
+	TIMING_RENDER,
+	TIMING_TICK,
+	TIMING_COUNT
+} timing_t;
+
+static struct {
+	entry_window_info_t window;
+
+	uint32_t frame;
+
+	uint32_t num_frames;
+	uint32_t num_warmup;
+	float    dt;
+
+	double* timings[TIMING_COUNT];
+} s_ctx;
+
+const entry_window_info_t* entry_get_window() {
+	return &s_ctx.window;
+}
+
+bool entry_mouse_pressed(entry_button_t b) {
+	switch (b) {
+		case ENTRY_BUTTON_LEFT:  return s_ctx.frame % SCRIPT_CLICK_FRAMES < 2;
+		case ENTRY_BUTTON_RIGHT: return s_ctx.frame % SCRIPT_DRAG_FRAMES  < SCRIPT_DRAG_LENGTH;
+		default:                 return false;
+	}
+}
+
+void entry_mouse_position(float* x, float* y) {
+	assert(x);
+	assert(y);
+
+	const float a = 2.0f * 3.14159265f * (s_ctx.frame % SCRIPT_ORBIT_FRAMES) / SCRIPT_ORBIT_FRAMES;
+	*x = s_ctx.window.width  * 0.5f + cosf(a) * SCRIPT_ORBIT_RADIUS;
+	*y = s_ctx.window.height * 0.5f + sinf(a) * SCRIPT_ORBIT_RADIUS;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+	const double x = *(const double*)a;
+	const double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static void report(const char* name, double* samples, size_t count) {
+	assert(name);
+	assert(samples);
+
+	if (count == 0) return;
+
+	double sum = 0.0;
+	for (size_t i = 0; i < count; ++i) {
+		sum += samples[i];
+	}
+
+	qsort(samples, count, sizeof(double), compare_doubles);
+
+	printf("%s n=%zu avg=%.3fms p50=%.3fms p90=%.3fms p99=%.3fms max=%.3fms\n",
+		name, count, sum / count,
+		samples[(size_t)(0.50 * (count - 1))],
+		samples[(size_t)(0.90 * (count - 1))],
+		samples[(size_t)(0.99 * (count - 1))],
+		samples[count - 1]);
+}
+
+static void parse_args(int32_t argc, const char* argv[]) {
+	for (int32_t i = 1; i + 1 < argc; ++i) {
+		if      (strcmp(argv[i], "--frames") == 0) s_ctx.num_frames = strtol(argv[i + 1], NULL, 10);
+		else if (strcmp(argv[i], "--warmup") == 0) s_ctx.num_warmup = strtol(argv[i + 1], NULL, 10);
+		else if (strcmp(argv[i], "--dt")     == 0) s_ctx.dt         = strtod(argv[i + 1], NULL);
+	}
+
+	if (s_ctx.num_frames == 0 || s_ctx.dt <= 0.0f) log_fatal("[entry] Needs at least a frame of some time");
+}
+
+int main(int argc, const char* argv[]) {
+	s_ctx.num_frames = DEFAULT_FRAMES;
+	s_ctx.num_warmup = DEFAULT_WARMUP;
+	s_ctx.dt         = DEFAULT_DT_MS;
+	parse_args(argc, argv);
+
+	s_ctx.window.width       = WINDOW_WIDTH;
+	s_ctx.window.height      = WINDOW_HEIGHT;
+	s_ctx.window.is_headless = true;
+
+	if (!entry_init(argc, argv)) return 1;
+
+	allocator_t* alloc = allocator_main();
+	for (size_t t = 0; t < TIMING_COUNT; ++t) {
+		s_ctx.timings[t] = BR_ALLOC(alloc, sizeof(double) * s_ctx.num_frames);
+	}
+
+	// First frames load & warm up caches, they are not counted.
+	const uint32_t total = s_ctx.num_warmup + s_ctx.num_frames;
+	size_t         count = 0;
+
+	for (s_ctx.frame = 0; s_ctx.frame < total; ++s_ctx.frame) {
+		const double start       = timer_current();
+		const bool   should_stop = !entry_tick(s_ctx.dt);
+		const double tick_ms     = timer_current() - start;
+
+		if (s_ctx.frame >= s_ctx.num_warmup) {
+			entry_frame_timings(&s_ctx.timings[TIMING_UPDATE][count], &s_ctx.timings[TIMING_RENDER][count]);
+			s_ctx.timings[TIMING_TICK][count] = tick_ms;
+			++count;
+		}
+
+		if (should_stop) break;
+	}
+
+	entry_shutdown();
+
+	printf("frames n=%zu dt=%.3fms\n", count, s_ctx.dt);
+	report("game_update", s_ctx.timings[TIMING_UPDATE], count);
+	report("game_render", s_ctx.timings[TIMING_RENDER], count);
+	report("entry_tick",  s_ctx.timings[TIMING_TICK],   count);
+
+	for (size_t t = 0; t < TIMING_COUNT; ++t) {
+		BR_FREE(alloc, s_ctx.timings[t]);
+	}
+
+	return 0;
+}
+
+#endif
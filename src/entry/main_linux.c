@@ -1,4 +1,4 @@
-#ifdef BR_PLATFORM_LINUX
+#if defined(BR_PLATFORM_LINUX) && !defined(BR_HEADLESS)
 
 #include "entry.h"
 
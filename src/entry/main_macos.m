@@ -1,4 +1,4 @@
-#ifdef BR_PLATFORM_MACOS
+#if defined(BR_PLATFORM_MACOS) && !defined(BR_HEADLESS)
 
 #import <Cocoa/Cocoa.h>
 
@@ -2,31 +2,163 @@
 
 #include <assert.h>
 #include <stdbool.h>
-#include <string.h>  // memcpy
+#include <string.h>  // memcpy, strncpy
+#include <strings.h> // strncasecmp
+#include <stdlib.h>  // strtol
+#include <stdio.h>   // snprintf
+#include <unistd.h>  // sysconf, pipe, read, write
+#include <fcntl.h>   // fcntl
 
 #include <curl.h>
 #include <tinycthread.h>
 
+#include "utils.h"
 #include "log.h"
+#include "allocator.h"
+#include "timer.h"
+#include "http_cache.h"
+#include "http_trace.h"
+#include "profile.h"
+#include "metrics.h"
 
 // Must be a power-of-two.
 #define REQUESTS_MAX_IN_FLIGHT 64
 #define REQUESTS_INDEX_MASK    (REQUESTS_MAX_IN_FLIGHT - 1)
 #define REQUESTS_ID_ADD        REQUESTS_MAX_IN_FLIGHT
 
-typedef struct {
+// Max concurrent transfers per priority class, 0 stands for no limit. Shared by all workers, per player.
+static const uint8_t PRIORITY_MAX_RUNNING[HTTP_PRIORITY_COUNT] = {
+	[HTTP_PRIORITY_INTERACTIVE] = 0,
+	[HTTP_PRIORITY_STATE]       = 2,
+	[HTTP_PRIORITY_VISIBLE]     = 6,
+	[HTTP_PRIORITY_PREFETCH]    = 2,
+};
+
+// Only idempotent requests (GETs) are retried, the first attempt counts.
+#define RETRY_MAX_ATTEMPTS  4
+#define RETRY_BASE_DELAY_MS 250
+#define RETRY_MAX_DELAY_MS  (8 * 1000)
+// Server's Retry-After is trusted up to this one.
+#define RETRY_AFTER_MAX_MS  (60 * 1000)
+
+// Worker waits on the sockets, this is only how often an idle one looks around.
+#define WORKER_IDLE_WAIT_MS 1000
+
+// Client-side token bucket, keeps us below the server's own limits. Per player.
+// Interactive requests take a token if there is one, but never wait for it.
+#define RATE_LIMIT_PER_SECOND 10.0
+#define RATE_LIMIT_BURST      20.0
+
+typedef struct request_t {
 	CURL*              h;
 	curl_mime*         mime;
 	struct curl_slist* headers;
 
 	void*  buffer;
+	size_t size;
 	size_t free;
 	size_t used;
 
-	uint8_t status;
-	uint8_t response_code;
+	uint8_t  status;
+	uint16_t response_code;
+
+	uint8_t           priority;
+	bool              is_running;
+	struct request_t* next_pending;
+	// Worker it's assigned to.
+	uint8_t           shard;
+
+	uint32_t timeout_ms;
+	double   queued_at;
+
+	char endpoint[HTTP_STATS_MAX_NAME];
+
+	bool     is_idempotent;
+	uint8_t  attempts;
+	double   not_before;
+	uint32_t retry_after_ms;
+
+	char etag[HTTP_MAX_ETAG_LENGTH];
+	char last_modified[HTTP_MAX_LAST_MODIFIED_LENGTH];
+
+	// 0 if the response is not cached.
+	uint64_t cache_key;
+	// Went out with the cached ETag, a 304 is answered from the cache.
+	bool     is_cache_validated;
+	// Answer to the 304 is being read by a cache job, 0 otherwise.
+	uint32_t cache_load;
+
+	// http_trace_method_t.
+	uint8_t                   method;
+	bool                      is_replaying;
+	double                    replay_at;
+	// NULL if nothing was recorded for it.
+	const http_trace_entry_t* replay;
+
+	// Finished, but held back by the network conditions.
+	bool     is_delivering;
+	double   deliver_at;
+	CURLcode deliver_result;
+	long     deliver_code;
 } request_t;
 
+typedef struct {
+	request_t* head;
+	request_t* tail;
+} pending_queue_t;
+
+// Disk I/O of the cache, done by the worker once it lets go of the locks.
+// Stores own a copy of the body, loads fill their request in if it still waits for them.
+typedef struct {
+	request_t* req;
+	uint64_t   key;
+	// Matches request's cache_load, 0 for a store.
+	uint32_t   load;
+
+	void*  data;
+	size_t size;
+	size_t used;
+	bool   is_hit;
+	char   etag[HTTP_MAX_ETAG_LENGTH];
+} cache_job_t;
+
+// Recorded one, written out by the worker once it lets go of the locks as well.
+typedef struct {
+	http_trace_entry_t entry;
+	// Owns the body & strings of the entry.
+	void*              data;
+} trace_job_t;
+
+// Worker with its own multi handle, performing the requests assigned to it.
+// It waits on the sockets without the lock, see shard_lock for getting to the multi handle meanwhile.
+typedef struct {
+	mtx_t  lock;
+	CURLM* multi;
+
+	cnd_t got_work;
+	bool  stop;
+
+	// Curl this old has no curl_multi_wakeup, a byte in the pipe is what ends the wait instead.
+	int     wake_pipe[2];
+	bool    is_polling;
+	uint8_t num_waiting;
+	cnd_t   polled;
+
+	// Guarded by the shared lock. Has ready requests waiting for a slot of a cap shared with other workers.
+	bool is_held_back;
+
+	// Worker's own, only it finishes requests.
+	cache_job_t cache_jobs[REQUESTS_MAX_IN_FLIGHT];
+	uint8_t     num_cache_jobs;
+	trace_job_t trace_jobs[REQUESTS_MAX_IN_FLIGHT];
+	uint8_t     num_trace_jobs;
+
+	thrd_t thread;
+
+	// Guarded by lock.
+	pending_queue_t pending[HTTP_PRIORITY_COUNT];
+} shard_t;
+
 typedef struct {
 	request_t req;
 
@@ -41,88 +173,940 @@ typedef struct {
 	uint8_t dequeue;
 } work_table_t;
 
-static struct {
-	CURLSH* share;
+static const http_config_t CONFIG_DEFAULT = {
+	.use_http2            = true,
+	.share_connections    = true,
+	.max_host_connections = 4,
+	.max_connections      = 16,
+	.keepalive_seconds    = 30,
+	.cache_dir            = NULL,
+	.cache_max_bytes      = 0,
+	.is_offline           = false,
+	.record_path          = NULL,
+	.replay_path          = NULL,
+	.replay_latency_scale = 1.0f,
+	.num_workers          = 0,
+	.num_players          = 1,
+};
+
+// Requests by how they ended, see metrics.h.
+typedef enum {
+	REQUESTS_OK = 0,
+	REQUESTS_NOT_MODIFIED,
+	REQUESTS_CLIENT_ERROR,
+	REQUESTS_SERVER_ERROR,
+	REQUESTS_OTHER,
+	// No response at all.
+	REQUESTS_FAILED,
+	REQUESTS_TIMED_OUT,
+	REQUESTS_CANCELLED,
+	REQUESTS_COUNT
+} requests_metric_t;
+
+static const char* REQUESTS_METRICS[REQUESTS_COUNT] = {
+	"http.requests.ok",
+	"http.requests.not_modified",
+	"http.requests.client_error",
+	"http.requests.server_error",
+	"http.requests.other",
+	"http.requests.failed",
+	"http.requests.timed_out",
+	"http.requests.cancelled",
+};
 
-	mtx_t  multi_lock;
-	CURLM* multi;
+static struct {
+	http_config_t config;
 
-	cnd_t got_work;
-	bool  stop_worker;
+	CURLSH* share;
+	mtx_t   share_locks[CURL_LOCK_DATA_LAST];
 
-	thrd_t thread;
+	shard_t shards[HTTP_MAX_WORKERS];
+	uint8_t num_shards;
 
 	work_table_t work;
+
+	// Everything below is shared by the workers and is guarded by shared_lock.
+	// It's always taken after a shard lock, never the other way around.
+	mtx_t shared_lock;
+
+	uint16_t num_running[HTTP_PRIORITY_COUNT];
+
+	double   tokens;
+	double   tokens_at;
+	// Server asked to slow down (429), only interactive requests go out till then.
+	double   throttled_until;
+	uint32_t jitter;
+	uint32_t conditions_random;
+	uint32_t num_cache_loads;
+	double   uplink_free_at;
+	double   downlink_free_at;
+
+	http_endpoint_stats_t stats[HTTP_STATS_MAX_ENDPOINTS];
+	size_t                num_stats;
+
+	metrics_id_t requests_metrics[REQUESTS_COUNT];
+	metrics_id_t retries_metric;
+	metrics_id_t bytes_down_metric;
+	metrics_id_t bytes_up_metric;
+
+	// Doesn't take a slot, nobody waits for it.
+	request_t warmup;
+	uint8_t   warmup_buffer[16];
 } s_ctx;
 
-// TODO: Handle failed requests!
-// This one happens under lock.
-static void finish_work(CURL* h) {
+// STATS
+// =====
+
+// All of these happen under lock.
+
+static http_endpoint_stats_t* stats_lookup(const char* name) {
+	assert(name);
+
+	for (size_t i = 0; i < s_ctx.num_stats; ++i) {
+		if (strncmp(s_ctx.stats[i].name, name, HTTP_STATS_MAX_NAME) == 0) return &s_ctx.stats[i];
+	}
+
+	// The last one takes everything which doesn't fit.
+	if (s_ctx.num_stats == HTTP_STATS_MAX_ENDPOINTS) return &s_ctx.stats[HTTP_STATS_MAX_ENDPOINTS - 1];
+
+	http_endpoint_stats_t* stats = &s_ctx.stats[s_ctx.num_stats++];
+	memset(stats, 0, sizeof(*stats));
+	strncpy(stats->name, name, HTTP_STATS_MAX_NAME - 1);
+	return stats;
+}
+
+static void histogram_add(http_histogram_t* h, double ms) {
 	assert(h);
 
-	request_t* req;
-	curl_easy_getinfo(h, CURLINFO_PRIVATE, &req);
+	if (ms < 0) ms = 0;
+
+	size_t b = 0;
+	while (b < HTTP_STATS_NUM_BUCKETS - 1 && ms >= (double)(1u << b)) ++b;
+
+	++h->buckets[b];
+	++h->count;
+	h->sum_ms += ms;
+	if (ms > h->max_ms) h->max_ms = ms;
+}
+
+static void stats_record(request_t* req, CURLcode result, long response_code) {
+	assert(req);
+
+	http_endpoint_stats_t* stats = stats_lookup(req->endpoint[0] ? req->endpoint : "other");
+
+	// All of them are seconds since the start of the attempt, 0 for a phase which didn't happen.
+	double dns = 0, connect = 0, tls = 0, ttfb = 0, total = 0;
+	curl_easy_getinfo(req->h, CURLINFO_NAMELOOKUP_TIME,    &dns);
+	curl_easy_getinfo(req->h, CURLINFO_CONNECT_TIME,       &connect);
+	curl_easy_getinfo(req->h, CURLINFO_APPCONNECT_TIME,    &tls);
+	curl_easy_getinfo(req->h, CURLINFO_STARTTRANSFER_TIME, &ttfb);
+	curl_easy_getinfo(req->h, CURLINFO_TOTAL_TIME,         &total);
+
+	long   request_size = 0, header_size = 0;
+	double upload       = 0, download    = 0;
+	curl_easy_getinfo(req->h, CURLINFO_REQUEST_SIZE,  &request_size);
+	curl_easy_getinfo(req->h, CURLINFO_HEADER_SIZE,   &header_size);
+	curl_easy_getinfo(req->h, CURLINFO_SIZE_UPLOAD,   &upload);
+	curl_easy_getinfo(req->h, CURLINFO_SIZE_DOWNLOAD, &download);
+
+	++stats->num_requests;
+	if (result != CURLE_OK || response_code == 0 || response_code >= 400) ++stats->num_failed;
+	stats->bytes_up   += request_size + (uint64_t)upload;
+	stats->bytes_down += header_size  + (uint64_t)download;
+
+	metrics_add(s_ctx.bytes_up_metric,   request_size + (uint64_t)upload);
+	metrics_add(s_ctx.bytes_down_metric, header_size  + (uint64_t)download);
+
+	// Reused connection skips the phases.
+	if (connect > 0) {
+		histogram_add(&stats->timings[HTTP_TIMING_DNS],     dns * 1000.0);
+		histogram_add(&stats->timings[HTTP_TIMING_CONNECT], (connect - dns) * 1000.0);
+	}
+	if (tls > 0) histogram_add(&stats->timings[HTTP_TIMING_TLS], (tls - connect) * 1000.0);
+	if (ttfb > 0) histogram_add(&stats->timings[HTTP_TIMING_TTFB], ttfb * 1000.0);
+	histogram_add(&stats->timings[HTTP_TIMING_TOTAL], total * 1000.0);
+}
+
+// Once a request is done for good, retries are not counted.
+static void stats_count(const request_t* req) {
 	assert(req);
 
-	if (req->headers) curl_slist_free_all(req->headers);
-	if (req->mime)    curl_mime_free(req->mime);
+	if (req == &s_ctx.warmup) return;
+
+	const uint16_t    code = req->response_code;
+	requests_metric_t m    = REQUESTS_OTHER;
+
+	if      (req->status == HTTP_STATUS_CANCELLED) m = REQUESTS_CANCELLED;
+	else if (req->status == HTTP_STATUS_TIMED_OUT) m = REQUESTS_TIMED_OUT;
+	else if (code == 0)                            m = REQUESTS_FAILED;
+	else if (code == 304)                          m = REQUESTS_NOT_MODIFIED;
+	else if (code >= 200 && code < 300)            m = REQUESTS_OK;
+	else if (code >= 400 && code < 500)            m = REQUESTS_CLIENT_ERROR;
+	else if (code >= 500)                          m = REQUESTS_SERVER_ERROR;
+
+	metrics_add(s_ctx.requests_metrics[m], 1);
+}
+
+// SHARDS
+// ======
+
+static void shard_wake(shard_t* shard) {
+	assert(shard);
+
+	const char b = 0;
+	// Fails only when the pipe is full, so the worker is going to wake up anyway.
+	const ssize_t n = write(shard->wake_pipe[1], &b, 1);
+	(void)n;
+}
+
+// Takes the lock once the worker is out of its wait, so the multi handle can be used.
+static void shard_lock(shard_t* shard) {
+	assert(shard);
+
+	mtx_lock(&shard->lock);
+
+	++shard->num_waiting;
+	while (shard->is_polling) {
+		shard_wake(shard);
+		cnd_wait(&shard->polled, &shard->lock);
+	}
+	--shard->num_waiting;
+}
+
+static void shard_unlock(shard_t* shard) {
+	assert(shard);
+
+	mtx_unlock(&shard->lock);
+	cnd_signal(&shard->got_work);
+}
+
+// A slot of a shared cap got free, other workers could have been waiting for it.
+// Under the shared lock.
+static void wake_held_back(const shard_t* except) {
+	for (uint8_t i = 0; i < s_ctx.num_shards; ++i) {
+		shard_t* shard = &s_ctx.shards[i];
+		if (shard == except || !shard->is_held_back) continue;
+
+		shard->is_held_back = false;
+		shard_wake(shard);
+	}
+}
+
+// SCHEDULING
+// ==========
+
+// All of these happen under the lock of the request's shard and the shared one.
+
+static void pending_push(request_t* req) {
+	assert(req);
+	assert(req->priority < HTTP_PRIORITY_COUNT);
+
+	pending_queue_t* q = &s_ctx.shards[req->shard].pending[req->priority];
+
+	req->next_pending = NULL;
+	if (q->tail) {
+		q->tail->next_pending = req;
+	} else {
+		q->head = req;
+	}
+	q->tail = req;
+}
+
+static void pending_remove(request_t* req) {
+	assert(req);
+
+	pending_queue_t* q    = &s_ctx.shards[req->shard].pending[req->priority];
+	request_t*       prev = NULL;
+
+	for (request_t* it = q->head; it; prev = it, it = it->next_pending) {
+		if (it != req) continue;
+
+		if (prev) {
+			prev->next_pending = it->next_pending;
+		} else {
+			q->head = it->next_pending;
+		}
+		if (q->tail == it) q->tail = prev;
+
+		it->next_pending = NULL;
+		return;
+	}
+}
+
+static bool priority_can_run(uint8_t priority) {
+	const uint16_t max = PRIORITY_MAX_RUNNING[priority] * s_ctx.config.num_players;
+	return max == 0 || s_ctx.num_running[priority] < max;
+}
+
+static double tokens_per_second() {
+	return RATE_LIMIT_PER_SECOND * s_ctx.config.num_players;
+}
+
+static void tokens_refill(double now) {
+	s_ctx.tokens    = MIN(RATE_LIMIT_BURST * s_ctx.config.num_players, s_ctx.tokens + (now - s_ctx.tokens_at) * tokens_per_second() / 1000.0);
+	s_ctx.tokens_at = now;
+}
+
+// Keeps the earliest moment the worker has to wake up at.
+static void wake_at(double* wake, double t) {
+	if (*wake < 0 || t < *wake) *wake = t;
+}
+
+// Jittered exponential backoff, half of the delay is random.
+static uint32_t retry_delay(uint8_t attempts) {
+	assert(attempts > 0);
+
+	uint32_t delay = RETRY_BASE_DELAY_MS << MIN(attempts - 1, 16);
+	if (delay > RETRY_MAX_DELAY_MS) delay = RETRY_MAX_DELAY_MS;
+
+	// xorshift32, rolled under the shared lock.
+	uint32_t x = s_ctx.jitter;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	s_ctx.jitter = x;
+
+	return delay / 2 + x % (delay / 2 + 1);
+}
+
+static void detach_work(request_t* req) {
+	assert(req);
+
+	// Held back one is still in the multi handle.
+	req->is_delivering = false;
+
+	if (req->is_replaying) {
+		req->is_replaying = false;
+	} else if (req->cache_load) {
+		// Job finds it gone.
+		req->cache_load = 0;
+	} else if (req->is_running) {
+		curl_multi_remove_handle(s_ctx.shards[req->shard].multi, req->h);
+
+		assert(s_ctx.num_running[req->priority] > 0);
+		--s_ctx.num_running[req->priority];
+		req->is_running = false;
+
+		wake_held_back(&s_ctx.shards[req->shard]);
+	} else {
+		pending_remove(req);
+	}
+}
+
+// Takes request out of the multi handle or the pending queue.
+static void stop_work(request_t* req) {
+	assert(req);
+
+	detach_work(req);
+
+	if (req->headers) curl_slist_free_all(req->headers);
+	if (req->mime)    curl_mime_free(req->mime);
+	req->headers = NULL;
+	req->mime    = NULL;
+}
+
+// Drops pending requests which ran out of time while waiting.
+static void expire(shard_t* shard, double now, double* wake) {
+	for (uint8_t p = 0; p < HTTP_PRIORITY_COUNT; ++p) {
+		request_t* it = shard->pending[p].head;
+		while (it) {
+			request_t* next = it->next_pending;
+			if (it->timeout_ms > 0) {
+				const double deadline = it->queued_at + it->timeout_ms;
+				if (now >= deadline) {
+					stop_work(it);
+					it->response_code = 0;
+					it->status        = HTTP_STATUS_TIMED_OUT;
+				} else {
+					wake_at(wake, deadline);
+				}
+			}
+			it = next;
+		}
+	}
+}
+
+static void replay_finish(request_t* req) {
+	assert(req);
+
+	const http_trace_entry_t* e = req->replay;
+
+	stop_work(req);
+
+	req->response_code = 0;
+	req->status        = HTTP_STATUS_FINISHED;
+
+	if (!e) return;
+
+	// Plus 1 as it will be zero-terminated.
+	if (e->body_size + 1 > req->size) {
+		log_error("[http] Recorded response of %zu bytes doesn't fit into %zu", e->body_size, req->size);
+		return;
+	}
+
+	// Scaled latency can run past the deadline.
+	if (req->timeout_ms > 0 && e->duration_ms * s_ctx.config.replay_latency_scale > req->timeout_ms) {
+		req->status = HTTP_STATUS_TIMED_OUT;
+		return;
+	}
+
+	memcpy(req->buffer, e->body, e->body_size);
+	((uint8_t*)req->buffer)[e->body_size] = 0;
+	req->used = e->body_size;
+	req->free = req->size - req->used;
+
+	strncpy(req->etag, e->etag, HTTP_MAX_ETAG_LENGTH - 1);
+	req->etag[HTTP_MAX_ETAG_LENGTH - 1] = 0;
+	strncpy(req->last_modified, e->last_modified, HTTP_MAX_LAST_MODIFIED_LENGTH - 1);
+	req->last_modified[HTTP_MAX_LAST_MODIFIED_LENGTH - 1] = 0;
+
+	req->response_code = e->response_code;
+	req->status        = e->status;
+}
+
+// Finishes replayed requests whose recorded latency has passed.
+static void replay(shard_t* shard, double now, double* wake) {
+	for (size_t i = 0; i < REQUESTS_MAX_IN_FLIGHT; ++i) {
+		request_t* req = &s_ctx.work.items[i].req;
+		if (!req->is_replaying || &s_ctx.shards[req->shard] != shard) continue;
+
+		if (now >= req->replay_at) {
+			replay_finish(req);
+			stats_count(req);
+		} else {
+			wake_at(wake, req->replay_at);
+		}
+	}
+}
+
+// First request of the queue which is allowed to go out now, waiting for a retry or for a token otherwise.
+static request_t* pending_ready(pending_queue_t* q, uint8_t priority, double now, double* wake) {
+	assert(q);
+
+	const bool is_interactive = priority == HTTP_PRIORITY_INTERACTIVE;
+
+	if (!is_interactive && now < s_ctx.throttled_until) {
+		if (q->head) wake_at(wake, s_ctx.throttled_until);
+		return NULL;
+	}
+
+	for (request_t* it = q->head; it; it = it->next_pending) {
+		if (now < it->not_before) {
+			wake_at(wake, it->not_before);
+			continue;
+		}
+
+		if (s_ctx.tokens >= 1.0) {
+			s_ctx.tokens -= 1.0;
+		} else if (!is_interactive) {
+			wake_at(wake, now + (1.0 - s_ctx.tokens) * 1000.0 / tokens_per_second());
+			return NULL;
+		}
+
+		pending_remove(it);
+		return it;
+	}
+	return NULL;
+}
+
+// Has requests which could go out now, if not for the cap or tokens.
+static bool pending_has_ready(const pending_queue_t* q, double now) {
+	assert(q);
+
+	for (const request_t* it = q->head; it; it = it->next_pending) {
+		if (now >= it->not_before) return true;
+	}
+	return false;
+}
+
+// Moves pending requests of the shard into its multi handle, the most important first.
+// A class that is held back by its cap holds back everything less important, too.
+// Returns the moment (timer_current) it has to be called again at, negative if there is no need.
+// Happens under the shard lock, takes the shared one.
+static double schedule(shard_t* shard) {
+	assert(shard);
+
+	const double now  = timer_current();
+	double       wake = -1.0;
+
+	mtx_lock(&s_ctx.shared_lock);
+
+	shard->is_held_back = false;
+
+	expire(shard, now, &wake);
+	replay(shard, now, &wake);
+	tokens_refill(now);
+
+	for (uint8_t p = 0; p < HTTP_PRIORITY_COUNT; ++p) {
+		pending_queue_t* q = &shard->pending[p];
+
+		request_t* req;
+		while (priority_can_run(p) && (req = pending_ready(q, p, now, &wake))) {
+			// Time spent in the queue counts against the deadline.
+			if (req->timeout_ms > 0) {
+				const long left = (long)req->timeout_ms - (long)(now - req->queued_at);
+				curl_easy_setopt(req->h, CURLOPT_TIMEOUT_MS, left > 1 ? left : 1L);
+			} else {
+				curl_easy_setopt(req->h, CURLOPT_TIMEOUT_MS, 0L);
+			}
+
+			CURLMcode err = curl_multi_add_handle(shard->multi, req->h);
+			if (err != CURLM_OK) log_fatal("[http] Failed to create request - %s", curl_multi_strerror(err));
+
+			++s_ctx.num_running[p];
+			req->is_running = true;
+			++req->attempts;
+		}
+
+		// Ones waiting for a retry don't hold back anything.
+		if (pending_has_ready(q, now)) {
+			// Cap is shared, the slot can be freed by another worker, it wakes this one up then.
+			shard->is_held_back = true;
+			break;
+		}
+	}
+
+	mtx_unlock(&s_ctx.shared_lock);
+
+	return wake;
+}
+
+static bool is_transient(CURLcode result, long response_code) {
+	switch (result) {
+		case CURLE_OK:
+			return response_code == 429 || response_code == 502 || response_code == 503 || response_code == 504;
+
+		case CURLE_COULDNT_RESOLVE_HOST:
+		case CURLE_COULDNT_CONNECT:
+		case CURLE_SEND_ERROR:
+		case CURLE_RECV_ERROR:
+		case CURLE_GOT_NOTHING:
+		case CURLE_PARTIAL_FILE:
+		case CURLE_SSL_CONNECT_ERROR:
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+// Puts a failed attempt back into the queue. False if it's out of attempts.
+static bool retry_work(request_t* req, CURLcode result, long response_code) {
+	assert(req);
+
+	if (!req->is_idempotent || req->attempts >= RETRY_MAX_ATTEMPTS) return false;
+	if (!is_transient(result, response_code)) return false;
+
+	const double now   = timer_current();
+	uint32_t     delay = retry_delay(req->attempts);
+
+	if (response_code == 429) {
+		if (req->retry_after_ms > delay) delay = req->retry_after_ms;
+		if (now + delay > s_ctx.throttled_until) s_ctx.throttled_until = now + delay;
+	}
+
+	log_info("[http] Retrying in %u ms (attempt %u, curl %d, code %ld)", delay, req->attempts, result, response_code);
+	metrics_add(s_ctx.retries_metric, 1);
+
+	detach_work(req);
+
+	req->free           = req->size;
+	req->used           = 0;
+	req->etag[0]          = 0;
+	req->last_modified[0] = 0;
+	req->retry_after_ms   = 0;
+	req->not_before     = now + delay;
+
+	pending_push(req);
+	return true;
+}
+
+static cache_job_t* cache_job_add(request_t* req) {
+	assert(req);
+
+	shard_t* shard = &s_ctx.shards[req->shard];
+	assert(shard->num_cache_jobs < REQUESTS_MAX_IN_FLIGHT);
+
+	cache_job_t* job = &shard->cache_jobs[shard->num_cache_jobs++];
+	memset(job, 0, sizeof(cache_job_t));
+	job->req = req;
+	job->key = req->cache_key;
+	return job;
+}
+
+// Request stays in progress until the job is done.
+static void cache_job_load(request_t* req) {
+	assert(req);
+
+	if (++s_ctx.num_cache_loads == 0) ++s_ctx.num_cache_loads;
+	req->cache_load = s_ctx.num_cache_loads;
+
+	cache_job_t* job = cache_job_add(req);
+	job->load = req->cache_load;
+	job->size = req->size;
+}
+
+static void cache_job_store(request_t* req) {
+	assert(req);
+
+	cache_job_t* job = cache_job_add(req);
+	job->data = BR_ALLOC(allocator_main(), req->used + 1);
+	job->size = req->used;
+	memcpy(job->data, req->buffer, req->used);
+	strncpy(job->etag, req->etag, HTTP_MAX_ETAG_LENGTH - 1);
+}
+
+// Copies everything, the request can be reused before it's written.
+static void trace_job_add(request_t* req) {
+	assert(req);
+
+	shard_t* shard = &s_ctx.shards[req->shard];
+	assert(shard->num_trace_jobs < REQUESTS_MAX_IN_FLIGHT);
+
+	const char* url = NULL;
+	curl_easy_getinfo(req->h, CURLINFO_EFFECTIVE_URL, &url);
+	if (!url) url = "";
+
+	const size_t url_size  = strlen(url) + 1;
+	const size_t etag_size = strlen(req->etag) + 1;
+	const size_t lm_size   = strlen(req->last_modified) + 1;
+
+	uint8_t* data = BR_ALLOC(allocator_main(), req->used + url_size + etag_size + lm_size);
+	char*    body = (char*)data;
+	char*    u    = body + req->used;
+	char*    e    = u + url_size;
+	char*    lm   = e + etag_size;
+	memcpy(body, req->buffer,        req->used);
+	memcpy(u,    url,                url_size);
+	memcpy(e,    req->etag,          etag_size);
+	memcpy(lm,   req->last_modified, lm_size);
+
+	shard->trace_jobs[shard->num_trace_jobs++] = (trace_job_t) {
+		.entry = {
+			.method        = req->method,
+			.status        = req->status,
+			.response_code = req->response_code,
+			.start_ms      = req->queued_at,
+			.duration_ms   = timer_current() - req->queued_at,
+			.url           = u,
+			.etag          = e,
+			.last_modified = lm,
+			.body          = body,
+			.body_size     = req->used,
+		},
+		.data = data,
+	};
+}
+
+static void complete_work(request_t* req, CURLcode result, long response_code) {
+	assert(req);
+
+	req->response_code = response_code;
+	req->status        = result == CURLE_OPERATION_TIMEDOUT ? HTTP_STATUS_TIMED_OUT : HTTP_STATUS_FINISHED;
+	stats_count(req);
+
+	if (s_ctx.config.record_path && req != &s_ctx.warmup) trace_job_add(req);
+}
+
+static void finish_work(request_t* req, CURLcode result, long response_code) {
+	assert(req);
+
+	stats_record(req, result, response_code);
+
+	if (retry_work(req, result, response_code)) return;
+
+	stop_work(req);
+
+	if (result != CURLE_OK) log_error("[http] Request failed - %s", curl_easy_strerror(result));
+
+	if (result == CURLE_OK && req->cache_key) {
+		if (response_code == 304 && req->is_cache_validated) {
+			// Caller didn't ask for a revalidation, so it gets the body once it's read.
+			cache_job_load(req);
+			return;
+		}
+		if (response_code == 200) cache_job_store(req);
+	}
+
+	complete_work(req, result, response_code);
+}
+
+// NETWORK CONDITIONS
+// ==================
+
+// All of these happen under the shard lock and the shared one.
+
+static bool is_conditioned() {
+	const http_conditions_t* c = &s_ctx.config.conditions;
+	return c->rtt_ms > 0 || c->jitter_ms > 0 || c->failure_rate > 0.0f || c->download_bytes_per_second > 0 || c->upload_bytes_per_second > 0;
+}
+
+// xorshift32, own sequence, so conditions repeat from run to run whatever retries do.
+static uint32_t conditions_random() {
+	uint32_t x = s_ctx.conditions_random;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return s_ctx.conditions_random = x;
+}
+
+// Finished transfer is held back for the time it takes over the simulated link, keeping its slot.
+// Link is a bottleneck: transfers get through it one after another, then take a round trip.
+static void condition_work(request_t* req, CURLcode result, long response_code) {
+	assert(req);
+
+	const http_conditions_t* c = &s_ctx.config.conditions;
+
+	const double now = timer_current();
+
+	double up = now;
+	if (c->upload_bytes_per_second > 0) {
+		long   request_size = 0;
+		double upload       = 0;
+		curl_easy_getinfo(req->h, CURLINFO_REQUEST_SIZE, &request_size);
+		curl_easy_getinfo(req->h, CURLINFO_SIZE_UPLOAD,  &upload);
+
+		up = MAX(up, s_ctx.uplink_free_at) + (request_size + upload) * 1000.0 / c->upload_bytes_per_second;
+		s_ctx.uplink_free_at = up;
+	}
+
+	double down = up;
+	if (c->download_bytes_per_second > 0) {
+		long   header_size = 0;
+		double download    = 0;
+		curl_easy_getinfo(req->h, CURLINFO_HEADER_SIZE,   &header_size);
+		curl_easy_getinfo(req->h, CURLINFO_SIZE_DOWNLOAD, &download);
+
+		down = MAX(down, s_ctx.downlink_free_at) + (header_size + download) * 1000.0 / c->download_bytes_per_second;
+		s_ctx.downlink_free_at = down;
+	}
+
+	const float roll = (conditions_random() & 0xFFFFFF) / (float)0x1000000;
+	if (result == CURLE_OK && roll < c->failure_rate) {
+		// Looks like a dropped connection, so it goes through retries as one.
+		result        = CURLE_RECV_ERROR;
+		response_code = 0;
+	}
+
+	double delay = c->rtt_ms;
+	if (c->jitter_ms > 0) delay += conditions_random() % (c->jitter_ms + 1);
+
+	req->deliver_at     = down + delay;
+	req->deliver_result = result;
+	req->deliver_code   = response_code;
+	req->is_delivering  = true;
+
+	if (req->timeout_ms > 0 && req->deliver_at > req->queued_at + req->timeout_ms) {
+		req->deliver_at     = req->queued_at + req->timeout_ms;
+		req->deliver_result = CURLE_OPERATION_TIMEDOUT;
+		req->deliver_code   = 0;
+	}
+}
+
+// Finishes the held back transfers of the shard whose time has come. True if any did.
+static bool deliver(shard_t* shard, double now, double* wake) {
+	bool has_finished = false;
+
+	for (size_t i = 0; i < REQUESTS_MAX_IN_FLIGHT; ++i) {
+		request_t* req = &s_ctx.work.items[i].req;
+		if (!req->is_delivering || &s_ctx.shards[req->shard] != shard) continue;
+
+		if (now >= req->deliver_at) {
+			req->is_delivering = false;
+			finish_work(req, req->deliver_result, req->deliver_code);
+			has_finished = true;
+		} else {
+			wake_at(wake, req->deliver_at);
+		}
+	}
+
+	return has_finished;
+}
+
+static void transfer_done(CURL* h, CURLcode result) {
+	assert(h);
+
+	// Curl type-checks it as a string, optimized builds warn otherwise.
+	char* private;
+	curl_easy_getinfo(h, CURLINFO_PRIVATE, &private);
+	request_t* req = (request_t*)private;
+	assert(req);
+
+	long response_code;
+	curl_easy_getinfo(h, CURLINFO_RESPONSE_CODE, &response_code);
+
+	mtx_lock(&s_ctx.shared_lock);
+
+	if (is_conditioned() && req != &s_ctx.warmup) {
+		condition_work(req, result, response_code);
+	} else {
+		finish_work(req, result, response_code);
+	}
+
+	mtx_unlock(&s_ctx.shared_lock);
+}
+
+// Takes the locks back once the I/O is done, to hand the loaded bodies over.
+static void cache_jobs_run(shard_t* shard) {
+	assert(shard);
+
+	allocator_t* alloc = allocator_main();
+
+	mtx_unlock(&shard->lock);
+
+	for (uint8_t i = 0; i < shard->num_cache_jobs; ++i) {
+		cache_job_t* job = &shard->cache_jobs[i];
+		if (job->load) {
+			job->data   = BR_ALLOC(alloc, job->size);
+			job->is_hit = http_cache_get(job->key, job->data, job->size, &job->used, job->etag, HTTP_MAX_ETAG_LENGTH);
+		} else {
+			http_cache_put(job->key, job->data, job->size, job->etag);
+		}
+	}
+
+	mtx_lock(&shard->lock);
+	mtx_lock(&s_ctx.shared_lock);
+
+	for (uint8_t i = 0; i < shard->num_cache_jobs; ++i) {
+		cache_job_t* job = &shard->cache_jobs[i];
+		request_t*   req = job->req;
+
+		// Cancelled meanwhile, maybe even reused.
+		if (job->load && req->cache_load == job->load) {
+			req->cache_load = 0;
+
+			if (job->is_hit) {
+				// Zero-terminated.
+				memcpy(req->buffer, job->data, job->used + 1);
+				req->used = job->used;
+				req->free = req->size - req->used;
+				strncpy(req->etag, job->etag, HTTP_MAX_ETAG_LENGTH - 1);
+			}
+			complete_work(req, CURLE_OK, job->is_hit ? 200 : 0);
+		}
+
+		BR_FREE(alloc, job->data);
+	}
+	shard->num_cache_jobs = 0;
+
+	mtx_unlock(&s_ctx.shared_lock);
+}
+
+static void trace_jobs_run(shard_t* shard) {
+	assert(shard);
+
+	allocator_t* alloc = allocator_main();
 
-	// TODO: Get more info & record networking stats. See: https://curl.haxx.se/libcurl/c/curl_easy_getinfo.html
+	mtx_unlock(&shard->lock);
 
-	long response_code;
-    curl_easy_getinfo(h, CURLINFO_RESPONSE_CODE, &response_code);
-	
-	req->response_code = response_code;
-	req->status        = HTTP_STATUS_FINISHED;
+	for (uint8_t i = 0; i < shard->num_trace_jobs; ++i) {
+		http_trace_record(&shard->trace_jobs[i].entry);
+		BR_FREE(alloc, shard->trace_jobs[i].data);
+	}
+	shard->num_trace_jobs = 0;
+
+	mtx_lock(&shard->lock);
 }
 
-// TODO: There is a bug when worker sleeps *after* got_work is signalled, but it still not got the work to do :(
 static int worker(void* arg) {
-	mtx_lock(&s_ctx.multi_lock);
-	cnd_wait(&s_ctx.got_work, &s_ctx.multi_lock);
-	// Lock is held now.
+	shard_t* shard = arg;
+	assert(shard);
 
-	bool exit;
+	PROFILE_THREAD("http worker");
+
+	mtx_lock(&shard->lock);
+	// Lock is held now, it's released only while waiting & for the cache and trace I/O, so no signal is missed.
+
+	bool exit = false;
 	while (!exit) {
-		CURLM* h = s_ctx.multi;
+		CURLM* h = shard->multi;
+
+		// Delivered ones free up slots for the scheduling right after.
+		double delivery = -1.0;
+
+		bool   has_finished;
+		double wake;
+		int    running;
+		{
+			PROFILE_SCOPE("http_schedule");
 
-		int running;
-		curl_multi_perform(h, &running);
+			mtx_lock(&s_ctx.shared_lock);
+			has_finished = deliver(shard, timer_current(), &delivery);
+			mtx_unlock(&s_ctx.shared_lock);
+
+			wake = schedule(shard);
+			if (delivery >= 0) wake_at(&wake, delivery);
+		}
+
+		{
+			PROFILE_SCOPE("curl_multi_perform");
+			curl_multi_perform(h, &running);
+		}
 
 		CURLMsg* m;
 		do {
 			int msgs;
 			m = curl_multi_info_read(h, &msgs);
 			if (m && (m->msg == CURLMSG_DONE)) {
-				CURL* eh = m->easy_handle;
-				curl_multi_remove_handle(h, eh);
+				PROFILE_SCOPE("http_transfer_done");
 				// TODO: Do it outside of the lock?
-				finish_work(eh);
+				transfer_done(m->easy_handle, m->data.result);
+				has_finished = true;
 			}
 		} while (m);
 
-		if (running > 0) {
-			long timeout;
-			curl_multi_timeout(h, &timeout);
+		if (shard->num_cache_jobs > 0) {
+			PROFILE_SCOPE("http_cache_jobs");
+			cache_jobs_run(shard);
+			has_finished = true;
+		}
+
+		// Loads handed over above are recorded too.
+		if (shard->num_trace_jobs > 0) {
+			PROFILE_SCOPE("http_trace_jobs");
+			trace_jobs_run(shard);
+		}
+
+		if (shard->num_waiting > 0) {
+			// Someone needs the multi handle, they go first.
+			while (shard->num_waiting > 0 && !shard->stop) cnd_wait(&shard->got_work, &shard->lock);
+		} else if (has_finished) {
+			// Finished transfers could free up room for the held back ones, no waiting.
+		} else if (!shard->stop) {
+			long timeout = -1;
+			if (running > 0) curl_multi_timeout(h, &timeout);
 
 			// It just means libcurl currently has no stored timeout value.
-			if (timeout < 0) timeout = 1000;
+			if (timeout < 0) timeout = WORKER_IDLE_WAIT_MS;
+
+			// Delayed retries, tokens and deadlines of the queued ones.
+			if (wake >= 0) {
+				const double until = wake - timer_current();
+				if (until < timeout) timeout = until > 0 ? (long)until + 1 : 0;
+			}
+
+			shard->is_polling = true;
+			mtx_unlock(&shard->lock);
+
+			struct curl_waitfd wake_fd = { .fd = shard->wake_pipe[0], .events = CURL_WAIT_POLLIN };
+			curl_multi_wait(h, &wake_fd, 1, (int)timeout, NULL);
 
-			struct timespec t;
-			t.tv_sec  = timeout / 1000;
-			t.tv_nsec = (timeout % 1000) * 1000000;
+			char b[64];
+			while (read(shard->wake_pipe[0], b, sizeof(b)) > 0) {}
 
-			cnd_timedwait(&s_ctx.got_work, &s_ctx.multi_lock, &t);
-		} else if (!s_ctx.stop_worker) {
-			cnd_wait(&s_ctx.got_work, &s_ctx.multi_lock);
+			mtx_lock(&shard->lock);
+			shard->is_polling = false;
+			cnd_broadcast(&shard->polled);
 		}
 
-		exit = s_ctx.stop_worker;
+		exit = shard->stop;
 
 		// Lock is held now.
 	}
 
-	log_info("[http] Worker died.");
+	mtx_unlock(&shard->lock);
+
+	log_info("[http] Worker %u died.", (unsigned)(shard - s_ctx.shards));
 	return 0;
 }
 
@@ -145,6 +1129,57 @@ static size_t response_write(const char* ptr, size_t size, size_t nmemb, void* u
 	return bytes;
 }
 
+// Name includes the colon, value is trimmed and is not zero-terminated.
+static bool header_value(const char* ptr, size_t bytes, const char* name, const char** value, size_t* length) {
+	const size_t n = strlen(name);
+
+	if (bytes <= n || strncasecmp(ptr, name, n) != 0) return false;
+
+	const char* v   = ptr + n;
+	const char* end = ptr + bytes;
+	while (v < end && (*v == ' ' || *v == '\t')) ++v;
+	while (end > v && (end[-1] == '\r' || end[-1] == '\n' || end[-1] == ' ')) --end;
+
+	*value  = v;
+	*length = end - v;
+	return true;
+}
+
+static size_t response_header(const char* ptr, size_t size, size_t nmemb, void* userdata) {
+	assert(userdata);
+
+	request_t* req = userdata;
+
+	const size_t bytes = size * nmemb;
+
+	const char* v;
+	size_t      length;
+
+	if (header_value(ptr, bytes, "ETag:", &v, &length)) {
+		if (length < HTTP_MAX_ETAG_LENGTH) {
+			memcpy(req->etag, v, length);
+			req->etag[length] = 0;
+		}
+	} else if (header_value(ptr, bytes, "Last-Modified:", &v, &length)) {
+		if (length < HTTP_MAX_LAST_MODIFIED_LENGTH) {
+			memcpy(req->last_modified, v, length);
+			req->last_modified[length] = 0;
+		}
+	} else if (header_value(ptr, bytes, "Retry-After:", &v, &length)) {
+		// Only delay-seconds, an HTTP-date falls back to the own backoff.
+		char       seconds[16];
+		const long n = length < sizeof(seconds) ? length : 0;
+		memcpy(seconds, v, n);
+		seconds[n] = 0;
+
+		char*      end;
+		const long s = strtol(seconds, &end, 10);
+		if (n > 0 && *end == 0 && s >= 0) req->retry_after_ms = MIN(s * 1000, RETRY_AFTER_MAX_MS);
+	}
+
+	return bytes;
+}
+
 // HANDLE MANAGEMENT
 // =================
 
@@ -157,12 +1192,27 @@ static CURL* create_easy(void* userdata) {
 #endif
 	curl_easy_setopt(h, CURLOPT_SHARE, s_ctx.share);
 
+	const http_config_t* config = &s_ctx.config;
+	if (config->use_http2) {
+		curl_easy_setopt(h, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+		// Rather waits for a connection to multiplex on, than opens a new one.
+		curl_easy_setopt(h, CURLOPT_PIPEWAIT, 1L);
+	}
+	if (config->keepalive_seconds > 0) {
+		curl_easy_setopt(h, CURLOPT_TCP_KEEPALIVE, 1L);
+		curl_easy_setopt(h, CURLOPT_TCP_KEEPIDLE,  (long)config->keepalive_seconds);
+		curl_easy_setopt(h, CURLOPT_TCP_KEEPINTVL, (long)config->keepalive_seconds);
+	}
+
 	// Enables all supported built-in compressions.
 	curl_easy_setopt(h, CURLOPT_ACCEPT_ENCODING, "");
 
 	curl_easy_setopt(h, CURLOPT_WRITEFUNCTION, response_write);
 	curl_easy_setopt(h, CURLOPT_WRITEDATA, userdata);
 
+	curl_easy_setopt(h, CURLOPT_HEADERFUNCTION, response_header);
+	curl_easy_setopt(h, CURLOPT_HEADERDATA, userdata);
+
 	curl_easy_setopt(h, CURLOPT_PRIVATE, userdata);
 	return h;
 }
@@ -173,17 +1223,41 @@ static void free_easy(CURL* h) {
 	curl_easy_cleanup(h);
 }
 
-static void add_to_multi(CURL* h) {
-	assert(h);
+static void add_to_multi(request_t* req) {
+	assert(req);
+
+	shard_t* shard = &s_ctx.shards[req->shard];
+
+	shard_lock(shard);
+
+	pending_push(req);
+	schedule(shard);
+
+	shard_unlock(shard);
+}
 
-	mtx_lock(&s_ctx.multi_lock);
+// Least loaded one, by the number of requests in progress.
+static uint8_t shard_pick() {
+	uint8_t load[HTTP_MAX_WORKERS] = {0};
+	for (size_t i = 0; i < REQUESTS_MAX_IN_FLIGHT; ++i) {
+		const request_t* req = &s_ctx.work.items[i].req;
+		if (req->status == HTTP_STATUS_IN_PROGRESS) ++load[req->shard];
+	}
 
-	CURLMcode err = curl_multi_add_handle(s_ctx.multi, h);
-	if (err != CURLM_OK) log_fatal("[http] Failed to create request - %s", curl_multi_strerror(err));
+	uint8_t best = 0;
+	for (uint8_t i = 1; i < s_ctx.num_shards; ++i) {
+		if (load[i] < load[best]) best = i;
+	}
+	return best;
+}
 
-	mtx_unlock(&s_ctx.multi_lock);
+// Curl calls these from any of the workers.
+static void share_lock(CURL* h, curl_lock_data data, curl_lock_access access, void* userptr) {
+	mtx_lock(&s_ctx.share_locks[data]);
+}
 
-	cnd_signal(&s_ctx.got_work);
+static void share_unlock(CURL* h, curl_lock_data data, void* userptr) {
+	mtx_unlock(&s_ctx.share_locks[data]);
 }
 
 // WORK MANAGEMENT
@@ -193,8 +1267,9 @@ static void work_init(work_table_t* ctx) {
 	assert(ctx);
 
 	for (size_t i = 0; i < REQUESTS_MAX_IN_FLIGHT; ++i) {
-		ctx->items[i].id   = i;
-		ctx->items[i].next = i + 1;
+		ctx->items[i].id    = i;
+		ctx->items[i].index = UINT8_MAX;
+		ctx->items[i].next  = i + 1;
 	}
 	ctx->dequeue = 0;
 	ctx->enqueue = REQUESTS_MAX_IN_FLIGHT - 1;
@@ -238,6 +1313,7 @@ static void work_remove(work_table_t* ctx, http_work_id_t id) {
 
 	work_t* item                  = &ctx->items[id & REQUESTS_INDEX_MASK];
 	item->index                   = UINT8_MAX;
+	item->next                    = REQUESTS_MAX_IN_FLIGHT;
 	ctx->items[ctx->enqueue].next = id & REQUESTS_INDEX_MASK;
 	ctx->enqueue                  = id & REQUESTS_INDEX_MASK;
 
@@ -262,47 +1338,287 @@ static void requests_shutdown() {
 	}
 }
 
-static http_work_id_t requests_add(void* buffer, size_t size) {
+static void requests_reset(request_t* req, const http_options_t* options, void* buffer, size_t size) {
+	assert(req);
 	assert(buffer);
 	assert(size > 0);
-	assert(work_can_add(&s_ctx.work));
 
-	http_work_id_t id  = work_add(&s_ctx.work);
-	request_t*     req = &work_lookup(&s_ctx.work, id)->req;
-	
 	req->status  = HTTP_STATUS_IN_PROGRESS;
 	req->buffer  = buffer;
+	req->size    = size;
 	req->free    = size;
 	req->used    = 0;
 	req->mime    = NULL;
 	req->headers = NULL;
 
+	req->etag[0]          = 0;
+	req->last_modified[0] = 0;
+
+	req->priority     = options ? options->priority : HTTP_PRIORITY_INTERACTIVE;
+	req->is_running   = false;
+	req->next_pending = NULL;
+	assert(req->priority < HTTP_PRIORITY_COUNT);
+
+	req->timeout_ms = options ? options->timeout_ms : 0;
+	req->queued_at  = timer_current();
+
+	req->endpoint[0] = 0;
+	if (options && options->endpoint) {
+		strncpy(req->endpoint, options->endpoint, HTTP_STATS_MAX_NAME - 1);
+		req->endpoint[HTTP_STATS_MAX_NAME - 1] = 0;
+	}
+
+	req->is_idempotent  = false;
+	req->attempts       = 0;
+	req->not_before     = 0.0;
+	req->retry_after_ms = 0;
+
+	req->cache_key          = 0;
+	req->is_cache_validated = false;
+	req->cache_load         = 0;
+
+	req->method       = HTTP_TRACE_GET;
+	req->is_replaying = false;
+	req->replay_at    = 0.0;
+	req->replay       = NULL;
+
+	req->is_delivering = false;
+}
+
+// Answers with the recorded response after the recorded (scaled) latency, nothing goes out.
+static void requests_replay(request_t* req, const char* url) {
+	assert(req);
+	assert(url);
+
+	shard_t* shard = &s_ctx.shards[req->shard];
+
+	mtx_lock(&shard->lock);
+	mtx_lock(&s_ctx.shared_lock);
+
+	const http_trace_entry_t* e = http_trace_replay_next(req->method, url);
+	if (!e) log_error("[http] Nothing recorded for %s", url);
+
+	req->replay       = e;
+	req->replay_at    = req->queued_at + (e ? e->duration_ms * s_ctx.config.replay_latency_scale : 0.0);
+	req->is_replaying = true;
+
+	mtx_unlock(&s_ctx.shared_lock);
+	mtx_unlock(&shard->lock);
+
+	// Nothing touches the multi handle, the worker only has to pick it up.
+	shard_wake(shard);
+}
+
+// Completes without a transfer, used in offline mode.
+static void requests_finish(request_t* req, uint16_t response_code) {
+	assert(req);
+
+	shard_t* shard = &s_ctx.shards[req->shard];
+
+	mtx_lock(&shard->lock);
+	req->response_code = response_code;
+	req->status        = HTTP_STATUS_FINISHED;
+	stats_count(req);
+	mtx_unlock(&shard->lock);
+}
+
+static bool has_validators(const http_options_t* options) {
+	if (!options) return false;
+
+	for (size_t i = 0; i < options->num_headers; ++i) {
+		const char* header = options->headers[i];
+		if (strncasecmp(header, "If-None-Match:", 14) == 0 || strncasecmp(header, "If-Modified-Since:", 18) == 0) return true;
+	}
+	return false;
+}
+
+// Value of the caller's header, leading spaces skipped. False if there is no such header.
+static bool options_header(const http_options_t* options, const char* name, char* value, size_t size) {
+	assert(name);
+	assert(value && size > 0);
+
+	if (!options) return false;
+
+	const size_t length = strlen(name);
+	for (size_t i = 0; i < options->num_headers; ++i) {
+		const char* header = options->headers[i];
+		if (strncasecmp(header, name, length) != 0 || header[length] != ':') continue;
+
+		const char* v = header + length + 1;
+		while (*v == ' ') ++v;
+		strncpy(value, v, size - 1);
+		value[size - 1] = 0;
+		return true;
+	}
+	return false;
+}
+
+// Cache is all there is offline, it answers the caller's validators the way the server would.
+// Returns the response code, 0 on a miss.
+static uint16_t requests_offline(request_t* req, const http_options_t* options, void* buffer, size_t size) {
+	assert(req);
+
+	if (!req->cache_key) return 0;
+
+	char if_none_match[HTTP_MAX_ETAG_LENGTH];
+	if (options_header(options, "If-None-Match", if_none_match, sizeof(if_none_match))
+	 && http_cache_lookup(req->cache_key, req->etag, HTTP_MAX_ETAG_LENGTH)
+	 && req->etag[0] && strcmp(req->etag, if_none_match) == 0) {
+		return 304;
+	}
+
+	req->etag[0] = 0;
+	if (!http_cache_get(req->cache_key, buffer, size, &req->used, req->etag, HTTP_MAX_ETAG_LENGTH)) return 0;
+
+	req->free = size - req->used;
+	return 200;
+}
+
+static http_work_id_t requests_add(const http_options_t* options, void* buffer, size_t size) {
+	assert(work_can_add(&s_ctx.work));
+
+	http_work_id_t id  = work_add(&s_ctx.work);
+	request_t*     req = &work_lookup(&s_ctx.work, id)->req;
+
+	// Picked while the slot is not in progress yet, so it doesn't count itself.
+	const uint8_t shard = shard_pick();
+
+	requests_reset(req, options, buffer, size);
+	req->shard = shard;
+
 	return id;
 }
 
+// Content type can be NULL.
+static void requests_set_headers(request_t* req, const char* content_type, const http_options_t* options) {
+	assert(req);
+	assert(!req->headers);
+
+	if (content_type) req->headers = curl_slist_append(req->headers, content_type);
+
+	if (options) {
+		for (size_t i = 0; i < options->num_headers; ++i) {
+			req->headers = curl_slist_append(req->headers, options->headers[i]);
+		}
+	}
+
+	curl_easy_setopt(req->h, CURLOPT_HTTPHEADER, req->headers);
+}
+
 // PUBLIC API
 // ==========
 
-void http_init() {
-	assert(!s_ctx.multi);
+http_config_t http_config_default() {
+	return CONFIG_DEFAULT;
+}
+
+void http_init(const http_config_t* config) {
+	assert(s_ctx.num_shards == 0);
 
-	if (mtx_init(&s_ctx.multi_lock, mtx_plain) != thrd_success) log_fatal("[http] Failed to create mutex");
-	if (cnd_init(&s_ctx.got_work) != thrd_success) log_fatal("[http] Failed to create a condvar");
+	s_ctx.config = config ? *config : CONFIG_DEFAULT;
+	if (s_ctx.config.num_players == 0) s_ctx.config.num_players = 1;
+
+	if (s_ctx.config.cache_dir && !http_cache_init(s_ctx.config.cache_dir, s_ctx.config.cache_max_bytes)) {
+		log_error("[http] Going on without the cache");
+	}
+	if (s_ctx.config.is_offline) log_info("[http] Offline, serving from the cache only");
+
+	const http_conditions_t* conditions = &s_ctx.config.conditions;
+	s_ctx.conditions_random = conditions->seed ? conditions->seed : 1;
+	if (is_conditioned() || conditions->download_bytes_per_second > 0 || conditions->upload_bytes_per_second > 0) {
+		log_info("[http] Simulating %u+%u ms round trips, %u/%u B/s down/up, %.1f%% failures",
+			conditions->rtt_ms, conditions->jitter_ms,
+			conditions->download_bytes_per_second, conditions->upload_bytes_per_second,
+			conditions->failure_rate * 100.0f);
+	}
+
+	if (s_ctx.config.replay_path && !http_trace_replay_open(s_ctx.config.replay_path)) {
+		log_fatal("[http] Failed to load the trace to replay: %s", s_ctx.config.replay_path);
+	}
+	if (s_ctx.config.record_path && !http_trace_record_open(s_ctx.config.record_path)) {
+		s_ctx.config.record_path = NULL;
+	}
+
+	if (mtx_init(&s_ctx.shared_lock, mtx_plain) != thrd_success) log_fatal("[http] Failed to create mutex");
+
+	for (size_t i = 0; i < REQUESTS_COUNT; ++i) {
+		s_ctx.requests_metrics[i] = metrics_counter(REQUESTS_METRICS[i]);
+	}
+	s_ctx.retries_metric    = metrics_counter("http.retries");
+	s_ctx.bytes_down_metric = metrics_counter("http.bytes_down");
+	s_ctx.bytes_up_metric   = metrics_counter("http.bytes_up");
+
+	s_ctx.tokens    = RATE_LIMIT_BURST * s_ctx.config.num_players;
+	s_ctx.tokens_at = timer_current();
+	s_ctx.jitter    = (uint32_t)s_ctx.tokens_at | 1;
 
 	CURLcode e = curl_global_init(CURL_GLOBAL_DEFAULT);
 	if (e != CURLE_OK) log_fatal("[http] Failed to init curl");
 	
-	s_ctx.multi = curl_multi_init();
 	s_ctx.share = curl_share_init();
 
+	// Workers use it in parallel.
+	for (size_t i = 0; i < CURL_LOCK_DATA_LAST; ++i) {
+		if (mtx_init(&s_ctx.share_locks[i], mtx_plain) != thrd_success) log_fatal("[http] Failed to create mutex");
+	}
+	curl_share_setopt(s_ctx.share, CURLSHOPT_LOCKFUNC,   share_lock);
+	curl_share_setopt(s_ctx.share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+
 	curl_share_setopt(s_ctx.share, CURLSHOPT_SHARE, CURL_LOCK_DATA_COOKIE);
 	curl_share_setopt(s_ctx.share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
 
+	const http_config_t* c = &s_ctx.config;
+
+	uint32_t num_shards = c->num_workers;
+	if (num_shards == 0) {
+		const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+		num_shards = cores > 0 ? cores : 1;
+	}
+	s_ctx.num_shards = CLAMP(num_shards, 1, HTTP_MAX_WORKERS);
+
+	if (c->share_connections) {
+		curl_share_setopt(s_ctx.share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+
+		// Connection cache can't be used from several threads at once, curl doesn't support it.
+		// Older curl knows the constant, but refuses it.
+		if (s_ctx.num_shards > 1 || curl_share_setopt(s_ctx.share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT) != CURLSHE_OK) {
+			log_info("[http] Connections stay per multi handle");
+		}
+	}
+
+	// Connection limits are split between the multi handles, so the server sees the same number.
+	const long host_connections = MAX(c->max_host_connections / s_ctx.num_shards, 1);
+	const long connections      = MAX(c->max_connections      / s_ctx.num_shards, 1);
+
+	for (uint8_t i = 0; i < s_ctx.num_shards; ++i) {
+		shard_t* shard = &s_ctx.shards[i];
+
+		if (mtx_init(&shard->lock, mtx_plain) != thrd_success) log_fatal("[http] Failed to create mutex");
+		if (cnd_init(&shard->got_work) != thrd_success) log_fatal("[http] Failed to create a condvar");
+		if (cnd_init(&shard->polled)   != thrd_success) log_fatal("[http] Failed to create a condvar");
+
+		// Neither end ever blocks, a full pipe already wakes the worker up.
+		if (pipe(shard->wake_pipe) != 0) log_fatal("[http] Failed to create a wake up pipe");
+		for (size_t j = 0; j < 2; ++j) {
+			fcntl(shard->wake_pipe[j], F_SETFL, fcntl(shard->wake_pipe[j], F_GETFL) | O_NONBLOCK);
+		}
+
+		shard->multi = curl_multi_init();
+
+		if (c->use_http2)                curl_multi_setopt(shard->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+		if (c->max_host_connections > 0) curl_multi_setopt(shard->multi, CURLMOPT_MAX_HOST_CONNECTIONS, host_connections);
+		if (c->max_connections > 0)      curl_multi_setopt(shard->multi, CURLMOPT_MAXCONNECTS, connections);
+	}
+
 	// TODO: curl_global_init_mem - pass memory functions.
 	
 	requests_init();
+	s_ctx.warmup.h = create_easy(&s_ctx.warmup);
 
-	if (thrd_create(&s_ctx.thread, worker, NULL) != thrd_success) log_fatal("[http] Failed to create a worker thread");
+	for (uint8_t i = 0; i < s_ctx.num_shards; ++i) {
+		if (thrd_create(&s_ctx.shards[i].thread, worker, &s_ctx.shards[i]) != thrd_success) log_fatal("[http] Failed to create a worker thread");
+	}
+	log_info("[http] %u workers", s_ctx.num_shards);
 
 #if DEBUG
 	const curl_version_info_data* info = curl_version_info(CURLVERSION_NOW);
@@ -314,84 +1630,187 @@ void http_init() {
 }
 
 void http_shutdown() {
-	assert(s_ctx.multi);
+	assert(s_ctx.num_shards > 0);
 
-	mtx_lock(&s_ctx.multi_lock);
-	s_ctx.stop_worker = true;
-	mtx_unlock(&s_ctx.multi_lock);
+	for (uint8_t i = 0; i < s_ctx.num_shards; ++i) {
+		shard_t* shard = &s_ctx.shards[i];
 
-	cnd_signal(&s_ctx.got_work);
+		shard_lock(shard);
+		shard->stop = true;
+		shard_unlock(shard);
+	}
+
+	for (uint8_t i = 0; i < s_ctx.num_shards; ++i) {
+		thrd_join(s_ctx.shards[i].thread, NULL);
+	}
 
-	thrd_join(s_ctx.thread, NULL);
-	mtx_destroy(&s_ctx.multi_lock);
+	http_stats_dump();
 
 	requests_shutdown();
 
-	curl_multi_cleanup(s_ctx.multi);
+	if (s_ctx.warmup.is_running) curl_multi_remove_handle(s_ctx.shards[0].multi, s_ctx.warmup.h);
+	free_easy(s_ctx.warmup.h);
+
+	for (uint8_t i = 0; i < s_ctx.num_shards; ++i) {
+		shard_t* shard = &s_ctx.shards[i];
+
+		curl_multi_cleanup(shard->multi);
+		close(shard->wake_pipe[0]);
+		close(shard->wake_pipe[1]);
+		cnd_destroy(&shard->polled);
+		cnd_destroy(&shard->got_work);
+		mtx_destroy(&shard->lock);
+	}
+	s_ctx.num_shards = 0;
+
 	curl_share_cleanup(s_ctx.share);
+	for (size_t i = 0; i < CURL_LOCK_DATA_LAST; ++i) {
+		mtx_destroy(&s_ctx.share_locks[i]);
+	}
+
+	mtx_destroy(&s_ctx.shared_lock);
 
 	curl_global_cleanup();
+
+	http_cache_shutdown();
+	http_trace_close();
+}
+
+void http_preconnect(const char* url) {
+	assert(url);
+
+	request_t* req = &s_ctx.warmup;
+
+	// Always goes through the first worker.
+	mtx_lock(&s_ctx.shards[0].lock);
+	const bool is_busy = req->status == HTTP_STATUS_IN_PROGRESS;
+	mtx_unlock(&s_ctx.shards[0].lock);
+
+	if (is_busy || s_ctx.config.is_offline || s_ctx.config.replay_path) return;
+
+	const http_options_t options = { .endpoint = "preconnect" };
+	requests_reset(req, &options, s_ctx.warmup_buffer, sizeof(s_ctx.warmup_buffer));
+
+	curl_easy_setopt(req->h, CURLOPT_URL,    url);
+	curl_easy_setopt(req->h, CURLOPT_NOBODY, 1L);
+
+	add_to_multi(req);
 }
 
-http_work_id_t http_get(const char* url, void* buffer, size_t size) {
+http_work_id_t http_get(const char* url, const http_options_t* options, void* buffer, size_t size) {
 	assert(url);
 	
 	if (!work_can_add(&s_ctx.work)) return 0;
 
-	http_work_id_t id = requests_add(buffer, size);
-	CURL*           h  = work_lookup(&s_ctx.work, id)->req.h;
+	http_work_id_t id  = requests_add(options, buffer, size);
+	request_t*     req = &work_lookup(&s_ctx.work, id)->req;
+	CURL*          h   = req->h;
+
+	if (s_ctx.config.replay_path) {
+		requests_replay(req, url);
+		return id;
+	}
+
+	// Caller's own validators mean it wants to see a 304, so the cache stays out of it, unless it's all there is.
+	const bool is_cached = s_ctx.config.cache_dir && (s_ctx.config.is_offline || !has_validators(options));
+	if (is_cached) req->cache_key = http_cache_key(options ? options->cache_scope : NULL, url);
+
+	if (s_ctx.config.is_offline) {
+		requests_finish(req, requests_offline(req, options, buffer, size));
+		return id;
+	}
+
+	curl_easy_setopt(h, CURLOPT_URL,     url);
+	curl_easy_setopt(h, CURLOPT_HTTPGET, 1);
+
+	req->is_idempotent = true;
+
+	requests_set_headers(req, NULL, options);
+
+	char etag[HTTP_MAX_ETAG_LENGTH];
+	if (req->cache_key && http_cache_lookup(req->cache_key, etag, sizeof(etag)) && etag[0]) {
+		char header[HTTP_MAX_ETAG_LENGTH + 16];
+		snprintf(header, sizeof(header), "If-None-Match: %s", etag);
+		req->headers = curl_slist_append(req->headers, header);
+		curl_easy_setopt(h, CURLOPT_HTTPHEADER, req->headers);
+
+		req->is_cache_validated = true;
+	}
+
+	add_to_multi(req);
+
+	return id;
+}
 
-	curl_easy_setopt(h, CURLOPT_URL,        url);
-	curl_easy_setopt(h, CURLOPT_HTTPGET,    1);
-	curl_easy_setopt(h, CURLOPT_HTTPHEADER, NULL);
+// Offline POSTs are taken as accepted, the response is empty.
+static http_work_id_t post_offline(const http_options_t* options, void* buffer, size_t size) {
+	http_work_id_t id  = requests_add(options, buffer, size);
+	request_t*     req = &work_lookup(&s_ctx.work, id)->req;
 
-	add_to_multi(h);
+	((uint8_t*)buffer)[0] = 0;
+	requests_finish(req, 200);
 
 	return id;
 }
 
 // TODO: Move out common form vs json and re-use rest of the code. 
 
-http_work_id_t http_post_json(const char* url, const char* payload, void* buffer, size_t size) {
+http_work_id_t http_post_json(const char* url, const char* payload, const http_options_t* options, void* buffer, size_t size) {
 	assert(url);
 	assert(payload);
 	assert(buffer);
 	assert(size > 0);
 
 	if (!work_can_add(&s_ctx.work)) return 0;
+	if (s_ctx.config.is_offline && !s_ctx.config.replay_path) return post_offline(options, buffer, size);
 
-	http_work_id_t id  = requests_add(buffer, size);
+	http_work_id_t id  = requests_add(options, buffer, size);
 	request_t*     req = &work_lookup(&s_ctx.work, id)->req;
 	CURL*          h   = req->h;
 
+	req->method = HTTP_TRACE_POST;
+
+	if (s_ctx.config.replay_path) {
+		requests_replay(req, url);
+		return id;
+	}
+
 	curl_easy_setopt(h, CURLOPT_URL, url);
 	curl_easy_setopt(h, CURLOPT_POST, 1);
 	
-	req->headers = curl_slist_append(NULL, "Content-Type: application/json");
+	requests_set_headers(req, "Content-Type: application/json", options);
 
 	curl_easy_setopt(h, CURLOPT_MIMEPOST,       NULL);
-	curl_easy_setopt(h, CURLOPT_HTTPHEADER,     req->headers);
 	curl_easy_setopt(h, CURLOPT_COPYPOSTFIELDS, payload);
 
-	add_to_multi(h);
+	add_to_multi(req);
 
 	return id;
 }
 
-http_work_id_t http_post_form(const char* url, const http_form_part_t* parts, size_t num_parts, void* buffer, size_t size) {
+http_work_id_t http_post_form(const char* url, const http_form_part_t* parts, size_t num_parts, const http_options_t* options, void* buffer, size_t size) {
 	assert(url);
 	assert(buffer);
 	assert(size > 0);
 
 	if (!work_can_add(&s_ctx.work)) return 0;
+	if (s_ctx.config.is_offline && !s_ctx.config.replay_path) return post_offline(options, buffer, size);
 
-	http_work_id_t id  = requests_add(buffer, size);
+	http_work_id_t id  = requests_add(options, buffer, size);
 	request_t*     req = &work_lookup(&s_ctx.work, id)->req;
 	CURL*          h   = req->h;
 
-	curl_easy_setopt(h, CURLOPT_URL,        url);
-	curl_easy_setopt(h, CURLOPT_POST,       1);
-	curl_easy_setopt(h, CURLOPT_HTTPHEADER, NULL);
+	req->method = HTTP_TRACE_POST;
+
+	if (s_ctx.config.replay_path) {
+		requests_replay(req, url);
+		return id;
+	}
+
+	curl_easy_setopt(h, CURLOPT_URL,  url);
+	curl_easy_setopt(h, CURLOPT_POST, 1);
+
+	requests_set_headers(req, NULL, options);
 
 	if (parts && num_parts > 0) {
 		curl_mime* m = curl_mime_init(h);
@@ -410,13 +1829,44 @@ http_work_id_t http_post_form(const char* url, const http_form_part_t* parts, si
 		curl_easy_setopt(h, CURLOPT_POSTFIELDSIZE, 0);
 	}
 
-	add_to_multi(h);
+	add_to_multi(req);
 
 	return id;
 }
 
-http_work_id_t http_post(const char* url, void* buffer, size_t size) {
-	return http_post_form(url, NULL, 0, buffer, size);
+http_work_id_t http_post(const char* url, const http_options_t* options, void* buffer, size_t size) {
+	return http_post_form(url, NULL, 0, options, buffer, size);
+}
+
+void http_cancel(http_work_id_t id) {
+	if (!work_has(&s_ctx.work, id)) return;
+
+	request_t* req   = &work_lookup(&s_ctx.work, id)->req;
+	shard_t*   shard = &s_ctx.shards[req->shard];
+
+	shard_lock(shard);
+
+	if (req->status == HTTP_STATUS_IN_PROGRESS) {
+		mtx_lock(&s_ctx.shared_lock);
+		stop_work(req);
+		mtx_unlock(&s_ctx.shared_lock);
+
+		req->response_code = 0;
+		req->status        = HTTP_STATUS_CANCELLED;
+		stats_count(req);
+
+		// Room for the held back ones.
+		schedule(shard);
+	}
+
+	shard_unlock(shard);
+}
+
+void http_release(http_work_id_t id) {
+	if (!work_has(&s_ctx.work, id)) return;
+
+	http_cancel(id);
+	work_remove(&s_ctx.work, id);
 }
 
 // TODO: SYNCHRONIZATION IS LACKING NOW, CAN BE TOTALLY BROKEN.
@@ -428,7 +1878,7 @@ http_status_t http_status(http_work_id_t id) {
 	return HTTP_STATUS_UNKNOWN;
 }
 
-bool http_response_code(http_work_id_t id, uint8_t* code) {
+bool http_response_code(http_work_id_t id, uint16_t* code) {
 	assert(code);
 
 	if (!work_has(&s_ctx.work, id)) return false;
@@ -453,3 +1903,84 @@ bool http_response_size(http_work_id_t id, size_t* size) {
 	*size = req->used;
 	return true;
 }
+
+bool http_response_etag(http_work_id_t id, char* buffer, size_t size) {
+	assert(buffer);
+	assert(size > 0);
+
+	if (!work_has(&s_ctx.work, id)) return false;
+
+	request_t* req = &work_lookup(&s_ctx.work, id)->req;
+
+	if (req->status != HTTP_STATUS_FINISHED || !req->etag[0]) return false;
+
+	strncpy(buffer, req->etag, size - 1);
+	buffer[size - 1] = 0;
+	return true;
+}
+
+bool http_response_last_modified(http_work_id_t id, char* buffer, size_t size) {
+	assert(buffer);
+	assert(size > 0);
+
+	if (!work_has(&s_ctx.work, id)) return false;
+
+	request_t* req = &work_lookup(&s_ctx.work, id)->req;
+
+	if (req->status != HTTP_STATUS_FINISHED || !req->last_modified[0]) return false;
+
+	strncpy(buffer, req->last_modified, size - 1);
+	buffer[size - 1] = 0;
+	return true;
+}
+
+size_t http_stats(http_endpoint_stats_t* stats, size_t max_stats) {
+	assert(stats || max_stats == 0);
+
+	mtx_lock(&s_ctx.shared_lock);
+
+	const size_t n = MIN(max_stats, s_ctx.num_stats);
+	memcpy(stats, s_ctx.stats, n * sizeof(*stats));
+
+	mtx_unlock(&s_ctx.shared_lock);
+
+	return n;
+}
+
+double http_stats_percentile(const http_histogram_t* h, double p) {
+	assert(h);
+	assert(p >= 0.0 && p <= 1.0);
+
+	if (h->count == 0) return 0.0;
+
+	const uint32_t rank = (uint32_t)(p * (h->count - 1)) + 1;
+
+	uint32_t seen = 0;
+	for (size_t b = 0; b < HTTP_STATS_NUM_BUCKETS - 1; ++b) {
+		seen += h->buckets[b];
+		if (seen >= rank) return MIN((double)(1u << b), h->max_ms);
+	}
+	return h->max_ms;
+}
+
+void http_stats_dump() {
+	static const char* TIMINGS[HTTP_TIMING_COUNT] = { "dns", "connect", "tls", "ttfb", "total" };
+
+	http_endpoint_stats_t stats[HTTP_STATS_MAX_ENDPOINTS];
+	const size_t          n = http_stats(stats, HTTP_STATS_MAX_ENDPOINTS);
+
+	for (size_t i = 0; i < n; ++i) {
+		const http_endpoint_stats_t* s = &stats[i];
+		log_info("[http] %s: %u requests, %u failed, %llu bytes up, %llu bytes down",
+			s->name, s->num_requests, s->num_failed, (unsigned long long)s->bytes_up, (unsigned long long)s->bytes_down);
+
+		for (size_t t = 0; t < HTTP_TIMING_COUNT; ++t) {
+			const http_histogram_t* h = &s->timings[t];
+			if (h->count == 0) continue;
+
+			log_info("[http] %s %-7s n=%u avg=%.1fms p50<=%.0fms p90<=%.0fms p99<=%.0fms max=%.1fms",
+				s->name, TIMINGS[t], h->count, h->sum_ms / h->count,
+				http_stats_percentile(h, 0.5), http_stats_percentile(h, 0.9), http_stats_percentile(h, 0.99), h->max_ms);
+		}
+	}
+}
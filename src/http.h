@@ -17,24 +17,171 @@ typedef struct {
 	const char* value;
 } http_form_part_t;
 
-void http_init();
+// Lower value goes out first. Interactive requests are never held back,
+// the rest are capped in the number of concurrent transfers.
+typedef enum {
+	HTTP_PRIORITY_INTERACTIVE = 0,
+	HTTP_PRIORITY_STATE,
+	HTTP_PRIORITY_VISIBLE,
+	HTTP_PRIORITY_PREFETCH,
+	HTTP_PRIORITY_COUNT
+} http_priority_t;
+
+// Optional per-request parameters, NULL stands for defaults.
+typedef struct {
+	// HTTP_PRIORITY_INTERACTIVE by default.
+	uint8_t priority;
+	// Whole transfer deadline, including the time spent waiting to be scheduled. 0 stands for none.
+	uint32_t timeout_ms;
+	// Name to aggregate stats under (e.g. "map"), copied. NULL stands for "other".
+	const char* endpoint;
+	// Who the response is for (e.g. the username behind the session cookie), the disk cache
+	// keeps responses of different ones apart. NULL stands for the same for everyone.
+	const char* cache_scope;
+
+	// Extra request headers, e.g. "If-None-Match: ...". Copied, can point to a temporal storage.
+	const char* const* headers;
+	size_t             num_headers;
+} http_options_t;
+
+#define HTTP_MAX_ETAG_LENGTH          128
+#define HTTP_MAX_LAST_MODIFIED_LENGTH 64
+
+#define HTTP_MAX_WORKERS 4
+
+// Simulated bad network, all zeroes for none. Same seed gives the same delays and failures.
+typedef struct {
+	// Every transfer is held back for a round trip once it's done, keeping its slot.
+	// Connection setups are not slowed down on top of it.
+	uint32_t rtt_ms;
+	// Random extra delay, up to it.
+	uint32_t jitter_ms;
+	// Of the whole link, shared by all the transfers. 0 for no cap.
+	uint32_t download_bytes_per_second;
+	uint32_t upload_bytes_per_second;
+	// Chance of a transfer failing as if the connection was dropped, 0..1.
+	float    failure_rate;
+	uint32_t seed;
+} http_conditions_t;
+
+// Connection handling & caching, NULL at init stands for http_config_default():
+// HTTP/2 on, sharing on, 4 connections per host, 16 cached connections, 30 seconds keep-alive,
+// no cache, no recording or replay, no simulated conditions, a worker per core, a single player.
+typedef struct {
+	// Multiplexes parallel requests over one connection where the server talks HTTP/2 (over TLS only).
+	bool use_http2;
+	// Shares DNS cache and connections between all handles (connections need curl 7.57+).
+	bool share_connections;
+	// 0 stands for curl's defaults.
+	uint16_t max_host_connections;
+	uint16_t max_connections;
+	// TCP keep-alive idle time & probes interval, 0 disables it.
+	uint16_t keepalive_seconds;
+
+	// Directory of the on-disk GET responses cache, NULL disables it.
+	// Successful responses are stored and revalidated by ETag, a 304 is answered from the cache as a 200.
+	const char* cache_dir;
+	uint32_t    cache_max_bytes;
+	// Nothing goes out: GETs are served from the cache (a miss finishes with code 0), ones with
+	// an If-None-Match of the cached ETag get a 304. POSTs finish right away with 200 and an empty body.
+	bool is_offline;
+
+	// Writes every finished request with its response & latency into a trace file, NULL disables it.
+	const char* record_path;
+	// Answers requests from a recorded trace, nothing goes out. Overrides the cache & offline mode.
+	const char* replay_path;
+	// Recorded latencies are multiplied by it, 0 answers right away.
+	float replay_latency_scale;
+
+	http_conditions_t conditions;
+
+	// Worker threads, each with its own curl multi handle, so TLS & decompression spread over cores.
+	// 0 stands for one per core, up to HTTP_MAX_WORKERS. Connection limits are split between them.
+	uint8_t num_workers;
+
+	// Players sharing the process, like in the load generator. Priority caps & the rate limit are per player.
+	// 0 stands for 1.
+	uint16_t num_players;
+} http_config_t;
+
+http_config_t http_config_default();
+
+void http_init(const http_config_t* config);
 
 void http_shutdown();
 
-http_work_id_t http_get(const char* url, void* buffer, size_t size);
+// Warms up DNS, TCP & TLS to the host of url with a HEAD request, so the first real one finds a connection ready.
+void http_preconnect(const char* url);
 
-http_work_id_t http_post(const char* url, void* buffer, size_t size);
+http_work_id_t http_get(const char* url, const http_options_t* options, void* buffer, size_t size);
 
-http_work_id_t http_post_json(const char* url, const char* payload, void* buffer, size_t size);
+http_work_id_t http_post(const char* url, const http_options_t* options, void* buffer, size_t size);
 
-http_work_id_t http_post_form(const char* url, const http_form_part_t* parts, size_t num_parts, void* buffer, size_t size);
+http_work_id_t http_post_json(const char* url, const char* payload, const http_options_t* options, void* buffer, size_t size);
+
+http_work_id_t http_post_form(const char* url, const http_form_part_t* parts, size_t num_parts, const http_options_t* options, void* buffer, size_t size);
 
 typedef enum {
 	HTTP_STATUS_UNKNOWN = 0,
 	HTTP_STATUS_IN_PROGRESS,
-	HTTP_STATUS_FINISHED
+	HTTP_STATUS_FINISHED,
+	HTTP_STATUS_CANCELLED,
+	HTTP_STATUS_TIMED_OUT
 } http_status_t;
 
+// Stops the transfer right away, status becomes HTTP_STATUS_CANCELLED. Does nothing for a done request.
+void http_cancel(http_work_id_t id);
+// Gives the slot back once the owner is done with the request, cancels it if it's still in progress.
+// Id is unknown afterwards.
+void http_release(http_work_id_t id);
+
 http_status_t http_status(http_work_id_t id);
-bool http_response_code(http_work_id_t id, uint8_t* code);
+bool http_response_code(http_work_id_t id, uint16_t* code);
 bool http_response_size(http_work_id_t id, size_t* size);
+// False if there was no ETag in the response.
+bool http_response_etag(http_work_id_t id, char* buffer, size_t size);
+// False if there was no Last-Modified in the response.
+bool http_response_last_modified(http_work_id_t id, char* buffer, size_t size);
+
+// STATS
+
+#define HTTP_STATS_MAX_ENDPOINTS 8
+#define HTTP_STATS_MAX_NAME      16
+// Log2 buckets in milliseconds: [0, 1), [1, 2), [2, 4) ... the last one takes the rest.
+#define HTTP_STATS_NUM_BUCKETS   18
+
+// Phases of a transfer attempt, TTFB and total are counted from its start.
+typedef enum {
+	HTTP_TIMING_DNS = 0,
+	HTTP_TIMING_CONNECT,
+	HTTP_TIMING_TLS,
+	HTTP_TIMING_TTFB,
+	HTTP_TIMING_TOTAL,
+	HTTP_TIMING_COUNT
+} http_timing_t;
+
+typedef struct {
+	uint32_t count;
+	uint32_t buckets[HTTP_STATS_NUM_BUCKETS];
+	double   sum_ms;
+	double   max_ms;
+} http_histogram_t;
+
+typedef struct {
+	char name[HTTP_STATS_MAX_NAME];
+
+	// Every attempt counts, retried ones too. Failed - no response or an error code.
+	uint32_t num_requests;
+	uint32_t num_failed;
+	uint64_t bytes_up;
+	uint64_t bytes_down;
+
+	http_histogram_t timings[HTTP_TIMING_COUNT];
+} http_endpoint_stats_t;
+
+// Copies a snapshot, returns number of endpoints.
+size_t http_stats(http_endpoint_stats_t* stats, size_t max_stats);
+// Upper bound of the bucket the percentile (0..1) falls into.
+double http_stats_percentile(const http_histogram_t* h, double p);
+// Logs a line per endpoint & timing, done at shutdown too.
+void   http_stats_dump();
@@ -0,0 +1,369 @@
+#include "http_cache.h"
+
+#include <assert.h>
+#include <stdio.h>     // snprintf, rename
+#include <string.h>    // memset, memcmp, strncpy
+#include <errno.h>
+#include <fcntl.h>     // open
+#include <unistd.h>    // close, ftruncate, unlink
+#include <sys/mman.h>  // mmap
+#include <sys/stat.h>  // mkdir, fstat
+
+#include <tinycthread.h>
+
+#include "log.h"
+#include "http.h"
+
+#define INDEX_MAGIC   "B4RC"
+#define INDEX_VERSION 1
+// Must be a power-of-two, kept at most 3/4 full.
+#define INDEX_MAX_ENTRIES 2048
+#define INDEX_MAX_LOAD    (INDEX_MAX_ENTRIES / 4 * 3)
+#define INDEX_MASK        (INDEX_MAX_ENTRIES - 1)
+
+#define MAX_PATH_LENGTH 512
+
+typedef struct {
+	char     magic[4];
+	uint32_t version;
+	uint32_t max_entries;
+	uint32_t num_entries;
+	// Sum of entry sizes, a body shared by several entries counts several times.
+	uint64_t total_bytes;
+	uint32_t tick;
+	uint32_t pad;
+} index_header_t;
+
+// 0 key marks a free one.
+typedef struct {
+	uint64_t key;
+	uint64_t content;
+	uint32_t size;
+	uint32_t last_used;
+	char     etag[HTTP_MAX_ETAG_LENGTH];
+} index_entry_t;
+
+typedef struct {
+	index_header_t header;
+	index_entry_t  entries[INDEX_MAX_ENTRIES];
+} index_t;
+
+static struct {
+	mtx_t    lock;
+	index_t* index;
+	size_t   max_bytes;
+	char     dir[MAX_PATH_LENGTH - 32];
+} s_ctx;
+
+// FNV-1a.
+#define HASH_SEED 14695981039346656037ull
+
+static uint64_t hash_more(uint64_t h, const void* data, size_t size) {
+	const uint8_t* p = data;
+
+	for (size_t i = 0; i < size; ++i) {
+		h ^= p[i];
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+static uint64_t hash(const void* data, size_t size) {
+	const uint64_t h = hash_more(HASH_SEED, data, size);
+	// 0 is reserved for a free entry.
+	return h ? h : 1;
+}
+
+static void body_path(uint64_t content, char* path, size_t size) {
+	snprintf(path, size, "%s/%016llx", s_ctx.dir, (unsigned long long)content);
+}
+
+// INDEX
+// =====
+
+// All of these happen under lock.
+
+static index_entry_t* index_find(uint64_t key) {
+	assert(key);
+
+	for (size_t i = key & INDEX_MASK;; i = (i + 1) & INDEX_MASK) {
+		index_entry_t* e = &s_ctx.index->entries[i];
+		if (e->key == key) return e;
+		if (e->key == 0)   return NULL;
+	}
+}
+
+// Backward shift deletion, keeps probe sequences intact without tombstones.
+static void index_remove(index_entry_t* e) {
+	assert(e && e->key);
+
+	index_t* index = s_ctx.index;
+
+	index->header.num_entries -= 1;
+	index->header.total_bytes -= e->size;
+
+	size_t hole = e - index->entries;
+	for (size_t i = (hole + 1) & INDEX_MASK;; i = (i + 1) & INDEX_MASK) {
+		index_entry_t* next = &index->entries[i];
+		if (next->key == 0) break;
+
+		// Moves into the hole only if its home slot is not between the hole and where it sits.
+		const size_t home = next->key & INDEX_MASK;
+		if (((i - home) & INDEX_MASK) >= ((i - hole) & INDEX_MASK)) {
+			index->entries[hole] = *next;
+			hole = i;
+		}
+	}
+	memset(&index->entries[hole], 0, sizeof(index_entry_t));
+}
+
+static bool index_is_content_used(uint64_t content) {
+	for (size_t i = 0; i < INDEX_MAX_ENTRIES; ++i) {
+		const index_entry_t* e = &s_ctx.index->entries[i];
+		if (e->key && e->content == content) return true;
+	}
+	return false;
+}
+
+static void index_evict(index_entry_t* e) {
+	const uint64_t content = e->content;
+	index_remove(e);
+
+	if (!index_is_content_used(content)) {
+		char path[MAX_PATH_LENGTH];
+		body_path(content, path, sizeof(path));
+		unlink(path);
+	}
+}
+
+static index_entry_t* index_least_recently_used() {
+	index_entry_t* lru = NULL;
+	for (size_t i = 0; i < INDEX_MAX_ENTRIES; ++i) {
+		index_entry_t* e = &s_ctx.index->entries[i];
+		if (e->key && (!lru || e->last_used < lru->last_used)) lru = e;
+	}
+	return lru;
+}
+
+static bool index_is_valid(const index_t* index) {
+	const index_header_t* h = &index->header;
+	return memcmp(h->magic, INDEX_MAGIC, 4) == 0 && h->version == INDEX_VERSION && h->max_entries == INDEX_MAX_ENTRIES;
+}
+
+// BODIES
+// ======
+
+static bool body_write(uint64_t content, const void* data, size_t size) {
+	char path[MAX_PATH_LENGTH];
+	char temp[MAX_PATH_LENGTH + 8];
+	body_path(content, path, sizeof(path));
+	snprintf(temp, sizeof(temp), "%s.tmp", path);
+
+	// Same content is already there.
+	struct stat st;
+	if (stat(path, &st) == 0 && (size_t)st.st_size == size) return true;
+
+	FILE* f = fopen(temp, "wb");
+	if (!f) return false;
+
+	const bool is_written = fwrite(data, 1, size, f) == size;
+	fclose(f);
+
+	// Readers never see a half-written body.
+	if (!is_written || rename(temp, path) != 0) {
+		unlink(temp);
+		return false;
+	}
+	return true;
+}
+
+static bool body_read(uint64_t content, void* buffer, size_t size) {
+	char path[MAX_PATH_LENGTH];
+	body_path(content, path, sizeof(path));
+
+	FILE* f = fopen(path, "rb");
+	if (!f) return false;
+
+	const bool is_read = fread(buffer, 1, size, f) == size;
+	fclose(f);
+
+	return is_read;
+}
+
+// PUBLIC API
+// ==========
+
+bool http_cache_init(const char* dir, size_t max_bytes) {
+	assert(dir);
+	assert(max_bytes > 0);
+	assert(!s_ctx.index);
+
+	if (strlen(dir) >= sizeof(s_ctx.dir)) {
+		log_error("[http_cache] Directory path is too long: %s", dir);
+		return false;
+	}
+	strncpy(s_ctx.dir, dir, sizeof(s_ctx.dir) - 1);
+	s_ctx.max_bytes = max_bytes;
+
+	if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+		log_error("[http_cache] Failed to create %s", dir);
+		return false;
+	}
+
+	char path[MAX_PATH_LENGTH];
+	snprintf(path, sizeof(path), "%s/index", dir);
+
+	const int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		log_error("[http_cache] Failed to open %s", path);
+		return false;
+	}
+
+	struct stat st;
+	const bool is_new = fstat(fd, &st) != 0 || (size_t)st.st_size != sizeof(index_t);
+	if (is_new && ftruncate(fd, sizeof(index_t)) != 0) {
+		log_error("[http_cache] Failed to resize %s", path);
+		close(fd);
+		return false;
+	}
+
+	void* p = mmap(NULL, sizeof(index_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	// Mapping keeps the file referenced.
+	close(fd);
+
+	if (p == MAP_FAILED) {
+		log_error("[http_cache] Failed to map %s", path);
+		return false;
+	}
+
+	index_t* index = p;
+	if (is_new || !index_is_valid(index)) {
+		// Bodies of an older index are orphaned, they are cheap to lose.
+		memset(index, 0, sizeof(index_t));
+		memcpy(index->header.magic, INDEX_MAGIC, 4);
+		index->header.version     = INDEX_VERSION;
+		index->header.max_entries = INDEX_MAX_ENTRIES;
+	}
+
+	if (mtx_init(&s_ctx.lock, mtx_plain) != thrd_success) log_fatal("[http_cache] Failed to create mutex");
+	s_ctx.index = index;
+
+	log_info("[http_cache] %u entries, %llu bytes in %s", index->header.num_entries, (unsigned long long)index->header.total_bytes, dir);
+	return true;
+}
+
+void http_cache_shutdown() {
+	if (!s_ctx.index) return;
+
+	msync(s_ctx.index, sizeof(index_t), MS_ASYNC);
+	munmap(s_ctx.index, sizeof(index_t));
+	mtx_destroy(&s_ctx.lock);
+	s_ctx.index = NULL;
+}
+
+uint64_t http_cache_key(const char* scope, const char* url) {
+	assert(url);
+
+	// Terminating zero included, so scope and url can't run into each other.
+	uint64_t h = scope ? hash_more(HASH_SEED, scope, strlen(scope) + 1) : HASH_SEED;
+	h = hash_more(h, url, strlen(url));
+	return h ? h : 1;
+}
+
+bool http_cache_lookup(uint64_t key, char* etag, size_t etag_size) {
+	if (!s_ctx.index) return false;
+
+	mtx_lock(&s_ctx.lock);
+
+	const index_entry_t* e = index_find(key);
+	if (e && etag) {
+		assert(etag_size > 0);
+		strncpy(etag, e->etag, etag_size - 1);
+		etag[etag_size - 1] = 0;
+	}
+
+	mtx_unlock(&s_ctx.lock);
+
+	return e != NULL;
+}
+
+bool http_cache_get(uint64_t key, void* buffer, size_t size, size_t* used, char* etag, size_t etag_size) {
+	assert(buffer);
+	assert(used);
+
+	if (!s_ctx.index) return false;
+
+	mtx_lock(&s_ctx.lock);
+
+	index_entry_t* e = index_find(key);
+
+	// Plus 1 as it will be zero-terminated.
+	bool is_hit = e && e->size + 1 <= size && body_read(e->content, buffer, e->size);
+	if (is_hit) {
+		((uint8_t*)buffer)[e->size] = 0;
+		*used        = e->size;
+		e->last_used = ++s_ctx.index->header.tick;
+
+		if (etag) {
+			assert(etag_size > 0);
+			strncpy(etag, e->etag, etag_size - 1);
+			etag[etag_size - 1] = 0;
+		}
+	} else if (e && e->size + 1 <= size) {
+		// Body is gone from under us.
+		index_evict(e);
+	}
+
+	mtx_unlock(&s_ctx.lock);
+
+	return is_hit;
+}
+
+void http_cache_put(uint64_t key, const void* data, size_t size, const char* etag) {
+	assert(data || size == 0);
+
+	if (!s_ctx.index || size > s_ctx.max_bytes || size > UINT32_MAX) return;
+
+	const uint64_t content = hash(data, size);
+
+	mtx_lock(&s_ctx.lock);
+
+	index_t* index = s_ctx.index;
+
+	index_entry_t* e = index_find(key);
+	if (e && e->content != content) {
+		index_evict(e);
+		e = NULL;
+	}
+
+	if (!e) {
+		while (index->header.num_entries >= INDEX_MAX_LOAD || index->header.total_bytes + size > s_ctx.max_bytes) {
+			index_entry_t* lru = index_least_recently_used();
+			if (!lru) break;
+			index_evict(lru);
+		}
+
+		if (!body_write(content, data, size)) {
+			log_error("[http_cache] Failed to write a body of %zu bytes", size);
+			mtx_unlock(&s_ctx.lock);
+			return;
+		}
+
+		size_t i = key & INDEX_MASK;
+		while (index->entries[i].key) i = (i + 1) & INDEX_MASK;
+
+		e          = &index->entries[i];
+		e->key     = key;
+		e->content = content;
+		e->size    = size;
+
+		index->header.num_entries += 1;
+		index->header.total_bytes += size;
+	}
+
+	e->last_used = ++index->header.tick;
+	strncpy(e->etag, etag ? etag : "", HTTP_MAX_ETAG_LENGTH - 1);
+	e->etag[HTTP_MAX_ETAG_LENGTH - 1] = 0;
+
+	mtx_unlock(&s_ctx.lock);
+}
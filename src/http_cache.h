@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Content-addressed disk cache of GET responses, used by http.c.
+// Bodies are files named after a hash of their contents, so equal ones are stored once.
+// Index is a fixed-size hash table in a file, mapped into memory as is:
+// no parsing at startup, nothing to write back at shutdown.
+// Thread-safe.
+
+// False if the directory or the index can't be set up, cache stays off then.
+bool http_cache_init(const char* dir, size_t max_bytes);
+void http_cache_shutdown();
+
+// Scope keeps apart responses which differ by who asks, e.g. the username. NULL if they don't.
+uint64_t http_cache_key(const char* scope, const char* url);
+
+// ETag can be NULL. False if there is no entry.
+bool http_cache_lookup(uint64_t key, char* etag, size_t etag_size);
+// Copies the body and zero-terminates it. False on a miss or if it doesn't fit.
+bool http_cache_get(uint64_t key, void* buffer, size_t size, size_t* used, char* etag, size_t etag_size);
+// ETag can be NULL. Evicts the least recently used entries to stay within the limit.
+void http_cache_put(uint64_t key, const void* data, size_t size, const char* etag);
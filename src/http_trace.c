@@ -0,0 +1,265 @@
+#include "http_trace.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h> // memcmp, strcmp, strlen
+
+#include "allocator.h"
+#include "timer.h"
+#include "log.h"
+
+#define TRACE_MAGIC   "B4RT"
+#define TRACE_VERSION 1
+
+// All the strings are stored with a zero, lengths include it.
+typedef struct {
+	uint8_t  method;
+	uint8_t  status;
+	uint16_t response_code;
+	uint32_t url_length;
+	uint32_t etag_length;
+	uint32_t last_modified_length;
+	uint32_t body_length;
+	uint32_t pad;
+	double   start_ms;
+	double   duration_ms;
+} record_t;
+
+typedef struct {
+	char     magic[4];
+	uint32_t version;
+} header_t;
+
+#define NONE UINT32_MAX
+
+// Heads chains of requests to the same url.
+typedef struct {
+	uint64_t hash;
+	uint32_t cursor;
+} url_slot_t;
+
+static struct {
+	FILE*  record;
+	double record_start;
+
+	uint8_t*            data;
+	http_trace_entry_t* entries;
+	// Next entry with the same method & url.
+	uint32_t*           next;
+	uint32_t            num_entries;
+	url_slot_t*         urls;
+	uint32_t            urls_mask;
+} s_ctx;
+
+// FNV-1a.
+static uint64_t hash_url(uint8_t method, const char* url) {
+	uint64_t h = 14695981039346656037ull ^ method;
+	h *= 1099511628211ull;
+	for (const char* c = url; *c; ++c) {
+		h ^= (uint8_t)*c;
+		h *= 1099511628211ull;
+	}
+	return h ? h : 1;
+}
+
+static url_slot_t* urls_find(uint64_t hash, uint8_t method, const char* url) {
+	for (uint32_t i = hash & s_ctx.urls_mask;; i = (i + 1) & s_ctx.urls_mask) {
+		url_slot_t* slot = &s_ctx.urls[i];
+		if (slot->hash == 0) return slot;
+		if (slot->hash != hash) continue;
+
+		const http_trace_entry_t* e = &s_ctx.entries[slot->cursor];
+		if (e->method == method && strcmp(e->url, url) == 0) return slot;
+	}
+}
+
+static uint8_t* read_file(const char* path, size_t* size) {
+	FILE* f = fopen(path, "rb");
+	if (!f) return NULL;
+
+	fseek(f, 0, SEEK_END);
+	const long length = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	uint8_t* data = NULL;
+	if (length > 0) data = BR_ALLOC(allocator_main(), length);
+	if (data && fread(data, 1, length, f) != (size_t)length) {
+		BR_FREE(allocator_main(), data);
+		data = NULL;
+	}
+	fclose(f);
+
+	*size = data ? length : 0;
+	return data;
+}
+
+// Fills entries if they are given, returns the number of valid records.
+static uint32_t parse(uint8_t* data, size_t size, http_trace_entry_t* entries) {
+	uint32_t count = 0;
+	size_t   at    = sizeof(header_t);
+
+	while (at + sizeof(record_t) <= size) {
+		record_t r;
+		memcpy(&r, data + at, sizeof(r));
+		at += sizeof(r);
+
+		const size_t length = (size_t)r.url_length + r.etag_length + r.last_modified_length + r.body_length;
+		if (r.url_length == 0 || r.etag_length == 0 || r.last_modified_length == 0 || length > size - at) break;
+
+		const char* strings = (const char*)data + at;
+		if (strings[r.url_length - 1] || strings[r.url_length + r.etag_length - 1] || strings[r.url_length + r.etag_length + r.last_modified_length - 1]) break;
+
+		if (entries) {
+			http_trace_entry_t* e = &entries[count];
+			e->method        = r.method;
+			e->status        = r.status;
+			e->response_code = r.response_code;
+			e->start_ms      = r.start_ms;
+			e->duration_ms   = r.duration_ms;
+			e->url           = strings;
+			e->etag          = strings + r.url_length;
+			e->last_modified = strings + r.url_length + r.etag_length;
+			e->body          = strings + r.url_length + r.etag_length + r.last_modified_length;
+			e->body_size     = r.body_length;
+		}
+
+		at += length;
+		++count;
+	}
+
+	return count;
+}
+
+// PUBLIC API
+// ==========
+
+bool http_trace_record_open(const char* path) {
+	assert(path);
+	assert(!s_ctx.record);
+
+	FILE* f = fopen(path, "wb");
+	if (!f) {
+		log_error("[http_trace] Failed to create %s", path);
+		return false;
+	}
+
+	header_t h = { .version = TRACE_VERSION };
+	memcpy(h.magic, TRACE_MAGIC, 4);
+	fwrite(&h, sizeof(h), 1, f);
+
+	s_ctx.record       = f;
+	s_ctx.record_start = timer_current();
+
+	log_info("[http_trace] Recording to %s", path);
+	return true;
+}
+
+void http_trace_record(const http_trace_entry_t* entry) {
+	assert(entry);
+	assert(entry->url);
+
+	if (!s_ctx.record) return;
+
+	const char* etag          = entry->etag          ? entry->etag          : "";
+	const char* last_modified = entry->last_modified ? entry->last_modified : "";
+
+	record_t r = {
+		.method               = entry->method,
+		.status               = entry->status,
+		.response_code        = entry->response_code,
+		.url_length           = strlen(entry->url) + 1,
+		.etag_length          = strlen(etag) + 1,
+		.last_modified_length = strlen(last_modified) + 1,
+		.body_length          = entry->body_size,
+		.start_ms             = entry->start_ms - s_ctx.record_start,
+		.duration_ms          = entry->duration_ms,
+	};
+
+	// Records of several threads don't interleave.
+	FILE* f = s_ctx.record;
+	flockfile(f);
+	fwrite(&r,            sizeof(r), 1, f);
+	fwrite(entry->url,    r.url_length, 1, f);
+	fwrite(etag,          r.etag_length, 1, f);
+	fwrite(last_modified, r.last_modified_length, 1, f);
+	if (r.body_length > 0) fwrite(entry->body, r.body_length, 1, f);
+	funlockfile(f);
+}
+
+bool http_trace_replay_open(const char* path) {
+	assert(path);
+	assert(!s_ctx.data);
+
+	size_t   size;
+	uint8_t* data = read_file(path, &size);
+
+	header_t h;
+	if (data && size >= sizeof(h)) memcpy(&h, data, sizeof(h));
+
+	if (!data || size < sizeof(h) || memcmp(h.magic, TRACE_MAGIC, 4) != 0 || h.version != TRACE_VERSION) {
+		log_error("[http_trace] Failed to load %s", path);
+		if (data) BR_FREE(allocator_main(), data);
+		return false;
+	}
+
+	allocator_t* alloc = allocator_main();
+
+	const uint32_t count = parse(data, size, NULL);
+
+	uint32_t num_urls = 16;
+	while (num_urls < count * 2) num_urls <<= 1;
+
+	s_ctx.data        = data;
+	s_ctx.num_entries = count;
+	s_ctx.entries     = BR_ALLOC(alloc, sizeof(http_trace_entry_t) * (count ? count : 1));
+	s_ctx.next        = BR_ALLOC(alloc, sizeof(uint32_t)           * (count ? count : 1));
+	s_ctx.urls        = BR_ALLOC(alloc, sizeof(url_slot_t)         * num_urls);
+	s_ctx.urls_mask   = num_urls - 1;
+
+	parse(data, size, s_ctx.entries);
+	memset(s_ctx.urls, 0, sizeof(url_slot_t) * num_urls);
+
+	// Links each entry to the next one of the same url, walking backwards keeps the recorded order.
+	for (uint32_t i = count; i-- > 0;) {
+		const http_trace_entry_t* e    = &s_ctx.entries[i];
+		const uint64_t            hash = hash_url(e->method, e->url);
+
+		url_slot_t* slot = urls_find(hash, e->method, e->url);
+		s_ctx.next[i] = slot->hash ? slot->cursor : NONE;
+		slot->hash    = hash;
+		slot->cursor  = i;
+	}
+
+	log_info("[http_trace] Replaying %u requests from %s", count, path);
+	return true;
+}
+
+const http_trace_entry_t* http_trace_replay_next(uint8_t method, const char* url) {
+	assert(url);
+
+	if (!s_ctx.data) return NULL;
+
+	url_slot_t* slot = urls_find(hash_url(method, url), method, url);
+	if (slot->hash == 0) return NULL;
+
+	const uint32_t i = slot->cursor;
+	if (s_ctx.next[i] != NONE) slot->cursor = s_ctx.next[i];
+
+	return &s_ctx.entries[i];
+}
+
+void http_trace_close() {
+	if (s_ctx.record) {
+		fclose(s_ctx.record);
+		s_ctx.record = NULL;
+	}
+
+	if (s_ctx.data) {
+		allocator_t* alloc = allocator_main();
+		BR_FREE(alloc, s_ctx.urls);
+		BR_FREE(alloc, s_ctx.next);
+		BR_FREE(alloc, s_ctx.entries);
+		BR_FREE(alloc, s_ctx.data);
+		s_ctx.data = NULL;
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Trace of HTTP traffic, used by http.c to record a session and to replay it without network.
+// Recording is thread-safe, the workers of http.c record at the same time. The rest is not.
+
+typedef enum {
+	HTTP_TRACE_GET = 0,
+	HTTP_TRACE_POST,
+} http_trace_method_t;
+
+typedef struct {
+	uint8_t  method;
+	// http_status_t the request finished with.
+	uint8_t  status;
+	uint16_t response_code;
+
+	// Since the recording has started.
+	double start_ms;
+	// From the call to the finish as the caller saw it, queueing and retries included.
+	double duration_ms;
+
+	const char* url;
+	const char* etag;
+	const char* last_modified;
+	const void* body;
+	size_t      body_size;
+} http_trace_entry_t;
+
+bool http_trace_record_open(const char* path);
+void http_trace_record(const http_trace_entry_t* entry);
+
+// Loads the whole trace into memory.
+bool http_trace_replay_open(const char* path);
+// Requests to the same url are answered in the recorded order, the last answer repeats once they run out.
+// NULL if nothing was recorded for it.
+const http_trace_entry_t* http_trace_replay_next(uint8_t method, const char* url);
+
+void http_trace_close();
@@ -3,28 +3,214 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <stdatomic.h>
 
-#define PRINT_TO(s, f)        \
-	va_list args;             \
-	va_start(args, (f));      \
-	vfprintf((s), (f), args); \
-	va_end(args);
+#include <tinycthread.h>
+
+// Lines a thread can have waiting, power of 2.
+#define RING_SIZE     512
+// How long the writer sleeps once it's written everything out.
+#define IDLE_SLEEP_NS (5 * 1000 * 1000)
+
+typedef struct {
+	int  level;
+	char text[LOG_MAX_LINE_LENGTH];
+} line_t;
+
+// Single producer, its thread, single consumer, whoever holds s_ctx.is_draining.
+typedef struct {
+	line_t           lines[RING_SIZE];
+	_Atomic uint32_t head;
+	_Atomic uint32_t tail;
+} ring_t;
+
+typedef enum {
+	WRITER_NONE = 0,
+	WRITER_STARTING,
+	WRITER_RUNNING,
+	WRITER_STOPPED
+} writer_state_t;
+
+static struct {
+	// Static, pages of rings never used aren't touched.
+	ring_t           rings[LOG_MAX_THREADS];
+	_Atomic uint32_t num_rings;
+
+	atomic_flag    is_draining;
+	_Atomic int    writer_state;
+	_Atomic bool   should_stop;
+	thrd_t         writer;
+
+	// Set by the main thread, read by all of them.
+	_Atomic bool is_info_disabled;
+} s_ctx = {
+	.is_draining = ATOMIC_FLAG_INIT
+};
+
+static _Thread_local ring_t* s_ring;
+static _Thread_local bool    s_is_untracked;
+
+static FILE* level_stream(int level) {
+	return level == LOG_LEVEL_INFO ? stdout : stderr;
+}
+
+static void write_line(int level, const char* text) {
+	FILE* s = level_stream(level);
+	fputs(text, s);
+	fputc('\n', s);
+}
 
-#define PRINT_ENDL(s) fprintf((s), "\n");
+static void format_line(char* text, const char* format, va_list args) {
+	const int length = vsnprintf(text, LOG_MAX_LINE_LENGTH, format, args);
+	if (length >= LOG_MAX_LINE_LENGTH) {
+		text[LOG_MAX_LINE_LENGTH - 4] = '.';
+		text[LOG_MAX_LINE_LENGTH - 3] = '.';
+		text[LOG_MAX_LINE_LENGTH - 2] = '.';
+	}
+}
+
+// DRAINING
+// ========
+
+static bool drain_ring(ring_t* r) {
+	const uint32_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+	uint32_t       tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	if (head == tail) return false;
+
+	for (; tail != head; ++tail) {
+		const line_t* l = &r->lines[tail & (RING_SIZE - 1)];
+		write_line(l->level, l->text);
+	}
+	atomic_store_explicit(&r->tail, tail, memory_order_release);
 
-void log_info(const char* format, ...) {
-	PRINT_TO  (stdout, format);
-	PRINT_ENDL(stdout);
+	return true;
 }
 
-void log_error(const char* format, ...) {
-	PRINT_TO  (stderr, format);
-	PRINT_ENDL(stderr);
+// Writes out every ring, returns whether there was anything.
+static bool drain() {
+	while (atomic_flag_test_and_set_explicit(&s_ctx.is_draining, memory_order_acquire)) thrd_yield();
+
+	bool is_any = false;
+	const uint32_t num_rings = atomic_load(&s_ctx.num_rings);
+	for (uint32_t i = 0; i < num_rings && i < LOG_MAX_THREADS; ++i) {
+		is_any |= drain_ring(&s_ctx.rings[i]);
+	}
+	if (is_any) fflush(stdout);
+
+	atomic_flag_clear_explicit(&s_ctx.is_draining, memory_order_release);
+	return is_any;
+}
+
+// WRITER THREAD
+// =============
+
+static int writer(void* arg) {
+	(void)arg;
+
+	const struct timespec idle = { .tv_sec = 0, .tv_nsec = IDLE_SLEEP_NS };
+
+	while (!atomic_load(&s_ctx.should_stop)) {
+		if (!drain()) thrd_sleep(&idle, NULL);
+	}
+	return 0;
+}
+
+// Exit or return from main, lines logged from now on are written synchronously.
+static void stop_writer() {
+	atomic_store(&s_ctx.should_stop, true);
+	thrd_join(s_ctx.writer, NULL);
+	atomic_store(&s_ctx.writer_state, WRITER_STOPPED);
+
+	// Pairs with the one in log_line: either this drain sees a line pushed meanwhile,
+	// or its thread sees the writer stopped and drains it itself.
+	atomic_thread_fence(memory_order_seq_cst);
+	drain();
+}
+
+// Started by the first line, lines logged meanwhile wait in the rings.
+static void start_writer() {
+	int expected = WRITER_NONE;
+	if (!atomic_compare_exchange_strong(&s_ctx.writer_state, &expected, WRITER_STARTING)) return;
+
+	if (thrd_create(&s_ctx.writer, writer, NULL) != thrd_success) {
+		atomic_store(&s_ctx.writer_state, WRITER_STOPPED);
+		fprintf(stderr, "[log] Failed to create the writer thread, logging synchronously\n");
+		drain();
+		return;
+	}
+
+	atomic_store(&s_ctx.writer_state, WRITER_RUNNING);
+	atexit(stop_writer);
+}
+
+static ring_t* thread_ring() {
+	if (s_ring || s_is_untracked) return s_ring;
+
+	const uint32_t i = atomic_fetch_add(&s_ctx.num_rings, 1);
+	if (i >= LOG_MAX_THREADS) {
+		s_is_untracked = true;
+		return NULL;
+	}
+
+	s_ring = &s_ctx.rings[i];
+	return s_ring;
+}
+
+static void log_line(int level, const char* format, va_list args) {
+	const int state = atomic_load_explicit(&s_ctx.writer_state, memory_order_acquire);
+	if (state == WRITER_NONE) start_writer();
+
+	ring_t* r = state == WRITER_STOPPED ? NULL : thread_ring();
+	if (!r) {
+		// The rings are written out first, to keep the order of lines of this thread.
+		char text[LOG_MAX_LINE_LENGTH];
+		format_line(text, format, args);
+		drain();
+		write_line(level, text);
+		return;
+	}
+
+	// The writer can't keep up, the thread writes out the rings itself rather than losing lines.
+	const uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	if (head - atomic_load_explicit(&r->tail, memory_order_acquire) == RING_SIZE) drain();
+
+	line_t* l = &r->lines[head & (RING_SIZE - 1)];
+	l->level = level;
+	format_line(l->text, format, args);
+	atomic_store_explicit(&r->head, head + 1, memory_order_release);
+
+	// Writer could have stopped (exit, log_fatal) since the state was read, the last drain can miss the line then.
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&s_ctx.writer_state, memory_order_relaxed) == WRITER_STOPPED) drain();
+}
+
+// PUBLIC API
+// ==========
+
+void log_set_info(bool is_enabled) {
+	atomic_store_explicit(&s_ctx.is_info_disabled, !is_enabled, memory_order_relaxed);
+}
+
+void log_write(int level, const char* format, ...) {
+	if (level == LOG_LEVEL_INFO && atomic_load_explicit(&s_ctx.is_info_disabled, memory_order_relaxed)) return;
+
+	va_list args;
+	va_start(args, format);
+	log_line(level, format, args);
+	va_end(args);
 }
 
 void log_fatal(const char* format, ...) {
-	PRINT_TO  (stderr, format);
-	PRINT_ENDL(stderr);
+	char text[LOG_MAX_LINE_LENGTH];
+
+	va_list args;
+	va_start(args, format);
+	format_line(text, format, args);
+	va_end(args);
+
+	drain();
+	write_line(LOG_LEVEL_FATAL, text);
 	fflush(NULL);
 	exit(1);
 }
@@ -1,8 +1,49 @@
 #pragma once
 
-void log_info(const char* format, ...);
+#include <stdbool.h>
 
-void log_error(const char* format, ...);
+// Lines are formatted into a ring of the calling thread & written out by a background one,
+// so a slow terminal or pipe never stalls the frame or the http workers. Lines of a thread
+// keep their order, lines of different threads are only roughly in order. A thread that fills
+// its ring up writes the rings out itself, so lines are never lost, it's only slowed down.
+//
+// Levels below BR_LOG_LEVEL are compiled out, arguments aren't even evaluated:
+//
+//     -DBR_LOG_LEVEL=LOG_LEVEL_ERROR
 
-// Exits immediately.
+#define LOG_LEVEL_INFO  0
+#define LOG_LEVEL_ERROR 1
+// Fatal lines only.
+#define LOG_LEVEL_FATAL 2
+
+#ifndef BR_LOG_LEVEL
+	#define BR_LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Threads past it write synchronously.
+#define LOG_MAX_THREADS     16
+// Longer lines are cut.
+#define LOG_MAX_LINE_LENGTH 256
+
+// Info lines are on by default, errors can't be turned off at runtime.
+void log_set_info(bool is_enabled);
+
+void log_write(int level, const char* format, ...);
+
+// Writes out every line logged so far, then exits immediately.
 void log_fatal(const char* format, ...);
+
+// Kept in the code, type checked, but never called.
+#define LOG_DISABLED(...) do { if (0) log_write(__VA_ARGS__); } while (0)
+
+#if BR_LOG_LEVEL <= LOG_LEVEL_INFO
+	#define log_info(...) log_write(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+	#define log_info(...) LOG_DISABLED(LOG_LEVEL_INFO, __VA_ARGS__)
+#endif
+
+#if BR_LOG_LEVEL <= LOG_LEVEL_ERROR
+	#define log_error(...) log_write(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+	#define log_error(...) LOG_DISABLED(LOG_LEVEL_ERROR, __VA_ARGS__)
+#endif
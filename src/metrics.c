@@ -0,0 +1,234 @@
+#include "metrics.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>    // strncmp, strncpy
+#include <time.h>      // time
+#include <stdatomic.h>
+
+#include "log.h"
+#include "timer.h"
+
+#define MAX_METRICS    128
+#define MAX_HISTOGRAMS 32
+
+// Values below 2^SUB_BITS get a bucket each, every power of two above is split in 2^SUB_BITS.
+#define SUB_BITS    3
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define NUM_BUCKETS ((64 - SUB_BITS + 1) * SUB_BUCKETS)
+
+typedef enum {
+	METRIC_COUNTER = 0,
+	METRIC_GAUGE,
+	METRIC_HISTOGRAM
+} metric_type_t;
+
+typedef struct {
+	_Atomic uint64_t buckets[NUM_BUCKETS];
+	_Atomic uint64_t sum;
+} histogram_t;
+
+typedef struct {
+	char    name[METRICS_MAX_NAME_LENGTH];
+	uint8_t type;
+
+	// Counters & gauges keep the value, histograms the index of theirs.
+	_Atomic int64_t value;
+} metric_t;
+
+static struct {
+	metric_t metrics[MAX_METRICS];
+	// Others can be updating while a module registers its own.
+	_Atomic size_t num_metrics;
+
+	histogram_t histograms[MAX_HISTOGRAMS];
+	size_t      num_histograms;
+
+	FILE*    file;
+	uint32_t period_ms;
+	double   flushed_at;
+} s_ctx;
+
+// HISTOGRAMS
+// ==========
+
+static size_t bucket_index(uint64_t v) {
+	if (v < SUB_BUCKETS) return v;
+
+	const uint32_t e = 63 - __builtin_clzll(v);
+	return (e - SUB_BITS + 1) * SUB_BUCKETS + ((v >> (e - SUB_BITS)) & (SUB_BUCKETS - 1));
+}
+
+// The largest value that falls into the bucket.
+static uint64_t bucket_upper(size_t i) {
+	if (i < SUB_BUCKETS) return i;
+
+	const uint32_t e = i / SUB_BUCKETS + SUB_BITS - 1;
+	const uint64_t s = i % SUB_BUCKETS;
+	return ((SUB_BUCKETS + s + 1) << (e - SUB_BITS)) - 1;
+}
+
+static uint64_t percentile(const uint64_t* buckets, uint64_t count, double p) {
+	const uint64_t rank = (uint64_t)(p * (count - 1));
+
+	uint64_t seen = 0;
+	for (size_t i = 0; i < NUM_BUCKETS; ++i) {
+		seen += buckets[i];
+		if (seen > rank) return bucket_upper(i);
+	}
+	return 0;
+}
+
+// REGISTRY
+// ========
+
+static metrics_id_t register_metric(const char* name, metric_type_t type) {
+	assert(name);
+
+	for (size_t i = 0; i < s_ctx.num_metrics; ++i) {
+		const metric_t* m = &s_ctx.metrics[i];
+		if (strncmp(m->name, name, METRICS_MAX_NAME_LENGTH - 1) == 0) {
+			if (m->type != type) log_fatal("[metrics] %s is registered as another type", name);
+			return i;
+		}
+	}
+
+	if (s_ctx.num_metrics == MAX_METRICS) log_fatal("[metrics] Too many metrics");
+	if (type == METRIC_HISTOGRAM && s_ctx.num_histograms == MAX_HISTOGRAMS) log_fatal("[metrics] Too many histograms");
+
+	metric_t* m = &s_ctx.metrics[s_ctx.num_metrics];
+	strncpy(m->name, name, METRICS_MAX_NAME_LENGTH - 1);
+	m->type = type;
+	atomic_init(&m->value, type == METRIC_HISTOGRAM ? (int64_t)s_ctx.num_histograms++ : 0);
+
+	return s_ctx.num_metrics++;
+}
+
+// FLUSHING
+// ========
+
+static void flush() {
+	FILE*        f  = s_ctx.file;
+	const time_t ts = time(NULL);
+
+	uint64_t buckets[NUM_BUCKETS];
+
+	for (size_t i = 0; i < s_ctx.num_metrics; ++i) {
+		metric_t*     m     = &s_ctx.metrics[i];
+		const int64_t value = atomic_load_explicit(&m->value, memory_order_relaxed);
+
+		switch (m->type) {
+			case METRIC_COUNTER:
+				fprintf(f, "ts=%lld type=counter name=%s value=%llu\n", (long long)ts, m->name, (unsigned long long)value);
+				break;
+			case METRIC_GAUGE:
+				fprintf(f, "ts=%lld type=gauge name=%s value=%lld\n", (long long)ts, m->name, (long long)value);
+				break;
+			case METRIC_HISTOGRAM: {
+				// Values recorded meanwhile go to this flush or the next one, none is lost.
+				histogram_t* h     = &s_ctx.histograms[value];
+				uint64_t     count = 0;
+				size_t       last  = 0;
+				for (size_t b = 0; b < NUM_BUCKETS; ++b) {
+					buckets[b] = atomic_exchange_explicit(&h->buckets[b], 0, memory_order_relaxed);
+					count += buckets[b];
+					if (buckets[b]) last = b;
+				}
+				const uint64_t sum = atomic_exchange_explicit(&h->sum, 0, memory_order_relaxed);
+
+				if (count == 0) {
+					fprintf(f, "ts=%lld type=histogram name=%s count=0\n", (long long)ts, m->name);
+					break;
+				}
+
+				fprintf(f, "ts=%lld type=histogram name=%s count=%llu sum=%llu p50=%llu p90=%llu p99=%llu max=%llu\n",
+					(long long)ts, m->name, (unsigned long long)count, (unsigned long long)sum,
+					(unsigned long long)percentile(buckets, count, 0.50),
+					(unsigned long long)percentile(buckets, count, 0.90),
+					(unsigned long long)percentile(buckets, count, 0.99),
+					(unsigned long long)bucket_upper(last));
+				break;
+			}
+		}
+	}
+
+	fflush(f);
+	s_ctx.flushed_at = timer_current();
+}
+
+// PUBLIC API
+// ==========
+
+metrics_id_t metrics_counter(const char* name) {
+	return register_metric(name, METRIC_COUNTER);
+}
+
+metrics_id_t metrics_gauge(const char* name) {
+	return register_metric(name, METRIC_GAUGE);
+}
+
+metrics_id_t metrics_histogram(const char* name) {
+	return register_metric(name, METRIC_HISTOGRAM);
+}
+
+void metrics_add(metrics_id_t counter, uint64_t value) {
+	assert(counter < s_ctx.num_metrics);
+	assert(s_ctx.metrics[counter].type == METRIC_COUNTER);
+
+	atomic_fetch_add_explicit(&s_ctx.metrics[counter].value, (int64_t)value, memory_order_relaxed);
+}
+
+void metrics_set(metrics_id_t gauge, int64_t value) {
+	assert(gauge < s_ctx.num_metrics);
+	assert(s_ctx.metrics[gauge].type == METRIC_GAUGE);
+
+	atomic_store_explicit(&s_ctx.metrics[gauge].value, value, memory_order_relaxed);
+}
+
+void metrics_change(metrics_id_t gauge, int64_t delta) {
+	assert(gauge < s_ctx.num_metrics);
+	assert(s_ctx.metrics[gauge].type == METRIC_GAUGE);
+
+	atomic_fetch_add_explicit(&s_ctx.metrics[gauge].value, delta, memory_order_relaxed);
+}
+
+void metrics_record(metrics_id_t histogram, uint64_t value) {
+	assert(histogram < s_ctx.num_metrics);
+	assert(s_ctx.metrics[histogram].type == METRIC_HISTOGRAM);
+
+	histogram_t* h = &s_ctx.histograms[atomic_load_explicit(&s_ctx.metrics[histogram].value, memory_order_relaxed)];
+	atomic_fetch_add_explicit(&h->buckets[bucket_index(value)], 1,     memory_order_relaxed);
+	atomic_fetch_add_explicit(&h->sum,                          value, memory_order_relaxed);
+}
+
+bool metrics_open(const char* path, uint32_t period_ms) {
+	assert(path);
+	assert(period_ms > 0);
+	assert(!s_ctx.file);
+
+	s_ctx.file = fopen(path, "a");
+	if (!s_ctx.file) {
+		log_error("[metrics] Failed to open %s", path);
+		return false;
+	}
+
+	s_ctx.period_ms  = period_ms;
+	s_ctx.flushed_at = timer_current();
+
+	log_info("[metrics] Flushing to %s every %u ms", path, period_ms);
+	return true;
+}
+
+void metrics_close() {
+	if (!s_ctx.file) return;
+
+	flush();
+	fclose(s_ctx.file);
+	s_ctx.file = NULL;
+}
+
+void metrics_update() {
+	if (!s_ctx.file) return;
+
+	if (timer_current() - s_ctx.flushed_at >= s_ctx.period_ms) flush();
+}
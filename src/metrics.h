@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Long-running aggregate numbers for dashboards, next to the traces of profile.h.
+//
+// Counters only grow, gauges go up & down, histograms keep the distribution of values in
+// log-linear buckets (HDR-style): exact below 8, within 1/8 of the value above.
+//
+// Metrics are registered by name at init time on the main thread, registering a name again
+// gives back the same id. Updates are lock-free atomics & fine from any thread on hot paths.
+//
+// Periodically flushed, appended to a file a line per metric:
+//
+//     ts=1760000000 type=counter name=http.bytes_down value=123456
+//     ts=1760000000 type=gauge name=client.pages_in_use value=3
+//     ts=1760000000 type=histogram name=frame_us count=600 sum=10012345 p50=18431 p90=18431 p99=20479 max=22527
+//
+// Timestamps are unix seconds. Counters are totals since the start, histograms cover the
+// time since the previous flush and are reset by it, percentiles are upper bounds of buckets.
+
+#define METRICS_MAX_NAME_LENGTH 48
+
+typedef uint16_t metrics_id_t;
+
+metrics_id_t metrics_counter  (const char* name);
+metrics_id_t metrics_gauge    (const char* name);
+metrics_id_t metrics_histogram(const char* name);
+
+void metrics_add   (metrics_id_t counter,   uint64_t value);
+void metrics_set   (metrics_id_t gauge,     int64_t value);
+// Gauges shared by many instances (e.g. clients of the load generator) are changed, not set.
+void metrics_change(metrics_id_t gauge,     int64_t delta);
+void metrics_record(metrics_id_t histogram, uint64_t value);
+
+// Appends to the file, once a period passes (see metrics_update) & on close.
+bool metrics_open  (const char* path, uint32_t period_ms);
+void metrics_close ();
+// Main thread, once a frame. Does nothing if no file is open.
+void metrics_update();
@@ -0,0 +1,237 @@
+#include "path.h"
+
+#include <assert.h>
+#include <stdlib.h> // abs
+#include <string.h> // memmove
+
+#include "utils.h"
+#include "world.h"
+
+// TERRAIN CLASSES
+// ===============
+
+static const struct {
+	uint8_t t;
+	uint8_t c;
+} TERRAIN_CLASS[] = {
+	{ TERRAIN_DEFAULT,      TERRAIN_CLASS_DEFAULT },
+	{ TERRAIN_ROCK_WATER,   TERRAIN_CLASS_ROCK    },
+	{ TERRAIN_ROCK_SOLID,   TERRAIN_CLASS_ROCK    },
+	{ TERRAIN_ROCK,         TERRAIN_CLASS_ROCK    },
+	{ TERRAIN_ROCK_SAND,    TERRAIN_CLASS_ROCK    },
+	{ TERRAIN_WILD,         TERRAIN_CLASS_WILD    },
+	{ TERRAIN_GRASS,        TERRAIN_CLASS_GRASS   },
+	{ TERRAIN_EARTH,        TERRAIN_CLASS_EARTH   },
+	{ TERRAIN_CLAY,         TERRAIN_CLASS_CLAY    },
+	{ TERRAIN_SAND,         TERRAIN_CLASS_SAND    },
+	{ TERRAIN_WATER,        TERRAIN_CLASS_WATER   },
+	{ TERRAIN_WATER_BOTTOM, TERRAIN_CLASS_WATER   },
+	{ TERRAIN_WATER_DEEP,   TERRAIN_CLASS_WATER   },
+};
+
+typedef struct {
+	uint8_t c;
+	uint8_t price_matter;
+	uint8_t price_matter_penalty;
+} path_price_t;
+
+static const path_price_t
+TERRAIN_PRICE[] = {
+	{ TERRAIN_CLASS_DEFAULT, 1, 0 },
+	{ TERRAIN_CLASS_ROCK,    5, 0 },
+	{ TERRAIN_CLASS_WILD,    2, 0 },
+	{ TERRAIN_CLASS_GRASS,   1, 0 },
+	{ TERRAIN_CLASS_EARTH,   1, 0 },
+	{ TERRAIN_CLASS_CLAY,    1, 0 },
+	{ TERRAIN_CLASS_SAND,    4, 0 },
+	{ TERRAIN_CLASS_WATER,   1, 1 },
+};
+
+static path_price_t terrain_get_price(uint8_t class) {
+	for (size_t i = 0; i < ARRAY_SIZE(TERRAIN_PRICE); ++i) {
+		if (TERRAIN_PRICE[i].c == class) return TERRAIN_PRICE[i];
+	}
+	return TERRAIN_PRICE[0];
+}
+
+// HELPERS
+// =======
+
+static bool is_on_plane(int32_t tx, int32_t ty) {
+	return tx >= 0 && tx < WORLD_PLANE_SIZE &&
+	       ty >= 0 && ty < WORLD_PLANE_SIZE;
+}
+
+static bool are_neighbours(int32_t tx0, int32_t ty0, int32_t tx1, int32_t ty1) {
+	int32_t dx = abs(tx0 - tx1);
+	int32_t dy = abs(ty0 - ty1);
+	return is_on_plane(tx0, ty0) && is_on_plane(tx1, ty1) && ((dx + dy) == 1);
+}
+
+static bool are_diagonal_only_neighbours(int32_t tx0, int32_t ty0, int32_t tx1, int32_t ty1) {
+	int32_t dx = abs(tx0 - tx1);
+	int32_t dy = abs(ty0 - ty1);
+	return is_on_plane(tx0, ty0) && is_on_plane(tx1, ty1) && dx == 1 && dy == 1;
+}
+
+// STEPS
+// =====
+
+static bool path_reset_to(path_t* p, int32_t px, int32_t py, int32_t tx, int32_t ty) {
+	if (tx == px && ty == py) {
+		path_reset(p);
+		return true;
+	}
+
+	size_t i = 0;
+	while (i < p->num_steps) {
+		if (p->steps[i].tx == tx && p->steps[i].ty == ty) {
+			p->num_steps = i + 1;
+			return true;
+		}
+		++i;
+	}
+
+	return false;
+}
+
+static path_price_t path_get_price(const struct world_t* w, int32_t tx, int32_t ty) {
+	const uint8_t t = world_terrain(w, tx, ty);
+	const uint8_t c = path_terrain_class(t);
+	return terrain_get_price(c);
+}
+
+static void path_step_new(path_t* p, const struct world_t* w, int32_t px, int32_t py, int32_t tx, int32_t ty) {
+	const int32_t sx = p->num_steps > 0 ? p->steps[p->num_steps - 1].tx : px;
+	const int32_t sy = p->num_steps > 0 ? p->steps[p->num_steps - 1].ty : py;
+
+	const path_price_t previous = path_get_price(w, sx, sy);
+	const path_price_t current  = path_get_price(w, tx, ty);
+
+	path_step_info_t last_step;
+	if (p->num_steps > 0) {
+		last_step = p->steps_info[p->num_steps - 1];
+	} else {
+		last_step.class   = previous.c;
+		last_step.chain   = 0;
+		last_step.total   = 0;
+		last_step.is_hard = 0;
+	}
+
+	int8_t total = last_step.total;
+	uint8_t price = current.price_matter;
+	int8_t chain = 1;
+	bool is_hard = false;
+
+	if (current.price_matter_penalty > 0) {
+		chain = last_step.chain;
+		if (previous.c == current.c) {
+			price += current.price_matter_penalty * chain;
+			++chain;
+			is_hard = chain > 1;
+		}
+	}
+	total += price;
+
+	// TODO: Validation.
+
+	p->steps[p->num_steps].tx = tx;
+	p->steps[p->num_steps].ty = ty;
+
+	p->steps_info[p->num_steps].class   = current.c;
+	p->steps_info[p->num_steps].chain   = chain;
+	p->steps_info[p->num_steps].price   = price;
+	p->steps_info[p->num_steps].total   = total;
+	p->steps_info[p->num_steps].is_hard = is_hard;
+
+	++p->num_steps;
+}
+
+static void path_step(path_t* p, const struct world_t* w, int32_t px, int32_t py, int32_t tx, int32_t ty) {
+	if (!path_reset_to(p, px, py, tx, ty)) {
+		path_step_new(p, w, px, py, tx, ty);
+	}
+}
+
+static void path_step_diagonally(path_t* p, const struct world_t* w, int32_t px, int32_t py, int32_t tx0, int32_t ty0, int32_t tx1, int32_t ty1) {
+	assert(are_diagonal_only_neighbours(tx0, ty0, tx1, ty1));
+
+	const int32_t dx = tx1 - tx0;
+	// const int32_t dy = ty1 - ty0;
+
+	// Step 1
+	const int32_t through_tx = tx1 - dx;
+	const int32_t through_ty = ty1;
+
+	path_step(p, w, px, py, through_tx, through_ty);
+	path_step(p, w, px, py, tx1,        ty1);
+
+	// Step 2
+	/* const int32_t through_tx = tx1; */
+	/* const int32_t through_ty = ty1 - dy; */
+	// TODO:
+}
+
+// PUBLIC API
+// ==========
+
+uint8_t path_terrain_class(uint8_t terrain) {
+	for (size_t i = 0; i < ARRAY_SIZE(TERRAIN_CLASS); ++i) {
+		if (TERRAIN_CLASS[i].t == terrain) return TERRAIN_CLASS[i].c;
+	}
+	return TERRAIN_CLASS_DEFAULT;
+}
+
+void path_reset(path_t* p) {
+	assert(p);
+
+	p->num_steps = 0;
+}
+
+bool path_contains(const path_t* p, int32_t tx, int32_t ty) {
+	assert(p);
+
+	for (size_t i = 0; i < p->num_steps; ++i) {
+		if (p->steps[i].tx == tx && p->steps[i].ty == ty) return true;
+	}
+	return false;
+}
+
+void path_input(path_t* p, const struct world_t* w, int32_t px, int32_t py, int32_t tx, int32_t ty) {
+	assert(p);
+	assert(w);
+
+	const int32_t sx = p->num_steps > 0 ? p->steps[p->num_steps - 1].tx : px;
+	const int32_t sy = p->num_steps > 0 ? p->steps[p->num_steps - 1].ty : py;
+
+	if (are_diagonal_only_neighbours(sx, sy, tx, ty)) {
+		path_step_diagonally(p, w, px, py, sx, sy, tx, ty);
+	} else if (are_neighbours(sx, sy, tx, ty)) {
+		path_step(p, w, px, py, tx, ty);
+	} else {
+		path_reset_to(p, px, py, tx, ty);
+	}
+}
+
+void path_trim_walked(path_t* p, int32_t px, int32_t py) {
+	assert(p);
+
+	for (size_t i = 0; i < p->num_steps; ++i) {
+		if (p->steps[i].tx == px && p->steps[i].ty == py) {
+			const size_t n = p->num_steps - (i + 1);
+			memmove(p->steps,      p->steps      + i + 1, sizeof(p->steps[0])      * n);
+			memmove(p->steps_info, p->steps_info + i + 1, sizeof(p->steps_info[0]) * n);
+			p->num_steps = n;
+			return;
+		}
+	}
+}
+
+void path_costs(const path_t* p, uint8_t costs[PATH_MAX_LENGTH]) {
+	assert(p);
+	assert(costs);
+
+	for (size_t i = 0; i < p->num_steps; ++i) {
+		costs[i] = p->steps_info[i].price;
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "session.h"
+
+// Path the player draws on the travel map tile by tile, with matter prices of its steps.
+// Doesn't touch the session, the player position and the world are passed in.
+
+#define PATH_MAX_LENGTH SESSION_MAX_STEPS
+
+struct world_t;
+
+typedef struct {
+	uint8_t class;
+	uint8_t chain;
+	// Matter the step alone costs.
+	uint8_t price;
+	// Price of the path up to & including the step, for the labels, wraps past 127.
+	uint8_t total   : 7;
+	bool    is_hard : 1;
+} path_step_info_t;
+
+typedef struct {
+	size_t           num_steps;
+	path_step_info_t steps_info[PATH_MAX_LENGTH];
+	session_step_t   steps[PATH_MAX_LENGTH];
+} path_t;
+
+// world_terrain_class_t of a world_terrain_t.
+uint8_t path_terrain_class(uint8_t terrain);
+
+void path_reset   (path_t* p);
+bool path_contains(const path_t* p, int32_t tx, int32_t ty);
+// Extends the path to the tile the cursor is dragged over, or cuts it back when the tile is already on it.
+void path_input   (path_t* p, const struct world_t* w, int32_t px, int32_t py, int32_t tx, int32_t ty);
+// Player walks the path step by step, so walked ones go away.
+void path_trim_walked(path_t* p, int32_t px, int32_t py);
+// Matter per step, as session_move takes them.
+void path_costs   (const path_t* p, uint8_t costs[PATH_MAX_LENGTH]);
@@ -0,0 +1,167 @@
+#include "profile.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>    // memset
+#include <stdatomic.h>
+
+#include <tinycthread.h> // _Thread_local
+
+#include "allocator.h"
+#include "timer.h"
+#include "log.h"
+
+#define MAX_THREAD_NAME_LENGTH 32
+
+// Fields are relaxed atomics, plain moves, so a dump racing the thread reads torn events
+// at worst, and those are thrown away.
+typedef struct {
+	_Atomic(const char*) name;
+	_Atomic uint64_t     start_ns;
+	_Atomic uint64_t     duration_ns;
+} event_t;
+
+typedef struct {
+	const char* name;
+	uint64_t    start_ns;
+	uint64_t    duration_ns;
+} event_copy_t;
+
+// Written by its thread only, read by the dumping one, like a seqlock: the thread bumps
+// num_begun before it overwrites the oldest event & num_written once the new one is there.
+typedef struct {
+	event_t          events[PROFILE_RING_SIZE];
+	_Atomic uint64_t num_begun;
+	_Atomic uint64_t num_written;
+
+	char name[MAX_THREAD_NAME_LENGTH];
+} ring_t;
+
+static struct {
+	// Rings live till the end, threads that are gone still show up in dumps.
+	_Atomic(ring_t*) rings[PROFILE_MAX_THREADS];
+	_Atomic uint32_t num_rings;
+} s_ctx;
+
+static _Thread_local ring_t* s_ring;
+static _Thread_local bool    s_is_untracked;
+
+// Named before it's published, so dumps never read the name while it's written.
+static ring_t* thread_ring(const char* name) {
+	if (s_ring || s_is_untracked) return s_ring;
+
+	const uint32_t i = atomic_fetch_add(&s_ctx.num_rings, 1);
+	if (i >= PROFILE_MAX_THREADS) {
+		s_is_untracked = true;
+		log_error("[profile] Too many threads, one is not recorded");
+		return NULL;
+	}
+
+	ring_t* r = BR_ALLOC(allocator_main(), sizeof(ring_t));
+	memset(r, 0, sizeof(ring_t));
+	snprintf(r->name, MAX_THREAD_NAME_LENGTH, "%s", name ? name : "thread");
+	atomic_store(&s_ctx.rings[i], r);
+
+	s_ring = r;
+	return r;
+}
+
+// Complete events, in microseconds of the monotonic clock, viewers start the timeline at the first one.
+static void dump_ring(FILE* f, const ring_t* r, uint32_t tid, event_copy_t* copy, bool* is_first) {
+	const uint64_t end   = atomic_load_explicit(&r->num_written, memory_order_acquire);
+	const uint64_t begin = end > PROFILE_RING_SIZE ? end - PROFILE_RING_SIZE : 0;
+
+	for (uint64_t i = begin; i < end; ++i) {
+		const event_t* e = &r->events[i & (PROFILE_RING_SIZE - 1)];
+		copy[i - begin] = (event_copy_t) {
+			.name        = atomic_load_explicit(&e->name,        memory_order_relaxed),
+			.start_ns    = atomic_load_explicit(&e->start_ns,    memory_order_relaxed),
+			.duration_ns = atomic_load_explicit(&e->duration_ns, memory_order_relaxed),
+		};
+	}
+
+	// The thread went on meanwhile, the oldest ones could have been overwritten while copying.
+	atomic_thread_fence(memory_order_acquire);
+	const uint64_t begun = atomic_load_explicit(&r->num_begun, memory_order_relaxed);
+	const uint64_t valid = begun > PROFILE_RING_SIZE ? begun - PROFILE_RING_SIZE : 0;
+
+	for (uint64_t i = begin > valid ? begin : valid; i < end; ++i) {
+		const event_copy_t* e = &copy[i - begin];
+		fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+			*is_first ? "" : ",", e->name, tid, e->start_ns / 1000.0, e->duration_ns / 1000.0);
+		*is_first = false;
+	}
+}
+
+// PUBLIC API
+// ==========
+
+profile_scope_t profile_begin(const char* name) {
+	assert(name);
+
+	return (profile_scope_t) { .name = name, .start_ns = timer_current_ns() };
+}
+
+void profile_end(profile_scope_t* scope) {
+	assert(scope);
+
+	const uint64_t end = timer_current_ns();
+
+	ring_t* r = thread_ring(NULL);
+	if (!r) return;
+
+	const uint64_t n = atomic_load_explicit(&r->num_written, memory_order_relaxed);
+	atomic_store_explicit(&r->num_begun, n + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	event_t* e = &r->events[n & (PROFILE_RING_SIZE - 1)];
+	atomic_store_explicit(&e->name,        scope->name,           memory_order_relaxed);
+	atomic_store_explicit(&e->start_ns,    scope->start_ns,       memory_order_relaxed);
+	atomic_store_explicit(&e->duration_ns, end - scope->start_ns, memory_order_relaxed);
+
+	atomic_store_explicit(&r->num_written, n + 1, memory_order_release);
+}
+
+void profile_thread_name(const char* name) {
+	assert(name);
+
+	thread_ring(name);
+}
+
+bool profile_dump(const char* path) {
+	assert(path);
+
+	FILE* f = fopen(path, "w");
+	if (!f) {
+		log_error("[profile] Failed to create %s", path);
+		return false;
+	}
+
+	allocator_t*   alloc     = allocator_main();
+	event_copy_t*  copy      = BR_ALLOC(alloc, sizeof(event_copy_t) * PROFILE_RING_SIZE);
+	const uint32_t num_rings = atomic_load(&s_ctx.num_rings);
+	bool           is_first  = true;
+
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+	for (uint32_t i = 0; i < num_rings && i < PROFILE_MAX_THREADS; ++i) {
+		const ring_t* r = atomic_load(&s_ctx.rings[i]);
+		if (!r) continue;
+
+		const uint32_t tid = i + 1;
+		fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+			is_first ? "" : ",", tid, r->name);
+		is_first = false;
+
+		dump_ring(f, r, tid, copy, &is_first);
+	}
+
+	fprintf(f, "\n]}\n");
+
+	BR_FREE(alloc, copy);
+	const bool is_written = !ferror(f);
+	fclose(f);
+
+	log_info("[profile] Dumped %u threads to %s", num_rings < PROFILE_MAX_THREADS ? num_rings : PROFILE_MAX_THREADS, path);
+	return is_written;
+}
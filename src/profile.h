@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Scoped CPU profiler. Every thread writes the scopes it leaves into its own ring, no locks,
+// the oldest ones are overwritten, so the last couple of seconds are always there to be
+// dumped as a Chrome trace (chrome://tracing, ui.perfetto.dev).
+//
+// Compiled in with BR_PROFILE only, the macros are empty otherwise. Debug builds define it,
+// release ones when generated with `premake5 --profile gmake`:
+//
+//     void world_update(struct world_t* w, float dt) {
+//         PROFILE_SCOPE("world_update");
+//         ...
+//     }
+//
+// Names must be string literals, or live as long as the program. Scopes are closed by
+// the compiler (cleanup attribute), returns & breaks included.
+
+// Threads past it are not recorded.
+#define PROFILE_MAX_THREADS 8
+// Scopes a thread keeps, power of 2.
+#define PROFILE_RING_SIZE   (1 << 14)
+
+typedef struct {
+	const char* name;
+	uint64_t    start_ns;
+} profile_scope_t;
+
+profile_scope_t profile_begin(const char* name);
+void            profile_end  (profile_scope_t* scope);
+
+// Shows up in the trace instead of the thread id, copied. Has to come before the first scope of the thread.
+void profile_thread_name(const char* name);
+
+// Any thread can dump, scopes being written meanwhile are left out. False if the file can't be written.
+bool profile_dump(const char* path);
+
+#ifdef BR_PROFILE
+	#define PROFILE_CONCAT_(a, b) a##b
+	#define PROFILE_CONCAT(a, b)  PROFILE_CONCAT_(a, b)
+
+	#define PROFILE_SCOPE(name) \
+		profile_scope_t PROFILE_CONCAT(profile_scope_, __LINE__) __attribute__((cleanup(profile_end))) = profile_begin(name)
+	#define PROFILE_THREAD(name) profile_thread_name(name)
+#else
+	#define PROFILE_SCOPE(name)
+	#define PROFILE_THREAD(name)
+#endif
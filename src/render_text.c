@@ -4,17 +4,14 @@
 #include <stdbool.h>
 #include <assert.h>
 
-#include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
-#define FONS_STATIC
-#define FONTSTASH_IMPLEMENTATION
 #include <fontstash.h>
 
 #include "render.h"
+#include "render_text_layout.h"
 
 #define MAX_FONTS 4
-#define MAX_VERTICES FONS_VERTEX_COUNT
+#define MAX_VERTICES RENDER_TEXT_MAX_VERTICES
 
 static struct {
 	FONScontext* fons;
@@ -97,16 +94,9 @@ static void render(void* uptr, const float* verts, const float* tcoords, const u
 }
 
 void render_text_init() {
-	const size_t ATLAS_WIDTH  = 1024;
-	const size_t ATLAS_HEIGHT = 1024;
-
 	FONSparams params;
 	memset(&params, 0, sizeof(params));
 
-	params.width  = ATLAS_WIDTH;
-	params.height = ATLAS_HEIGHT;
-	params.flags  = FONS_ZERO_TOPLEFT;
-
 	params.renderCreate = create_texture;
 	params.renderResize = resize_texture;
 	params.renderUpdate = update_texture;
@@ -114,73 +104,18 @@ void render_text_init() {
 	params.renderDelete = delete_texture;
 	params.userPtr      = NULL;
 
-	s_ctx.fons = fonsCreateInternal(&params);
+	s_ctx.fons = render_text_layout_create(&params);
 	s_ctx.loaded_fonts[s_ctx.free++] = FONS_INVALID;
 }
 
 void render_text_shutdown() {
-	fonsDeleteInternal(s_ctx.fons);
+	render_text_layout_destroy(s_ctx.fons);
 }
 
 void render_load_font(const char* name, const char* path) {
-	FILE* fp = fopen(path, "rb");
-	if (!fp) return;
-
-	fseek(fp, 0, SEEK_END);
-	size_t size = ftell(fp);
-	fseek(fp, 0, SEEK_SET);
-
-	if (!size)
-	{
-		fclose(fp);
-		return;
-	}
-
-	uint8_t* data = (uint8_t*)malloc(size);
-	fread(data, 1, size, fp);
-	fclose(fp);
-
-	fonsAddFontMem(s_ctx.fons, name, data, (int)size, 1);
+	render_text_layout_load_font(s_ctx.fons, name, path);
 }
 
 void render_text(const char* text, float x, float y, const render_text_t* params) {
-	assert(text);
-	assert(params);
-	// TODO: Have a fallback font?
-	assert(params->font);
-
-	int f = fonsGetFontByName(s_ctx.fons, params->font);
-	assert(f != FONS_INVALID);
-
-	fonsClearState(s_ctx.fons);
-	fonsSetAlign(s_ctx.fons, FONS_ALIGN_CENTER | FONS_ALIGN_BASELINE);
-	fonsSetFont(s_ctx.fons,  f);
-
-	if (params->size_pt != 0.0f)    fonsSetSize   (s_ctx.fons, params->size_pt);
-	if (params->spacing_pt != 0.0f) fonsSetSpacing(s_ctx.fons, params->spacing_pt);
-	if (params->color != 0)         fonsSetColor  (s_ctx.fons, params->color);
-	if (params->align != 0)         fonsSetAlign  (s_ctx.fons, params->align);
-
-	if (params->bounds_w || params->bounds_h) {
-		float bounds[4];
-		fonsTextBounds(s_ctx.fons, 0.0f, 0.0f, text, NULL, bounds);
-
-		const int minx = bounds[0];
-		const int miny = bounds[1];
-		const int maxx = bounds[2];
-		const int maxy = bounds[3];
-
-		if (params->bounds_w) *params->bounds_w = maxx - minx;
-		if (params->bounds_h) *params->bounds_h = maxy - miny;
-	}
-
-	if (params->shadow) {
-		fonsPushState(s_ctx.fons);
-		fonsSetBlur(s_ctx.fons,  0);
-		fonsSetColor(s_ctx.fons, 0xFF000000);
-		fonsDrawText(s_ctx.fons, x + 2.0f, y + 2.0f, text, NULL);
-		fonsPopState(s_ctx.fons);
-	}
-
-	fonsDrawText(s_ctx.fons, x, y, text, NULL);
+	render_text_layout(s_ctx.fons, text, x, y, params);
 }
@@ -0,0 +1,97 @@
+#include "render_text_layout.h"
+
+#include <stdint.h>
+#include <assert.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#define FONS_VERTEX_COUNT RENDER_TEXT_MAX_VERTICES
+#define FONTSTASH_IMPLEMENTATION
+#include <fontstash.h>
+
+#define ATLAS_WIDTH  1024
+#define ATLAS_HEIGHT 1024
+
+struct FONScontext* render_text_layout_create(struct FONSparams* params) {
+	assert(params);
+
+	params->width  = ATLAS_WIDTH;
+	params->height = ATLAS_HEIGHT;
+	params->flags  = FONS_ZERO_TOPLEFT;
+
+	return fonsCreateInternal(params);
+}
+
+void render_text_layout_destroy(struct FONScontext* fons) {
+	fonsDeleteInternal(fons);
+}
+
+bool render_text_layout_load_font(struct FONScontext* fons, const char* name, const char* path) {
+	assert(fons);
+	assert(name);
+	assert(path);
+
+	FILE* fp = fopen(path, "rb");
+	if (!fp) return false;
+
+	fseek(fp, 0, SEEK_END);
+	size_t size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	if (!size)
+	{
+		fclose(fp);
+		return false;
+	}
+
+	// Fontstash owns it from now on and frees it with the context.
+	uint8_t* data = (uint8_t*)malloc(size);
+	fread(data, 1, size, fp);
+	fclose(fp);
+
+	return fonsAddFontMem(fons, name, data, (int)size, 1) != FONS_INVALID;
+}
+
+void render_text_layout(struct FONScontext* fons, const char* text, float x, float y, const render_text_t* params) {
+	assert(fons);
+	assert(text);
+	assert(params);
+	// TODO: Have a fallback font?
+	assert(params->font);
+
+	int f = fonsGetFontByName(fons, params->font);
+	assert(f != FONS_INVALID);
+
+	fonsClearState(fons);
+	fonsSetAlign(fons, FONS_ALIGN_CENTER | FONS_ALIGN_BASELINE);
+	fonsSetFont(fons,  f);
+
+	if (params->size_pt != 0.0f)    fonsSetSize   (fons, params->size_pt);
+	if (params->spacing_pt != 0.0f) fonsSetSpacing(fons, params->spacing_pt);
+	if (params->color != 0)         fonsSetColor  (fons, params->color);
+	if (params->align != 0)         fonsSetAlign  (fons, params->align);
+
+	if (params->bounds_w || params->bounds_h) {
+		float bounds[4];
+		fonsTextBounds(fons, 0.0f, 0.0f, text, NULL, bounds);
+
+		const int minx = bounds[0];
+		const int miny = bounds[1];
+		const int maxx = bounds[2];
+		const int maxy = bounds[3];
+
+		if (params->bounds_w) *params->bounds_w = maxx - minx;
+		if (params->bounds_h) *params->bounds_h = maxy - miny;
+	}
+
+	if (params->shadow) {
+		fonsPushState(fons);
+		fonsSetBlur(fons,  0);
+		fonsSetColor(fons, 0xFF000000);
+		fonsDrawText(fons, x + 2.0f, y + 2.0f, text, NULL);
+		fonsPopState(fons);
+	}
+
+	fonsDrawText(fons, x, y, text, NULL);
+}
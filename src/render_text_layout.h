@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "render_text.h"
+
+// Fontstash side of render_text: the atlas, fonts and glyph layout, no GPU involved.
+// Glyphs are rasterized into the atlas and quads handed over to the render callbacks,
+// render_text.c turns them into textures & draws, the benchmark runs without any.
+
+// Most vertices a render callback is handed at once.
+#define RENDER_TEXT_MAX_VERTICES 1024
+
+struct FONScontext;
+struct FONSparams;
+
+// Atlas the game's text is rendered with, the callbacks come with the params.
+struct FONScontext* render_text_layout_create(struct FONSparams* params);
+void                render_text_layout_destroy(struct FONScontext* fons);
+
+// False if the font can't be read.
+bool render_text_layout_load_font(struct FONScontext* fons, const char* name, const char* path);
+void render_text_layout(struct FONScontext* fons, const char* text, float x, float y, const render_text_t* params);
@@ -1,17 +1,46 @@
 #include "session.h"
 
 #include <assert.h>
-#include <string.h> // strncpy
+#include <string.h> // strncpy, strncmp, memcpy
 #include <math.h>   // floor
 #include <stdlib.h> // rand
 
 #include "utils.h"
 #include "log.h"
+#include "allocator.h"
 #include "client.h"
 #include "api.h"
 #include "world.h"
+#include "profile.h"
 
-#define AUTO_UPDATE_INTERVALS_MS 5000.0f
+// State is polled often while something is going on and backs off while the player is idle.
+#define STATE_POLL_MIN_MS   1000.0f
+#define STATE_POLL_MAX_MS   30000.0f
+#define STATE_POLL_BACKOFF  2.0f
+
+#define RESOURCE_SEGMENTS 12
+
+#define WALK_STEP_MS 250.0f
+// Shared by all planes, 16x16 tiles each, two whole planes worth.
+#define WORLD_BLOCKS_BUDGET 512
+
+typedef struct {
+	session_step_t steps[SESSION_MAX_STEPS];
+	size_t         num_steps;
+	size_t         num_walked;
+	// Time spent in the current step.
+	float          t;
+
+	// Where to roll back to.
+	int32_t  start_x, start_y;
+	// Matter to pay, not yet seen in the server state.
+	uint16_t cost;
+
+	bool     is_confirmed;
+	// First state poll with the move applied on the server.
+	uint32_t sync_poll;
+	bool     is_synced;
+} walk_t;
 
 typedef enum {
 	STATUS_NA = 0,
@@ -21,12 +50,35 @@ typedef enum {
 	STATUS_AWAITING_LOGOUT
 } status_t;
 
-static struct {
+typedef struct session_ctx_t {
+	// Time left till the next state poll.
 	float t;
+	float    poll_interval;
+	bool     is_polling;
+	uint32_t num_polls;
+	uint32_t num_polls_done;
+
+	walk_t walk;
+
+	// Local clock in milliseconds and its offset to the server one in seconds.
+	double clock;
+	double server_offset;
+
+	// As the server sent them, player's ones are simulated up to now.
+	resource_t mind_base;
+	resource_t matter_base;
 
 	session_t current;
 	uint8_t   status;
-} s_ctx;
+
+	// Own ones, NULL for the built-in ones.
+	client_ctx_t* client;
+	world_ctx_t*  world;
+} session_ctx_t;
+
+// Bound one, the app never binds anything but the built-in one.
+static session_ctx_t  s_default;
+static session_ctx_t* s_ctx = &s_default;
 
 static inline uint8_t randi(uint8_t max) {
 	return floor(((float)rand() / RAND_MAX) * max);
@@ -45,31 +97,261 @@ static void handle_state_resource(const api_state_resource_t* r, resource_t* out
 	out->segment_time    = r->segment_time;
 }
 
+static uint64_t server_time() {
+	return s_ctx->clock / 1000.0 + s_ctx->server_offset;
+}
+
+// Local simulation went another way than the server, e.g. a booster kicked in.
+static bool is_resource_drifted(const resource_t* base, const api_state_resource_t* r, uint64_t timestamp) {
+	assert(base);
+	assert(r);
+
+	resource_t predicted;
+	resource_simulate(base, timestamp, &predicted);
+
+	return predicted.value           != r->value
+	    || predicted.max             != r->max
+	    || predicted.filled_segments != r->filled_segments;
+}
+
+// Regeneration is simulated locally, so it doesn't count as a change.
+static bool is_state_changed(const api_state_t* s) {
+	assert(s);
+
+	const api_state_player_t* p = &s->player;
+	const bool is_drifted = is_resource_drifted(&s_ctx->mind_base,   &p->mind,   s->timestamp)
+	                     || is_resource_drifted(&s_ctx->matter_base, &p->matter, s->timestamp);
+
+	if (is_drifted) log_info("[session] Resources drifted, resyncing");
+
+	return is_drifted
+	    || p->x     != s_ctx->current.player.x
+	    || p->y     != s_ctx->current.player.y
+	    || p->level != s_ctx->current.player.level
+	    || p->exp   != s_ctx->current.player.exp;
+}
+
+static void poll_schedule(bool is_changed) {
+	const float interval = is_changed ? STATE_POLL_MIN_MS : s_ctx->poll_interval * STATE_POLL_BACKOFF;
+
+	s_ctx->poll_interval = CLAMP(interval, STATE_POLL_MIN_MS, STATE_POLL_MAX_MS);
+	s_ctx->t             = s_ctx->poll_interval;
+}
+
+// Player did something, state is about to change.
+static void poll_soon() {
+	s_ctx->poll_interval = STATE_POLL_MIN_MS;
+	s_ctx->t             = MIN(s_ctx->t, STATE_POLL_MIN_MS);
+}
+
+static void poll_state() {
+	s_ctx->is_polling = true;
+	++s_ctx->num_polls;
+	client_state();
+}
+
+// WALK PREDICTION
+// ===============
+
+static bool walk_is_active() {
+	return s_ctx->walk.num_steps > 0;
+}
+
+static void walk_end() {
+	s_ctx->walk.num_steps = 0;
+	s_ctx->walk.cost      = 0;
+}
+
+static void walk_rollback() {
+	log_error("[session] Move was rejected, rolling back");
+
+	s_ctx->current.player.x = s_ctx->walk.start_x;
+	s_ctx->current.player.y = s_ctx->walk.start_y;
+	walk_end();
+}
+
+static void handle_move(uint16_t code) {
+	if (!walk_is_active() || s_ctx->walk.is_confirmed) {
+		log_error("[session] Got unexpected 'move' message");
+		return;
+	}
+
+	if (code != 200) {
+		walk_rollback();
+		poll_soon();
+		return;
+	}
+
+	s_ctx->walk.is_confirmed = true;
+	// The one in flight might have been answered before the move.
+	s_ctx->walk.sync_poll    = s_ctx->num_polls + 1;
+	poll_soon();
+}
+
+// Called after a state poll (200 or 304), which is the truth unless the walk still runs.
+static void walk_sync() {
+	walk_t* w = &s_ctx->walk;
+
+	if (!walk_is_active()) return;
+
+	if (w->is_confirmed && s_ctx->num_polls_done >= w->sync_poll) {
+		w->is_synced = true;
+		w->cost      = 0;
+	}
+}
+
+static void walk_update(float dt) {
+	walk_t* w = &s_ctx->walk;
+
+	if (!walk_is_active()) return;
+
+	w->t += dt;
+	while (w->t >= WALK_STEP_MS && w->num_walked < w->num_steps) {
+		w->t -= WALK_STEP_MS;
+		++w->num_walked;
+	}
+
+	// Server has the final say once the walk is over.
+	if (w->num_walked == w->num_steps && w->is_synced) {
+		walk_end();
+		return;
+	}
+
+	const session_step_t* step = w->num_walked > 0 ? &w->steps[w->num_walked - 1] : NULL;
+	s_ctx->current.player.x = step ? step->tx : w->start_x;
+	s_ctx->current.player.y = step ? step->ty : w->start_y;
+
+	resource_t* matter = &s_ctx->current.player.matter;
+	matter->value = matter->value > w->cost ? matter->value - w->cost : 0;
+}
+
 static void handle_state(const api_state_t* s) {
 	assert(s);
 
 	const size_t n = MIN(MAX_API_STRING_LENGTH, MAX_SESSION_STRING_LENGTH);
-	strncpy(s_ctx.current.player.username, s->player.username, n - 1);
-	s_ctx.current.player.username[n - 1] = 0;
-
-	s_ctx.current.player.x      = s->player.x;
-	s_ctx.current.player.y      = s->player.y;
-	s_ctx.current.player.level  = s->player.level;
-	s_ctx.current.player.exp    = s->player.exp;
-	s_ctx.current.player.avatar = s->player.avatar;
+	strncpy(s_ctx->current.player.username, s->player.username, n - 1);
+	s_ctx->current.player.username[n - 1] = 0;
+
+	s_ctx->current.player.x      = s->player.x;
+	s_ctx->current.player.y      = s->player.y;
+	s_ctx->current.player.level  = s->player.level;
+	s_ctx->current.player.exp    = s->player.exp;
+	s_ctx->current.player.avatar = s->player.avatar;
 	
-	handle_state_resource(&s->player.mind,   &s_ctx.current.player.mind);
-	handle_state_resource(&s->player.matter, &s_ctx.current.player.matter);
+	handle_state_resource(&s->player.mind,   &s_ctx->mind_base);
+	handle_state_resource(&s->player.matter, &s_ctx->matter_base);
+
+	s_ctx->server_offset = s->timestamp - s_ctx->clock / 1000.0;
+	s_ctx->current.player.mind   = s_ctx->mind_base;
+	s_ctx->current.player.matter = s_ctx->matter_base;
+
+	struct world_t* w = s_ctx->current.world;
+	if (!w || strncmp(world_plane_id(w), s->player.plane_id, WORLD_MAX_PLANE_ID_LENGTH - 1) != 0) {
+		log_info("[session] Switching to plane \"%s\"", s->player.plane_id);
+		// Blocks of the plane left behind are not worth the slots anymore.
+		if (w) client_cancel_maps(world_plane_id(w));
+		s_ctx->current.world = world_for_plane(s->player.plane_id);
+		world_activate(s_ctx->current.world);
+	}
+}
+
+static void handle_reveal(const api_reveal_t* r, uint16_t code) {
+	assert(r);
+
+	struct world_t* w = s_ctx->current.world;
+
+	if (code != 200) {
+		log_error("[session] Failed to reveal %d, %d (%u)", r->x, r->y, code);
+		world_reveal_rollback(w, r->x, r->y);
+		return;
+	}
+
+	if (r->has_terrain) {
+		_Alignas(api_map_t) uint8_t buffer[sizeof(api_map_t) + sizeof(api_map_terrain_t)];
+
+		api_map_t* patch = (api_map_t*)buffer;
+		patch->x       = r->x;
+		patch->y       = r->y;
+		patch->size    = 1;
+		patch->data[0] = r->terrain;
+
+		world_update_data(w, patch);
+	} else {
+		// Nothing to patch with, so ask just for this tile instead of the whole block.
+		client_map(world_plane_id(w), r->x, r->y, 1);
+	}
 }
 
 // PUBLIC API
 // ==========
 
+void resource_simulate(const resource_t* base, uint64_t server_time, resource_t* out) {
+	assert(base);
+	assert(out);
+
+	*out = *base;
+
+	if (server_time <= base->last_update) return;
+
+	const uint64_t elapsed = server_time - base->last_update;
+
+	out->last_update  = server_time;
+	// TODO: Booster effect on the regeneration is unknown yet, it is only counted down.
+	out->booster_time = base->booster_time > elapsed ? base->booster_time - elapsed : 0;
+
+	if (base->value >= base->max || base->regen_rate == 0) return;
+
+	// A segment fills every regen_rate seconds, all of them filled turn into a point.
+	const uint64_t per_value = (uint64_t)RESOURCE_SEGMENTS * base->regen_rate;
+	const uint64_t progress  = (uint64_t)base->filled_segments * base->regen_rate + base->segment_time + elapsed;
+	const uint64_t gained    = progress / per_value;
+
+	if (base->value + gained >= base->max) {
+		out->value           = base->max;
+		out->filled_segments = 0;
+		out->segment_time    = 0;
+		return;
+	}
+
+	const uint64_t rest = progress % per_value;
+	out->value           = base->value + gained;
+	out->filled_segments = rest / base->regen_rate;
+	out->segment_time    = rest % base->regen_rate;
+}
+
+session_ctx_t* session_ctx_create(struct allocator_t* alloc) {
+	assert(alloc);
+
+	session_ctx_t* c = BR_ALLOC(alloc, sizeof(session_ctx_t));
+	memset(c, 0, sizeof(session_ctx_t));
+	c->client = client_ctx_create(alloc);
+	c->world  = world_ctx_create(alloc);
+	return c;
+}
+
+void session_ctx_destroy(struct allocator_t* alloc, session_ctx_t* c) {
+	assert(alloc);
+	assert(c);
+	assert(c != s_ctx);
+
+	client_ctx_destroy(alloc, c->client);
+	world_ctx_destroy(alloc, c->world);
+	BR_FREE(alloc, c);
+}
+
+void session_bind(session_ctx_t* c) {
+	s_ctx = c ? c : &s_default;
+	client_bind(s_ctx->client);
+	world_bind(s_ctx->world);
+}
+
 void session_init(struct allocator_t* alloc) {
-	s_ctx.current.world = world_create(alloc);
+	world_init(alloc, WORLD_BLOCKS_BUDGET);
 }
 
 void session_update(float dt) {
+	PROFILE_SCOPE("session_update");
+
 	message_t* msg;
 	while (client_messages_peek(&msg)) {
 		switch (msg->type) {
@@ -77,40 +359,84 @@ void session_update(float dt) {
 				break;
 
 			case MESSAGE_TYPE_LOGIN:
-				if (s_ctx.status == STATUS_AWAITING_LOGIN) {
-					s_ctx.status = STATUS_AWAITING_STATE;
-					client_state();
+				if (s_ctx->status == STATUS_AWAITING_LOGIN) {
+					s_ctx->status = STATUS_AWAITING_STATE;
+					poll_state();
 				} else {
 					log_error("[session] Got unexpected 'login' message");
 				}
 				break;
 
 			case MESSAGE_TYPE_LOGOUT:
-				if (s_ctx.status == STATUS_AWAITING_LOGOUT) {
-					s_ctx.status = STATUS_NA;
+				if (s_ctx->status == STATUS_AWAITING_LOGOUT) {
+					s_ctx->status = STATUS_NA;
 				} else {
 					log_error("[session] Got unexpected 'logout' message");
 				}
 				break;
 
 			case MESSAGE_TYPE_STATE: {
-				if (s_ctx.status == STATUS_AWAITING_STATE) s_ctx.status = STATUS_ACTIVE;
-				handle_state((api_state_t*)msg->data);
+				s_ctx->is_polling = false;
+				++s_ctx->num_polls_done;
+
+				// Not modified, nothing to parse or apply. The state applied last is current though,
+				// so it settles a walk as well, its 200 might have come before the sync poll.
+				if (msg->code == 304) {
+					walk_sync();
+					poll_schedule(false);
+					break;
+				}
+
+				if (msg->code != 200) {
+					log_error("[session] Failed to get state (%u)", msg->code);
+					poll_schedule(false);
+					break;
+				}
+
+				const api_state_t* state = (api_state_t*)msg->data;
+				const bool is_changed = s_ctx->status != STATUS_ACTIVE || is_state_changed(state);
+
+				if (s_ctx->status == STATUS_AWAITING_STATE) s_ctx->status = STATUS_ACTIVE;
+				handle_state(state);
+				walk_sync();
+				poll_schedule(is_changed);
 				break;
 			}
 
+			case MESSAGE_TYPE_MOVE:
+				if (s_ctx->status == STATUS_ACTIVE) {
+					handle_move(msg->code);
+				} else {
+					log_error("[session] Got unexpected 'move' message");
+				}
+				break;
+
 			case MESSAGE_TYPE_MAP: {
-				if (s_ctx.status == STATUS_ACTIVE) {
-					api_map_t* m = (api_map_t*)msg->data;
-					world_update_data(s_ctx.current.world, m);
+				if (s_ctx->status == STATUS_ACTIVE) {
+					// Might be a late one for a plane the player has already left, still worth keeping.
+					api_map_t*      m = (api_map_t*)msg->data;
+					struct world_t* w = world_for_plane(m->plane_id);
+					if (msg->code == 200) {
+						world_update_data(w, m);
+					} else if (msg->code == 304) {
+						world_update_unchanged(w, m);
+					} else {
+						log_error("[session] Failed to fetch map %d, %d (%u)", m->x, m->y, msg->code);
+						world_update_failed(w, m);
+					}
 				} else {
 					log_error("[session] Got unexpected 'map' message");
 				}
 				break;
 			}
 
-			/* case MESSAGE_TYPE_REVEAL: */
-			/* 	break; */
+			case MESSAGE_TYPE_REVEAL:
+				if (s_ctx->status == STATUS_ACTIVE) {
+					handle_reveal((api_reveal_t*)msg->data, msg->code);
+				} else {
+					log_error("[session] Got unexpected 'reveal' message");
+				}
+				break;
 
 			default: log_fatal("[session] Got an unknown message!");
 		}
@@ -118,45 +444,97 @@ void session_update(float dt) {
 		client_messages_consume();
 	}
 
-	if (s_ctx.status == STATUS_ACTIVE) {
-		s_ctx.t -= dt;
-		if (s_ctx.t < 0.0f) {
-			s_ctx.t = AUTO_UPDATE_INTERVALS_MS;
-			client_state();
-		}
+	// Next poll is scheduled once the current one is answered.
+	const bool is_logged_in = s_ctx->status == STATUS_ACTIVE || s_ctx->status == STATUS_AWAITING_STATE;
+	if (is_logged_in && !s_ctx->is_polling) {
+		s_ctx->t -= dt;
+		if (s_ctx->t < 0.0f) poll_state();
+	}
 
-		if (s_ctx.current.world) world_update(s_ctx.current.world, dt);
+	s_ctx->clock += dt;
+
+	if (s_ctx->status == STATUS_ACTIVE) {
+		const uint64_t now = server_time();
+		resource_simulate(&s_ctx->mind_base,   now, &s_ctx->current.player.mind);
+		resource_simulate(&s_ctx->matter_base, now, &s_ctx->current.player.matter);
+
+		walk_update(dt);
+	}
+
+	if (s_ctx->status == STATUS_ACTIVE && s_ctx->current.world) {
+		world_update(s_ctx->current.world, dt);
 	}
 }
 
 void session_shutdown() {
-	if (s_ctx.current.world) world_free(s_ctx.current.world);
+	s_ctx->current.world = NULL;
+	world_shutdown();
 }
 
 const session_t* session_current() {
-	return s_ctx.status == STATUS_ACTIVE ? &s_ctx.current : NULL;
+	return s_ctx->status == STATUS_ACTIVE ? &s_ctx->current : NULL;
 }
 
 void session_start(const char* username, const char* password) {
-	assert(s_ctx.status == STATUS_NA);
-	s_ctx.status = STATUS_AWAITING_LOGIN;
+	assert(s_ctx->status == STATUS_NA);
+	s_ctx->status = STATUS_AWAITING_LOGIN;
 	client_login(username, password);
 }
 
 void session_end() {
-	assert(s_ctx.status == STATUS_ACTIVE);
+	assert(s_ctx->status == STATUS_ACTIVE);
+	s_ctx->status = STATUS_AWAITING_LOGOUT;
 	client_logout();
 }
 
 void session_reveal(int32_t x, int32_t y) {
-	assert(s_ctx.status == STATUS_ACTIVE);
+	assert(s_ctx->status == STATUS_ACTIVE);
+
+	if (world_is_revealing(s_ctx->current.world, x, y)) return;
+
+	world_reveal_begin(s_ctx->current.world, x, y);
 	client_reveal(x, y);
+	poll_soon();
 }
 
-void session_move(const session_step_t* steps, size_t count) {
-	assert(s_ctx.status == STATUS_ACTIVE);
+bool session_move(const session_step_t* steps, const uint8_t* costs, size_t count) {
+	assert(s_ctx->status == STATUS_ACTIVE);
 	assert(steps);
-	assert(count > 0);
+	assert(count > 0 && count <= SESSION_MAX_STEPS);
+
+	if (walk_is_active()) {
+		log_error("[session] Already walking");
+		return false;
+	}
+
+	uint16_t cost = 0;
+	for (size_t i = 0; costs && i < count; ++i) {
+		cost += costs[i];
+	}
+
+	// Server rejects it anyway, no point predicting a walk only to roll it back.
+	const uint16_t matter = s_ctx->current.player.matter.value;
+	if (cost > matter) {
+		log_error("[session] Not enough matter to walk (%u, has %u)", cost, matter);
+		return false;
+	}
+
+	walk_t* w = &s_ctx->walk;
+	memcpy(w->steps, steps, sizeof(session_step_t) * count);
+	w->num_steps    = count;
+	w->num_walked   = 0;
+	w->t            = 0.0f;
+	w->start_x      = s_ctx->current.player.x;
+	w->start_y      = s_ctx->current.player.y;
+	w->is_confirmed = false;
+	w->is_synced    = false;
+	w->cost         = cost;
 
 	client_move(&steps[0].tx, count);
+	poll_soon();
+	return true;
+}
+
+bool session_is_walking() {
+	return walk_is_active();
 }
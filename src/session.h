@@ -24,6 +24,9 @@ typedef struct {
 	uint8_t segment_time;
 } resource_t;
 
+// Deterministically advances a resource to the given server time (in seconds), the way the server does it.
+void resource_simulate(const resource_t* base, uint64_t server_time, resource_t* out);
+
 #define MAX_SESSION_STRING_LENGTH 64
 
 typedef struct {
@@ -42,6 +45,16 @@ typedef struct {
 	struct world_t* world;
 } session_t;
 
+// Session lives in an instance with its own client & worlds, session_ calls work on the bound one.
+// App sticks to the built-in one, the load generator drives many of them in turn. Not thread-safe.
+typedef struct session_ctx_t session_ctx_t;
+
+session_ctx_t* session_ctx_create (struct allocator_t* alloc);
+// Must not be bound, shut down.
+void           session_ctx_destroy(struct allocator_t* alloc, session_ctx_t* c);
+// Binds its client & worlds too. NULL binds the built-in ones.
+void           session_bind       (session_ctx_t* c);
+
 void session_init(struct allocator_t* alloc);
 void session_update(float dt);
 void session_shutdown();
@@ -53,5 +66,12 @@ const session_t* session_current();
 void session_start(const char* username, const char* password);
 void session_end();
 void session_reveal(int32_t x, int32_t y);
+#define SESSION_MAX_STEPS 100
+
 typedef struct { int32_t tx; int32_t ty; } session_step_t;
-void session_move(const session_step_t* steps, size_t count);
+// Movement is predicted: player walks the path and pays for it right away, and is
+// rolled back if the server rejects it. Costs are matter per step, can be NULL.
+// False if it's refused right away: already walking or the player can't pay for it.
+bool session_move(const session_step_t* steps, const uint8_t* costs, size_t count);
+// True while a move is animated or not yet confirmed by the server.
+bool session_is_walking();
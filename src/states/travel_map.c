@@ -2,13 +2,14 @@
 
 #include <assert.h>
 #include <stdio.h>  // snprintf
-#include <stdlib.h> // abs
 
 #include "utils.h"
 #include "game.h"
 #include "world.h"
 #include "log.h"
+#include "profile.h"
 #include "session.h"
+#include "path.h"
 #include "imgui.h"
 #include "input.h"
 #include "render.h"
@@ -25,30 +26,19 @@ static const float  VIEW_SIZE        = VIEW_TILES * TILE;
 static const float  VIEW_OFFSET      = 0.5f * TILE;
 static const float  SCREEN_SIZE      = 8    * TILE;
 
-#define MAX_PATH_LENGTH 100
-
 typedef enum {
 	TRAVEL_MAP_DEFAULT = 0,
 	TRAVEL_MAP_DRAWING,
 	TRAVEL_MAP_WALKING
 } state_t;
 
-typedef struct {
-	uint8_t class;
-	uint8_t chain;
-	uint8_t total   : 7;
-	bool    is_hard : 1;
-} path_step_info_t;
-
 static struct {
 	float   map_x;
 	float   map_y;
 	int32_t tile_x;
 	int32_t tile_y;
 
-	size_t           num_steps;
-	path_step_info_t steps_info[MAX_PATH_LENGTH];
-	session_step_t   steps[MAX_PATH_LENGTH];
+	path_t path;
 
 	int32_t selector_x;
 	int32_t selector_y;
@@ -65,23 +55,6 @@ static bool is_in_rect(float x, float y, float w, float h, float px, float py) {
 	       py >= y && py < y + h;
 }
 
-static bool is_on_plane(int32_t tx, int32_t ty) {
-	return tx >= 0 && tx < WORLD_PLANE_SIZE &&
-	       ty >= 0 && ty < WORLD_PLANE_SIZE;
-}
-
-static bool are_neighbours(int32_t tx0, int32_t ty0, int32_t tx1, int32_t ty1) {
-	int32_t dx = abs(tx0 - tx1);
-	int32_t dy = abs(ty0 - ty1);
-	return is_on_plane(tx0, ty0) && is_on_plane(tx1, ty1) && ((dx + dy) == 1);
-}
-
-static bool are_diagonal_only_neighbours(int32_t tx0, int32_t ty0, int32_t tx1, int32_t ty1) {
-	int32_t dx = abs(tx0 - tx1);
-	int32_t dy = abs(ty0 - ty1);
-	return is_on_plane(tx0, ty0) && is_on_plane(tx1, ty1) && dx == 1 && dy == 1;
-}
-
 static bool is_tile_dragged(int32_t tx, int32_t ty) {
 	if (input_dragging(INPUT_BUTTON_LEFT)) {
 		const float ox = VIEW_OFFSET + s_ctx.map_x;
@@ -111,186 +84,15 @@ static bool state_can_draw() {
 static bool state_is_drawing() { return s_ctx.state == TRAVEL_MAP_DRAWING; }
 static bool state_is_walking() { return s_ctx.state == TRAVEL_MAP_WALKING; }
 
-// TERRAIN CLASSES
-// ===============
-
-static const struct {
-	uint8_t t;
-	uint8_t c;
-} TERRAIN_CLASS[] = {
-	{ TERRAIN_DEFAULT,      TERRAIN_CLASS_DEFAULT },
-	{ TERRAIN_ROCK_WATER,   TERRAIN_CLASS_ROCK    },
-	{ TERRAIN_ROCK_SOLID,   TERRAIN_CLASS_ROCK    },
-	{ TERRAIN_ROCK,         TERRAIN_CLASS_ROCK    },
-	{ TERRAIN_ROCK_SAND,    TERRAIN_CLASS_ROCK    },
-	{ TERRAIN_WILD,         TERRAIN_CLASS_WILD    },
-	{ TERRAIN_GRASS,        TERRAIN_CLASS_GRASS   },
-	{ TERRAIN_EARTH,        TERRAIN_CLASS_EARTH   },
-	{ TERRAIN_CLAY,         TERRAIN_CLASS_CLAY    },
-	{ TERRAIN_SAND,         TERRAIN_CLASS_SAND    },
-	{ TERRAIN_WATER,        TERRAIN_CLASS_WATER   },
-	{ TERRAIN_WATER_BOTTOM, TERRAIN_CLASS_WATER   },
-	{ TERRAIN_WATER_DEEP,   TERRAIN_CLASS_WATER   },
-};
-
-typedef struct {
-	uint8_t c;
-	uint8_t price_matter;
-	uint8_t price_matter_penalty;
-} path_price_t;
-
-static const path_price_t
-TERRAIN_PRICE[] = {
-	{ TERRAIN_CLASS_DEFAULT, 1, 0 },
-	{ TERRAIN_CLASS_ROCK,    5, 0 },
-	{ TERRAIN_CLASS_WILD,    2, 0 },
-	{ TERRAIN_CLASS_GRASS,   1, 0 },
-	{ TERRAIN_CLASS_EARTH,   1, 0 },
-	{ TERRAIN_CLASS_CLAY,    1, 0 },
-	{ TERRAIN_CLASS_SAND,    4, 0 },
-	{ TERRAIN_CLASS_WATER,   1, 1 },
-};
-
-static uint8_t terrain_get_class(uint8_t t) {
-	for (size_t i = 0; i < ARRAY_SIZE(TERRAIN_CLASS); ++i) {
-		if (TERRAIN_CLASS[i].t == t) return TERRAIN_CLASS[i].c;
-	}
-	return TERRAIN_CLASS_DEFAULT;
-}
-
-static path_price_t terrain_get_price(uint8_t class) {
-	for (size_t i = 0; i < ARRAY_SIZE(TERRAIN_PRICE); ++i) {
-		if (TERRAIN_PRICE[i].c == class) return TERRAIN_PRICE[i];
-	}
-	return TERRAIN_PRICE[0];
-}
-
 // PATH MANAGEMENT
 // ===============
 
-static bool path_contains(int32_t tx, int32_t ty) {
-	for (size_t i = 0; i < s_ctx.num_steps; ++i) {
-		if (s_ctx.steps[i].tx == tx && s_ctx.steps[i].ty == ty) return true;
-	}
-	return false;
-}
-
-static void path_reset() {
-	s_ctx.num_steps = 0;
-}
-
-static bool path_reset_to(int32_t tx, int32_t ty) {
-	const int32_t px = session_current()->player.x;
-	const int32_t py = session_current()->player.y;
-	if (tx == px && ty == py) {
-		path_reset();
-		return true;
-	}
+static void path_walk() {
+	uint8_t costs[PATH_MAX_LENGTH];
+	path_costs(&s_ctx.path, costs);
 
-	size_t i = 0;
-	while (i < s_ctx.num_steps) {
-		if (s_ctx.steps[i].tx == tx && s_ctx.steps[i].ty == ty) {
-			s_ctx.num_steps = i + 1;
-			return true;
-		}
-		++i;
-	}
-
-	return false;
-}
-
-static path_price_t path_get_price(int32_t tx, int32_t ty) {
-	const uint8_t t = world_terrain(session_current()->world, tx, ty);
-	const uint8_t c = terrain_get_class(t);
-	return terrain_get_price(c);
-}
-
-static void path_step_new(int32_t tx, int32_t ty) {
-	const int32_t px = session_current()->player.x;
-	const int32_t py = session_current()->player.y;
-	const int32_t sx = s_ctx.num_steps > 0 ? s_ctx.steps[s_ctx.num_steps - 1].tx : px;
-	const int32_t sy = s_ctx.num_steps > 0 ? s_ctx.steps[s_ctx.num_steps - 1].ty : py;
-
-	const path_price_t previous = path_get_price(sx, sy);
-	const path_price_t current  = path_get_price(tx, ty);
-
-	path_step_info_t last_step;
-	if (s_ctx.num_steps > 0) {
-		last_step = s_ctx.steps_info[s_ctx.num_steps - 1];
-	} else {
-		last_step.class   = previous.c;
-		last_step.chain   = 0;
-		last_step.total   = 0;
-		last_step.is_hard = 0;
-	}
-
-	int8_t total = last_step.total;
-	int8_t price = current.price_matter;
-	int8_t chain = 1;
-	bool is_hard = false;
-
-	if (current.price_matter_penalty > 0) {
-		chain = last_step.chain;
-		if (previous.c == current.c) {
-			price += current.price_matter_penalty * chain;
-			++chain;
-			is_hard = chain > 1;
-		}
-	}
-	total += price;
-
-	// TODO: Validation.
-
-	s_ctx.steps[s_ctx.num_steps].tx = tx;
-	s_ctx.steps[s_ctx.num_steps].ty = ty;
-
-	s_ctx.steps_info[s_ctx.num_steps].class   = current.c;
-	s_ctx.steps_info[s_ctx.num_steps].chain   = chain;
-	s_ctx.steps_info[s_ctx.num_steps].total   = total;
-	s_ctx.steps_info[s_ctx.num_steps].is_hard = is_hard;
-
-	++s_ctx.num_steps;
-}
-
-static void path_step(int32_t tx, int32_t ty) {
-	if (!path_reset_to(tx, ty)) {
-		path_step_new(tx, ty);
-	}
-}
-
-static void path_step_diagonally(int32_t tx0, int32_t ty0, int32_t tx1, int32_t ty1) {
-	assert(are_diagonal_only_neighbours(tx0, ty0, tx1, ty1));
-
-	const int32_t dx = tx1 - tx0;
-	// const int32_t dy = ty1 - ty0;
-
-	// Step 1
-	const int32_t through_tx = tx1 - dx;
-	const int32_t through_ty = ty1;
-
-	path_step(through_tx, through_ty);
-	path_step(tx1,        ty1);
-
-	// Step 2
-	/* const int32_t through_tx = tx1; */
-	/* const int32_t through_ty = ty1 - dy; */
-	// TODO:
-}
-
-static void path_input(int32_t tx, int32_t ty) {
-	const int32_t px = session_current()->player.x;
-	const int32_t py = session_current()->player.y;
-	
-	const int32_t sx = s_ctx.num_steps > 0 ? s_ctx.steps[s_ctx.num_steps - 1].tx : px;
-	const int32_t sy = s_ctx.num_steps > 0 ? s_ctx.steps[s_ctx.num_steps - 1].ty : py;
-
-	if (are_diagonal_only_neighbours(sx, sy, tx, ty)) {
-		path_step_diagonally(sx, sy, tx, ty);
-	} else if (are_neighbours(sx, sy, tx, ty)) {
-		path_step(tx, ty);
-	} else {
-		path_reset_to(tx, ty);
-	}
+	// Refused one leaves the path drawn, to be cut shorter.
+	if (session_move(s_ctx.path.steps, costs, s_ctx.path.num_steps)) s_ctx.state = TRAVEL_MAP_WALKING;
 }
 
 static bool path_can_start_from(int32_t tx, int32_t ty) {
@@ -300,7 +102,7 @@ static bool path_can_start_from(int32_t tx, int32_t ty) {
 		if (tx == px && ty == py) return true;
 	}
 
-	return path_contains(tx, ty);
+	return path_contains(&s_ctx.path, tx, ty);
 }
 
 // SCROLL MANAGEMENT
@@ -393,11 +195,12 @@ static void map_view_update() {
 	if (map_view_pick_tile(x, y, &tx, &ty)) {
 		// TODO: Handle clicks on future steps when walking.
 		if (!state_is_walking() && input_button_clicked(INPUT_BUTTON_LEFT)) {
-			if (path_contains(tx, ty)) {
+			if (path_contains(&s_ctx.path, tx, ty)) {
 				// TODO: Split.
 				log_info("[travel map] Walking to %d, %d", tx, ty);
-				session_move(s_ctx.steps, s_ctx.num_steps);
+				path_walk();
 			} else if (world_is_hidden(session_current()->world, tx, ty)) {
+				// Session ignores repeated clicks while the tile is being revealed.
 				session_reveal(tx, ty);
 			} else {
 				s_ctx.selector_x = tx;
@@ -412,7 +215,8 @@ static void map_view_update() {
 			if (!input_dragging(INPUT_BUTTON_LEFT)) {
 				s_ctx.state = TRAVEL_MAP_DEFAULT;
 			}
-			path_input(tx, ty);
+			const session_t* session = session_current();
+			path_input(&s_ctx.path, session->world, session->player.x, session->player.y, tx, ty);
 		} else {
 			if (input_dragging(INPUT_BUTTON_LEFT)) {
 				scroll_update();
@@ -463,6 +267,8 @@ static void render_incognitta_shade(size_t tx, size_t ty, float x, float y) {
 }
 
 static void map_view_render() {
+	PROFILE_SCOPE("map_view_render");
+
 	const render_text_t DEBUG_TEXT = {
 		.font    = "regular",
 		.size_pt = 16.0f,
@@ -491,6 +297,10 @@ static void map_view_render() {
 
 			if (is_hidden) {
 				render_tile(assets_sprites()->travel_map.atlas_tiled_warfog, x, y, &test_tile);
+				if (world_is_revealing(session_current()->world, tx, ty)) {
+					const color_t REVEALING_COLOR = render_color(0x00, 0xC8, 0xFF);
+					render_sprite_colored(assets_sprites()->travel_map.eye_mind, x + TILE * 0.25f, y + TILE * 0.25f, REVEALING_COLOR);
+				}
 			} else {
 				const uint8_t terrain = world_terrain(session_current()->world, tx, ty);
 				render_tile(lookup_terrain_sprite(terrain), x, y, &test_tile);
@@ -571,18 +381,23 @@ static void resource_indicator_render(const resource_t* res, const indicator_ren
 
 	const size_t NUM_SEGMENTS = 12;
 
-	render_sprite(sprites->regen[0], x, y);
+	// Session simulates regeneration between polls, so these are up to date every frame.
+	const size_t rate = MIN(res->regen_rate, ARRAY_SIZE(sprites->regen) - 1);
+	render_sprite(sprites->regen[rate], x, y);
 
 	y += 32.0f;
 	render_sprite(sprites->time, x, y);
 
+	const bool is_full = res->value >= res->max;
+
 	char buf[8];
-	snprintf(buf, 8, "%u", res->regen_rate);
+	snprintf(buf, 8, "%u", is_full ? 0 : res->regen_rate - res->segment_time);
 	render_text(buf, x + 16.0f, y + 16.0f, &sprites->text_params);
 
 	y += 32.0f;
 	for (size_t i = 0; i < NUM_SEGMENTS; ++i) {
-		render_sprite(sprites->segment_full, x, y);
+		const bool is_filled = is_full || i < res->filled_segments;
+		render_sprite(is_filled ? sprites->segment_full : sprites->segment_empty, x, y);
 		y += 32.0f;
 	}
 }
@@ -841,7 +656,7 @@ static void get_arrow(int32_t tx0, int32_t ty0, int32_t tx1, int32_t ty1, bool u
 	assert(out);
 
 	const uint8_t t = world_terrain(session_current()->world, tx1, ty1);
-	const uint8_t c = terrain_get_class(t);
+	const uint8_t c = path_terrain_class(t);
 	const size_t  a = get_arrow_index(tx0, ty0, tx1, ty1);
 
 	out->dx = ARROW_OFFSETS[a].dx;
@@ -873,7 +688,7 @@ static const struct sprite_t* get_path_point(int32_t tx, int32_t ty) {
 	};
 #undef POINT
 	const uint8_t t = world_terrain(session_current()->world, tx, ty);
-	const uint8_t c = terrain_get_class(t);
+	const uint8_t c = path_terrain_class(t);
 	for (size_t i = 0; i < ARRAY_SIZE(LOOKUP); ++i) {
 		if (LOOKUP[i].c == c) return LOOKUP[i].p;
 	}
@@ -892,7 +707,7 @@ static void path_render_arrow(int32_t tx0, int32_t ty0, int32_t tx1, int32_t ty1
 }
 
 static void path_render() {
-	if (s_ctx.num_steps == 0) return;
+	if (s_ctx.path.num_steps == 0) return;
 
 	const render_text_t TEXT = {
 		.font    = "regular",
@@ -906,23 +721,23 @@ static void path_render() {
 
 	const int32_t px = session_current()->player.x;
 	const int32_t py = session_current()->player.y;
-	path_render_arrow(px, py, s_ctx.steps[0].tx, s_ctx.steps[0].ty, false);
+	path_render_arrow(px, py, s_ctx.path.steps[0].tx, s_ctx.path.steps[0].ty, false);
 
-	for (size_t i = 0; i < s_ctx.num_steps; ++i) {
-		const int32_t tx0 = s_ctx.steps[i].tx;
-		const int32_t ty0 = s_ctx.steps[i].ty;
+	for (size_t i = 0; i < s_ctx.path.num_steps; ++i) {
+		const int32_t tx0 = s_ctx.path.steps[i].tx;
+		const int32_t ty0 = s_ctx.path.steps[i].ty;
 		const float   x   = ox + TILE * (tx0 - s_ctx.tile_x);
 		const float   y   = oy + TILE * (ty0 - s_ctx.tile_y);
 
-		if (i != s_ctx.num_steps - 1) {
-			const int32_t tx1  = s_ctx.steps[i + 1].tx;
-			const int32_t ty1  = s_ctx.steps[i + 1].ty;
-			const bool is_hard = s_ctx.steps_info[i + 1].is_hard;
+		if (i != s_ctx.path.num_steps - 1) {
+			const int32_t tx1  = s_ctx.path.steps[i + 1].tx;
+			const int32_t ty1  = s_ctx.path.steps[i + 1].ty;
+			const bool is_hard = s_ctx.path.steps_info[i + 1].is_hard;
 			path_render_arrow(tx0, ty0, tx1, ty1, is_hard);
 		}
 
 		char buf[64];
-		snprintf(buf, sizeof(buf), "%hhu", s_ctx.steps_info[i].total);
+		snprintf(buf, sizeof(buf), "%hhu", s_ctx.path.steps_info[i].total);
 		const struct sprite_t* p = get_path_point(tx0, ty0);
 		render_sprite(p, x + TILE * 0.25f, y + TILE * 0.25f);
 		render_text(buf, x + TILE * 0.5f,  y + TILE * 0.5f - 1.0f, &TEXT);
@@ -1077,6 +892,15 @@ void states_travel_map_update(uint16_t width, uint16_t height, float dt) {
 		s_ctx.has_selector = true;
 	}
 
+	// Walk is predicted by the session, path follows the player until it's confirmed or rolled back.
+	if (state_is_walking()) {
+		path_trim_walked(&s_ctx.path, session_current()->player.x, session_current()->player.y);
+		if (!session_is_walking()) {
+			path_reset(&s_ctx.path);
+			s_ctx.state = TRAVEL_MAP_DEFAULT;
+		}
+	}
+
 	map_view_update();
 }
 
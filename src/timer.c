@@ -3,19 +3,25 @@
 #if BR_PLATFORM_LINUX
 	#include <time.h> // clock_gettime
 #elif BR_PLATFORM_MACOS
-	// TODO:
+	#include <mach/mach_time.h>
 #else
 	#error "Not implemented yet."
 #endif
 
-double timer_current() {
+uint64_t timer_current_ns() {
 	#if BR_PLATFORM_LINUX
 		struct timespec t;
-		clock_gettime(CLOCK_REALTIME, &t);
-		return t.tv_sec * 1000.0 + t.tv_nsec / 1000000.0;
+		clock_gettime(CLOCK_MONOTONIC, &t);
+		return (uint64_t)t.tv_sec * 1000000000ull + t.tv_nsec;
 	#elif BR_PLATFORM_MACOS
-		return 0.0f; // TODO:
+		static mach_timebase_info_data_t timebase;
+		if (timebase.denom == 0) mach_timebase_info(&timebase);
+		return mach_absolute_time() * timebase.numer / timebase.denom;
 	#else
 		#error "Not implemented yet."
 	#endif
 }
+
+double timer_current() {
+	return timer_current_ns() / 1000000.0;
+}
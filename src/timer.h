@@ -1,3 +1,8 @@
 #pragma once
 
-double timer_current();
+#include <stdint.h>
+
+// Monotonic, from some fixed point in the past: only differences mean something.
+double   timer_current();
+// Same clock in nanoseconds, for what's finer than a millisecond (e.g. profile.h).
+uint64_t timer_current_ns();
@@ -5,45 +5,91 @@
 #include <string.h> // memset
 #include <math.h>	// floorf
 
+#include "utils.h"
+#include "log.h"
 #include "allocator.h"
 #include "api.h"
+#include "profile.h"
+#include "metrics.h"
 
 #include "client.h"
 
-// TODO: @optimize Store only up-to-date blocks as a hash-map over block coordinate.
-// Then, store and update a non-used-time-interval to release blocks - LRU.
-
 #define BLOCK_SIZE (1 << 4)
 /* #define BLOCK_SIZE (1 << 5) */
 #define NUM_BLOCKS (WORLD_PLANE_SIZE / BLOCK_SIZE)
+#define NO_BLOCK   UINT16_MAX
 
 #define BLOCK_LIFE_SPAN_SECONDS (30 * 1000.0f)
 
+#define MAX_PLANES 8
+
 typedef struct {
-	uint8_t type	  : 7;
-	bool	is_hidden : 1;
+	uint8_t type	     : 6;
+	// Reveal was requested, but the server has not answered yet.
+	bool	is_revealing : 1;
+	bool	is_hidden    : 1;
 } terrain_t;
 
 typedef struct {
 	terrain_t data[BLOCK_SIZE][BLOCK_SIZE];
 } block_t;
 
+// Bookkeeping for a block from the shared budget.
+typedef struct {
+	// NULL for a free one.
+	struct world_t* owner;
+	uint32_t        last_used;
+	uint16_t        next;
+	uint8_t         x, y;
+} block_slot_t;
+
 typedef enum {
 	BLOCK_STATE_NA = 0,
 	BLOCK_STATE_NEEDED,
 	BLOCK_STATE_REQUESTED,
-	BLOCK_STATE_PRESENT
+	BLOCK_STATE_PRESENT,
+	// Outlived its life span, still shown while it's checked with the server.
+	BLOCK_STATE_STALE,
+	BLOCK_STATE_REVALIDATING
 } block_state_t;
 
 typedef struct world_t {
-	struct allocator_t* alloc;
+	char     plane_id[WORLD_MAX_PLANE_ID_LENGTH];
+	bool     is_active;
+	// Tick it was last updated or activated at, the least recent one is dropped for a new plane.
+	uint32_t last_active;
 
-	// In seconds.
-	float	age[NUM_BLOCKS][NUM_BLOCKS];
-	block_t terrain[NUM_BLOCKS][NUM_BLOCKS];
-	uint8_t state[NUM_BLOCKS][NUM_BLOCKS];
+	// In milliseconds, as dt.
+	float	 age[NUM_BLOCKS][NUM_BLOCKS];
+	uint16_t block[NUM_BLOCKS][NUM_BLOCKS];
+	uint8_t  state[NUM_BLOCKS][NUM_BLOCKS];
 } world_t;
 
+typedef struct world_ctx_t {
+	struct allocator_t* alloc;
+
+	world_t* worlds[MAX_PLANES];
+	size_t   num_worlds;
+
+	// All worlds share one block budget.
+	block_t*      blocks;
+	block_slot_t* slots;
+	size_t        max_blocks;
+	uint16_t      free;
+	uint16_t      num_resident;
+	uint32_t      tick;
+} world_ctx_t;
+
+// Bound one, the app never binds anything but the built-in one.
+static world_ctx_t  s_default;
+static world_ctx_t* s_ctx = &s_default;
+
+// Shared, numbers of all the instances add up.
+static struct {
+	metrics_id_t blocks_resident;
+	metrics_id_t blocks_evicted;
+} s_metrics;
+
 typedef struct {
 	int8_t x;
 	int8_t y;
@@ -59,79 +105,424 @@ static block_index_t to_block_index(int32_t x, int32_t y) {
 	return (block_index_t) { .x = bx, .y = by, .rx = rx, .ry = ry };
 }
 
+static bool block_has_data(const struct world_t* w, block_index_t bi) {
+	assert(w);
+
+	const uint8_t state = w->state[bi.x][bi.y];
+	return state == BLOCK_STATE_PRESENT || state == BLOCK_STATE_STALE || state == BLOCK_STATE_REVALIDATING;
+}
+
 static void block_requested(struct world_t* w, block_index_t bi) {
 	assert(w);
 
 	if (w->state[bi.x][bi.y] == BLOCK_STATE_NA) w->state[bi.x][bi.y] = BLOCK_STATE_NEEDED;
 }
 
+// BLOCKS BUDGET
+// =============
+
+static void blocks_init(size_t max_blocks) {
+	assert(max_blocks > 0 && max_blocks < NO_BLOCK);
+
+	s_ctx->max_blocks = max_blocks;
+	s_ctx->blocks     = BR_ALLOC(s_ctx->alloc, sizeof(block_t)      * max_blocks);
+	s_ctx->slots      = BR_ALLOC(s_ctx->alloc, sizeof(block_slot_t) * max_blocks);
+
+	for (size_t i = 0; i < max_blocks; ++i) {
+		s_ctx->slots[i].owner = NULL;
+		s_ctx->slots[i].next  = i + 1 < max_blocks ? i + 1 : NO_BLOCK;
+	}
+	s_ctx->free = 0;
+}
+
+static void blocks_shutdown() {
+	metrics_change(s_metrics.blocks_resident, -(int64_t)s_ctx->num_resident);
+	s_ctx->num_resident = 0;
+
+	BR_FREE(s_ctx->alloc, s_ctx->blocks);
+	BR_FREE(s_ctx->alloc, s_ctx->slots);
+}
+
+static void blocks_release(uint16_t i) {
+	assert(i < s_ctx->max_blocks);
+
+	block_slot_t* slot = &s_ctx->slots[i];
+	world_t*      w    = slot->owner;
+	assert(w);
+
+	w->block[slot->x][slot->y] = NO_BLOCK;
+	// Requested one will get its storage back with the response, a revalidated one has nothing to keep.
+	const block_index_t bi = { .x = slot->x, .y = slot->y };
+	if (block_has_data(w, bi)) w->state[slot->x][slot->y] = BLOCK_STATE_NA;
+
+	slot->owner = NULL;
+	slot->next  = s_ctx->free;
+	s_ctx->free  = i;
+
+	--s_ctx->num_resident;
+	metrics_change(s_metrics.blocks_resident, -1);
+}
+
+// Inactive planes go first, then the least recently used block.
+static uint16_t blocks_pick_victim() {
+	uint16_t victim = NO_BLOCK;
+	for (size_t i = 0; i < s_ctx->max_blocks; ++i) {
+		const block_slot_t* slot = &s_ctx->slots[i];
+		if (!slot->owner) continue;
+
+		if (victim == NO_BLOCK) {
+			victim = i;
+			continue;
+		}
+
+		const block_slot_t* best = &s_ctx->slots[victim];
+		if (best->owner->is_active != slot->owner->is_active) {
+			if (best->owner->is_active) victim = i;
+		} else if (slot->last_used < best->last_used) {
+			victim = i;
+		}
+	}
+	return victim;
+}
+
+static uint16_t blocks_alloc(world_t* w, int8_t bx, int8_t by) {
+	assert(w);
+	assert(w->block[bx][by] == NO_BLOCK);
+
+	if (s_ctx->free == NO_BLOCK) {
+		blocks_release(blocks_pick_victim());
+		metrics_add(s_metrics.blocks_evicted, 1);
+	}
+	assert(s_ctx->free != NO_BLOCK);
+
+	const uint16_t i    = s_ctx->free;
+	block_slot_t*  slot = &s_ctx->slots[i];
+	s_ctx->free      = slot->next;
+	slot->owner     = w;
+	slot->x         = bx;
+	slot->y         = by;
+	slot->last_used = s_ctx->tick;
+
+	memset(&s_ctx->blocks[i], 0, sizeof(block_t));
+	w->block[bx][by] = i;
+
+	++s_ctx->num_resident;
+	metrics_change(s_metrics.blocks_resident, 1);
+
+	return i;
+}
+
+static terrain_t* blocks_tile(const world_t* w, block_index_t bi) {
+	assert(w);
+
+	const uint16_t i = w->block[bi.x][bi.y];
+	if (i == NO_BLOCK) return NULL;
+
+	s_ctx->slots[i].last_used = s_ctx->tick;
+	return &s_ctx->blocks[i].data[bi.rx][bi.ry];
+}
+
+static block_t* blocks_get_or_alloc(world_t* w, int8_t bx, int8_t by) {
+	uint16_t i = w->block[bx][by];
+	if (i == NO_BLOCK) i = blocks_alloc(w, bx, by);
+
+	s_ctx->slots[i].last_used = s_ctx->tick;
+	return &s_ctx->blocks[i];
+}
+
+// WORLDS
+// ======
+
+static world_t* world_create(const char* plane_id) {
+	assert(plane_id);
+	assert(s_ctx->num_worlds < MAX_PLANES);
+
+	world_t* w = BR_ALLOC(s_ctx->alloc, sizeof(world_t));
+	memset(w, 0, sizeof(world_t));
+
+	strncpy(w->plane_id, plane_id, WORLD_MAX_PLANE_ID_LENGTH - 1);
+	for (size_t i = 0; i < NUM_BLOCKS; ++i) {
+		for (size_t j = 0; j < NUM_BLOCKS; ++j) {
+			w->block[i][j] = NO_BLOCK;
+		}
+	}
+
+	s_ctx->worlds[s_ctx->num_worlds++] = w;
+	log_info("[world] Created a world for plane \"%s\"", w->plane_id);
+
+	return w;
+}
+
+static void world_free(world_t* w) {
+	assert(w);
+	BR_FREE(s_ctx->alloc, w);
+}
+
+// Gives its blocks back to the budget, responses still on the way create the world anew.
+static void world_destroy(size_t index) {
+	assert(index < s_ctx->num_worlds);
+
+	world_t* w = s_ctx->worlds[index];
+	assert(!w->is_active);
+
+	for (size_t i = 0; i < NUM_BLOCKS; ++i) {
+		for (size_t j = 0; j < NUM_BLOCKS; ++j) {
+			if (w->block[i][j] != NO_BLOCK) blocks_release(w->block[i][j]);
+		}
+	}
+
+	log_info("[world] Dropped the world for plane \"%s\"", w->plane_id);
+	world_free(w);
+	s_ctx->worlds[index] = s_ctx->worlds[--s_ctx->num_worlds];
+}
+
+static size_t world_least_recently_active() {
+	size_t victim = MAX_PLANES;
+	for (size_t i = 0; i < s_ctx->num_worlds; ++i) {
+		const world_t* w = s_ctx->worlds[i];
+		if (w->is_active) continue;
+		if (victim == MAX_PLANES || w->last_active < s_ctx->worlds[victim]->last_active) victim = i;
+	}
+	return victim;
+}
+
 // PUBLIC API
 // ==========
 
-struct world_t* world_create(struct allocator_t* alloc) {
+world_ctx_t* world_ctx_create(struct allocator_t* alloc) {
 	assert(alloc);
-	world_t* w = BR_ALLOC(alloc, sizeof(world_t));
-	memset(w, 0, sizeof(world_t));
-	w->alloc = alloc;
-	return w;
+
+	world_ctx_t* c = BR_ALLOC(alloc, sizeof(world_ctx_t));
+	memset(c, 0, sizeof(world_ctx_t));
+	return c;
+}
+
+void world_ctx_destroy(struct allocator_t* alloc, world_ctx_t* c) {
+	assert(alloc);
+	assert(c);
+	assert(c != s_ctx);
+	assert(!c->alloc);
+
+	BR_FREE(alloc, c);
+}
+
+void world_bind(world_ctx_t* c) {
+	s_ctx = c ? c : &s_default;
+}
+
+void world_init(struct allocator_t* alloc, size_t max_blocks) {
+	assert(alloc);
+	assert(!s_ctx->alloc);
+
+	s_ctx->alloc = alloc;
+	blocks_init(max_blocks);
+
+	s_metrics.blocks_resident = metrics_gauge("world.blocks_resident");
+	s_metrics.blocks_evicted  = metrics_counter("world.blocks_evicted");
+}
+
+void world_shutdown() {
+	for (size_t i = 0; i < s_ctx->num_worlds; ++i) {
+		world_free(s_ctx->worlds[i]);
+	}
+	s_ctx->num_worlds = 0;
+
+	blocks_shutdown();
+	s_ctx->alloc = NULL;
 }
 
-void world_free(struct world_t* w) {
+struct world_t* world_for_plane(const char* plane_id) {
+	assert(plane_id);
+
+	for (size_t i = 0; i < s_ctx->num_worlds; ++i) {
+		if (strncmp(s_ctx->worlds[i]->plane_id, plane_id, WORLD_MAX_PLANE_ID_LENGTH - 1) == 0) {
+			return s_ctx->worlds[i];
+		}
+	}
+
+	// Only the active one is left out, so there is always one to drop.
+	if (s_ctx->num_worlds == MAX_PLANES) world_destroy(world_least_recently_active());
+
+	return world_create(plane_id);
+}
+
+void world_activate(struct world_t* w) {
 	assert(w);
-	BR_FREE(w->alloc, w);
+
+	for (size_t i = 0; i < s_ctx->num_worlds; ++i) {
+		s_ctx->worlds[i]->is_active = s_ctx->worlds[i] == w;
+	}
+	w->last_active = s_ctx->tick;
+}
+
+const char* world_plane_id(const struct world_t* w) {
+	assert(w);
+	return w->plane_id;
 }
 
 void world_update(struct world_t* w, float dt) {
+	PROFILE_SCOPE("world_update");
 	assert(w);
-	
+
+	++s_ctx->tick;
+	w->last_active = s_ctx->tick;
+
+	client_map_block_t needed[NUM_BLOCKS * NUM_BLOCKS];
+	size_t             num_needed = 0;
+	client_map_block_t stale[NUM_BLOCKS * NUM_BLOCKS];
+	size_t             num_stale = 0;
+
 	for (size_t i = 0; i < NUM_BLOCKS; ++i) {
 		for (size_t j = 0; j < NUM_BLOCKS; ++j) {
 			switch (w->state[i][j]) {
-				case BLOCK_STATE_NA:
-					continue;
-
 				case BLOCK_STATE_NEEDED:
-					client_map(i * BLOCK_SIZE, j * BLOCK_SIZE, BLOCK_SIZE);
-					w->state[i][j] = BLOCK_STATE_REQUESTED;
+					needed[num_needed++] = (client_map_block_t) { .x = i, .y = j };
+					break;
+
+				case BLOCK_STATE_PRESENT:
+					w->age[i][j] += dt;
+					if (w->age[i][j] > BLOCK_LIFE_SPAN_SECONDS) w->state[i][j] = BLOCK_STATE_STALE;
+					break;
+
+				// Only the ones still looked at (last frame) are worth checking.
+				case BLOCK_STATE_STALE: {
+					const uint16_t b = w->block[i][j];
+					if (b != NO_BLOCK && s_ctx->slots[b].last_used + 1 >= s_ctx->tick) {
+						stale[num_stale++] = (client_map_block_t) { .x = i, .y = j };
+					}
 					break;
+				}
 
-				// TODO:
-				/* case BLOCK_STATE_PRESENT: */
-				/*	w->age[i][j] += dt; */
-				/*	if (w->age[i][j] > BLOCK_LIFE_SPAN_SECONDS) { */
-				/*		w->age[i][j]   = 0.0f; */
-				/*		w->state[i][j] = BLOCK_STATE_NA; */
-				/*	} */
-				/*	break; */
+				default:
+					continue;
 			}
 		}
 	}
+
+	// Adjacent blocks go out together, the rest stays needed until there is room for it.
+	if (num_needed > 0) client_map_batch(w->plane_id, BLOCK_SIZE, needed, num_needed, false);
+	if (num_stale  > 0) client_map_batch(w->plane_id, BLOCK_SIZE, stale,  num_stale,  true);
+
+	for (size_t i = 0; i < num_needed; ++i) {
+		if (needed[i].is_requested) w->state[needed[i].x][needed[i].y] = BLOCK_STATE_REQUESTED;
+	}
+	for (size_t i = 0; i < num_stale; ++i) {
+		if (stale[i].is_requested) w->state[stale[i].x][stale[i].y] = BLOCK_STATE_REVALIDATING;
+	}
 }
 
 void world_update_data(struct world_t* w, const struct api_map_t* map) {
 	assert(w);
 	assert(map);
-	
-	// TODO: @optimize Can calculate block spans and iterate per span.
-
-	const size_t N = map->size;
-
-	for (size_t i = 0; i < N; ++i) {
-		for (size_t j = 0; j < N; ++j) {
-			const int32_t tx = map->x + i;
-			const int32_t ty = map->y + j;
-			const block_index_t bi = to_block_index(tx, ty);
-			
-			w->state[bi.x][bi.y] = BLOCK_STATE_PRESENT;
-			w->age[bi.x][bi.y]	 = 0.0f;
-
-			const api_map_terrain_t* t = map->data + N * j + i;
-			w->terrain[bi.x][bi.y].data[bi.rx][bi.ry].is_hidden = t->is_hidden;
-			w->terrain[bi.x][bi.y].data[bi.rx][bi.ry].type		= t->type;
+
+	const int32_t N  = map->size;
+	const int32_t x0 = MAX(map->x, 0);
+	const int32_t y0 = MAX(map->y, 0);
+	const int32_t x1 = MIN(map->x + N, WORLD_PLANE_SIZE);
+	const int32_t y1 = MIN(map->y + N, WORLD_PLANE_SIZE);
+
+	if (x0 >= x1 || y0 >= y1) return;
+
+	const block_index_t b0 = to_block_index(x0,     y0);
+	const block_index_t b1 = to_block_index(x1 - 1, y1 - 1);
+
+	for (int32_t bx = b0.x; bx <= b1.x; ++bx) {
+		for (int32_t by = b0.y; by <= b1.y; ++by) {
+			// Block span covered by the map.
+			const int32_t sx0 = MAX(x0, bx * BLOCK_SIZE);
+			const int32_t sy0 = MAX(y0, by * BLOCK_SIZE);
+			const int32_t sx1 = MIN(x1, (bx + 1) * BLOCK_SIZE);
+			const int32_t sy1 = MIN(y1, (by + 1) * BLOCK_SIZE);
+
+			block_t* b = blocks_get_or_alloc(w, bx, by);
+
+			for (int32_t tx = sx0; tx < sx1; ++tx) {
+				for (int32_t ty = sy0; ty < sy1; ++ty) {
+					const api_map_terrain_t* t  = map->data + N * (ty - map->y) + (tx - map->x);
+					terrain_t*               wt = &b->data[tx - bx * BLOCK_SIZE][ty - by * BLOCK_SIZE];
+
+					// A tile patch is the server's answer for a reveal, whatever it is.
+					if (!t->is_hidden || N == 1) wt->is_revealing = false;
+					wt->is_hidden = t->is_hidden;
+					wt->type      = t->type;
+				}
+			}
+
+			// Partial updates (e.g. reveal patches) just refresh tiles, block has to be fetched as a whole.
+			if (sx1 - sx0 == BLOCK_SIZE && sy1 - sy0 == BLOCK_SIZE) {
+				w->state[bx][by] = BLOCK_STATE_PRESENT;
+				w->age[bx][by]   = 0.0f;
+			}
+		}
+	}
+}
+
+// Moves blocks of the map span from one state to another.
+static void map_blocks_in_state(struct world_t* w, const struct api_map_t* map, uint8_t state, uint8_t new_state) {
+	assert(w);
+	assert(map);
+
+	const int32_t x0 = MAX(map->x, 0);
+	const int32_t y0 = MAX(map->y, 0);
+	const int32_t x1 = MIN(map->x + (int32_t)map->size, WORLD_PLANE_SIZE);
+	const int32_t y1 = MIN(map->y + (int32_t)map->size, WORLD_PLANE_SIZE);
+
+	if (x0 >= x1 || y0 >= y1) return;
+
+	const block_index_t b0 = to_block_index(x0,     y0);
+	const block_index_t b1 = to_block_index(x1 - 1, y1 - 1);
+
+	for (int32_t bx = b0.x; bx <= b1.x; ++bx) {
+		for (int32_t by = b0.y; by <= b1.y; ++by) {
+			if (w->state[bx][by] != state) continue;
+
+			w->state[bx][by] = new_state;
+			if (new_state == BLOCK_STATE_PRESENT) w->age[bx][by] = 0.0f;
 		}
 	}
 }
 
+void world_update_unchanged(struct world_t* w, const struct api_map_t* map) {
+	map_blocks_in_state(w, map, BLOCK_STATE_REVALIDATING, BLOCK_STATE_PRESENT);
+}
+
+void world_update_failed(struct world_t* w, const struct api_map_t* map) {
+	map_blocks_in_state(w, map, BLOCK_STATE_REQUESTED, BLOCK_STATE_NA);
+	// Still good enough to show, checked again after another life span.
+	map_blocks_in_state(w, map, BLOCK_STATE_REVALIDATING, BLOCK_STATE_PRESENT);
+
+	// A tile is only fetched on its own after a reveal, there is no answer coming for it now.
+	const bool is_in_plane = map->x >= 0 && map->x < WORLD_PLANE_SIZE && map->y >= 0 && map->y < WORLD_PLANE_SIZE;
+	if (map->size == 1 && is_in_plane) world_reveal_rollback(w, map->x, map->y);
+}
+
+void world_reveal_begin(struct world_t* w, int32_t x, int32_t y) {
+	assert(w);
+	assert(x >= 0 && x < WORLD_PLANE_SIZE);
+	assert(y >= 0 && y < WORLD_PLANE_SIZE);
+
+	const block_index_t bi = to_block_index(x, y);
+	blocks_get_or_alloc(w, bi.x, bi.y)->data[bi.rx][bi.ry].is_revealing = true;
+}
+
+void world_reveal_rollback(struct world_t* w, int32_t x, int32_t y) {
+	assert(w);
+	assert(x >= 0 && x < WORLD_PLANE_SIZE);
+	assert(y >= 0 && y < WORLD_PLANE_SIZE);
+
+	terrain_t* t = blocks_tile(w, to_block_index(x, y));
+	if (t) t->is_revealing = false;
+}
+
+bool world_is_revealing(const struct world_t* w, int32_t x, int32_t y) {
+	assert(w);
+	assert(x >= 0 && x < WORLD_PLANE_SIZE);
+	assert(y >= 0 && y < WORLD_PLANE_SIZE);
+
+	const terrain_t* t = blocks_tile(w, to_block_index(x, y));
+	return t && t->is_revealing;
+}
+
 bool world_is_hidden(const struct world_t* w, int32_t x, int32_t y) {
 	assert(w);
 	assert(x >= 0 && x < WORLD_PLANE_SIZE);
@@ -140,8 +531,11 @@ bool world_is_hidden(const struct world_t* w, int32_t x, int32_t y) {
 	const block_index_t bi = to_block_index(x, y);
 	// TODO: Cast is a hack.
 	block_requested((struct world_t*)w, bi);
-	
-	return w->state[bi.x][bi.y] != BLOCK_STATE_PRESENT || w->terrain[bi.x][bi.y].data[bi.rx][bi.ry].is_hidden;
+
+	if (!block_has_data(w, bi)) return true;
+
+	const terrain_t* t = blocks_tile(w, bi);
+	return !t || t->is_hidden;
 }
 
 uint8_t world_terrain(const struct world_t* w, int32_t x, int32_t y) {
@@ -154,5 +548,8 @@ uint8_t world_terrain(const struct world_t* w, int32_t x, int32_t y) {
 	// TODO: Cast is a hack.
 	block_requested((struct world_t*)w, bi);
 
-	return w->state[bi.x][bi.y] == BLOCK_STATE_PRESENT ? w->terrain[bi.x][bi.y].data[bi.rx][bi.ry].type : 0;
+	if (!block_has_data(w, bi)) return 0;
+
+	const terrain_t* t = blocks_tile(w, bi);
+	return t ? t->type : 0;
 }
@@ -1,9 +1,11 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 #include <stdbool.h>
 
 #define WORLD_PLANE_SIZE 256
+#define WORLD_MAX_PLANE_ID_LENGTH 64
 
 // TODO: Move enums out.
 
@@ -40,10 +42,38 @@ struct allocator_t;
 struct api_map_t;
 struct world_t;
 
-struct world_t* world_create(struct allocator_t* alloc);
-void world_free(struct world_t* w);
+// Worlds of all planes with their blocks budget live in an instance, world_ calls work on the bound one.
+// App sticks to the built-in one, the load generator drives many of them in turn. Not thread-safe.
+typedef struct world_ctx_t world_ctx_t;
+
+world_ctx_t* world_ctx_create (struct allocator_t* alloc);
+// Must not be bound, shut down.
+void         world_ctx_destroy(struct allocator_t* alloc, world_ctx_t* c);
+// NULL binds the built-in one.
+void         world_bind       (world_ctx_t* c);
+
+// Worlds are kept per plane and share one budget of blocks, so travelling back
+// to a plane doesn't start from scratch. Blocks of inactive planes are evicted first.
+void            world_init(struct allocator_t* alloc, size_t max_blocks);
+void            world_shutdown();
+// Lazily creates a world for the plane.
+struct world_t* world_for_plane(const char* plane_id);
+void            world_activate(struct world_t* w);
+const char*     world_plane_id(const struct world_t* w);
+
 void world_update(struct world_t* w, float dt);
 void world_update_data(struct world_t* w, const struct api_map_t* map);
+// Revalidated blocks the server answered with a 304 for are fresh again.
+void world_update_unchanged(struct world_t* w, const struct api_map_t* map);
+// Blocks of a failed fetch go back to be asked for again, once they are needed.
+// A failed fetch of a single tile, refetched after a reveal, ends the reveal.
+void world_update_failed   (struct world_t* w, const struct api_map_t* map);
+
+// Optimistic reveal: tile is marked as revealing right away and is cleared either by
+// a patch from the server (see world_update_data) or by a rollback on error.
+void world_reveal_begin   (struct world_t* w, int32_t x, int32_t y);
+void world_reveal_rollback(struct world_t* w, int32_t x, int32_t y);
+bool world_is_revealing   (const struct world_t* w, int32_t x, int32_t y);
 
 // TODO: @optimize Add a request to get a map part (e.g. travel map needs one).
 bool    world_is_hidden(const struct world_t* w, int32_t x, int32_t y);